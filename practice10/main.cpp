@@ -24,8 +24,9 @@
 #include <glm/ext/scalar_constants.hpp>
 #include <glm/gtx/string_cast.hpp>
 
-#include "obj_parser.hpp"
-#include "stb_image.h"
+#include "obj_cache.hpp"
+#include "mesh_tangents.hpp"
+#include "texture_cache_gl.hpp"
 
 std::string to_string(std::string_view str)
 {
@@ -50,7 +51,7 @@ uniform mat4 view;
 uniform mat4 projection;
 
 layout (location = 0) in vec3 in_position;
-layout (location = 1) in vec3 in_tangent;
+layout (location = 1) in vec4 in_tangent;
 layout (location = 2) in vec3 in_normal;
 layout (location = 3) in vec2 in_texcoord;
 
@@ -63,7 +64,7 @@ void main()
 {
     position = (model * vec4(in_position, 1.0)).xyz;
     gl_Position = projection * view * vec4(position, 1.0);
-    tangent = mat3(model) * in_tangent;
+    tangent = mat3(model) * in_tangent.xyz;
     normal = mat3(model) * in_normal;
     texcoord = in_texcoord;
 }
@@ -140,7 +141,8 @@ GLuint create_program(GLuint vertex_shader, GLuint fragment_shader)
 struct vertex
 {
     glm::vec3 position;
-    glm::vec3 tangent;
+    // w is the bitangent sign: bitangent = w * cross(normal, tangent)
+    glm::vec4 tangent;
     glm::vec3 normal;
     glm::vec2 texcoords;
 };
@@ -159,7 +161,7 @@ std::pair<std::vector<vertex>, std::vector<std::uint32_t>> generate_sphere(float
             auto & vertex = vertices.emplace_back();
             vertex.normal = {std::cos(lat) * std::cos(lon), std::sin(lat), std::cos(lat) * std::sin(lon)};
             vertex.position = vertex.normal * radius;
-            vertex.tangent = {-std::cos(lat) * std::sin(lon), 0.f, std::cos(lat) * std::cos(lon)};
+            vertex.tangent = {-std::sin(lon), 0.f, std::cos(lon), -1.f};
             vertex.texcoords.x = (longitude * 1.f) / (4.f * quality);
             vertex.texcoords.y = (latitude * 1.f) / (2.f * quality) + 0.5f;
         }
@@ -183,25 +185,51 @@ std::pair<std::vector<vertex>, std::vector<std::uint32_t>> generate_sphere(float
     return {std::move(vertices), std::move(indices)};
 }
 
-GLuint load_texture(std::string const & path)
+// Loads an OBJ through the mesh cache; normals (if the file has none) and tangents
+// are generated when the cache is built and stored in it
+std::pair<std::vector<vertex>, std::vector<std::uint32_t>> load_model(std::filesystem::path const & path)
 {
-    int width, height, channels;
-    auto pixels = stbi_load(path.data(), &width, &height, &channels, 4);
+    obj_cache_processing tangent_generation{"tangents", [](obj_data & mesh)
+    {
+        if (!has_normals(mesh))
+            compute_normals(mesh);
+        compute_tangents(mesh);
+    }};
+
+    auto model = load_obj_cached(path, tangent_generation);
+
+    std::vector<vertex> vertices(model.vertices.size());
+    for (std::size_t i = 0; i < vertices.size(); ++i)
+    {
+        auto const & v = model.vertices[i];
+        auto const & t = model.tangents[i];
+        vertices[i].position = {v.position[0], v.position[1], v.position[2]};
+        vertices[i].tangent = {t[0], t[1], t[2], t[3]};
+        vertices[i].normal = {v.normal[0], v.normal[1], v.normal[2]};
+        vertices[i].texcoords = {v.texcoord[0], v.texcoord[1]};
+    }
+
+    return {std::move(vertices), std::vector<std::uint32_t>(model.indices.begin(), model.indices.end())};
+}
 
+GLuint create_texture(cached_texture const & texture)
+{
     GLuint result;
     glGenTextures(1, &result);
     glBindTexture(GL_TEXTURE_2D, result);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+    upload_texture(texture);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glGenerateMipmap(GL_TEXTURE_2D);
-
-    stbi_image_free(pixels);
 
     return result;
 }
 
-int main() try
+GLuint load_texture(std::string const & path)
+{
+    return create_texture(load_texture_cached(path, {}, pick_compression({{block_format::bc7}, {block_format::bc1}})));
+}
+
+int main(int argc, char ** argv) try
 {
     if (SDL_Init(SDL_INIT_VIDEO) != 0)
         sdl2_fail("SDL_Init: ");
@@ -259,7 +287,8 @@ int main() try
     glGenBuffers(1, &sphere_ebo);
     GLuint sphere_index_count;
     {
-        auto [vertices, indices] = generate_sphere(1.f, 16);
+        // An OBJ file given on the command line replaces the sphere
+        auto [vertices, indices] = (argc > 1) ? load_model(argv[1]) : generate_sphere(1.f, 16);
 
         glBindBuffer(GL_ARRAY_BUFFER, sphere_vbo);
         glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(vertices[0]), vertices.data(), GL_STATIC_DRAW);
@@ -272,7 +301,7 @@ int main() try
     glEnableVertexAttribArray(0);
     glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(vertex), (void *)offsetof(vertex, position));
     glEnableVertexAttribArray(1);
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(vertex), (void *)offsetof(vertex, tangent));
+    glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(vertex), (void *)offsetof(vertex, tangent));
     glEnableVertexAttribArray(2);
     glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(vertex), (void *)offsetof(vertex, normal));
     glEnableVertexAttribArray(3);
@@ -281,6 +310,15 @@ int main() try
     std::string project_root = PROJECT_ROOT;
     GLuint albedo_texture = load_texture(project_root + "/textures/brick_albedo.jpg");
 
+    // The gray maps share one two-channel texture; bricks aren't metallic.
+    // The current lighting doesn't sample it yet.
+    GLuint material_texture = create_texture(pack_textures({
+        packed_channel{project_root + "/textures/brick_ao.jpg"},
+        packed_channel{project_root + "/textures/brick_roughness.jpg"},
+        packed_channel{{}, swizzle_source::zero},
+        packed_channel{{}, swizzle_source::one},
+    }, {mip_filter::kaiser, false}));
+
     auto last_frame_start = std::chrono::high_resolution_clock::now();
 
     float time = 0.f;
@@ -0,0 +1,296 @@
+#include "mesh_tangents.hpp"
+#include "index_hash_map.hpp"
+#include "parallel_for.hpp"
+
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <exception>
+
+namespace
+{
+
+    using vec3 = std::array<float, 3>;
+
+    vec3 operator - (vec3 const & a, vec3 const & b)
+    {
+        return {a[0] - b[0], a[1] - b[1], a[2] - b[2]};
+    }
+
+    vec3 operator * (vec3 const & a, float s)
+    {
+        return {a[0] * s, a[1] * s, a[2] * s};
+    }
+
+    float dot(vec3 const & a, vec3 const & b)
+    {
+        return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+    }
+
+    vec3 cross(vec3 const & a, vec3 const & b)
+    {
+        return {a[1] * b[2] - a[2] * b[1], a[2] * b[0] - a[0] * b[2], a[0] * b[1] - a[1] * b[0]};
+    }
+
+    // Zero vectors stay zero
+    vec3 normalize(vec3 const & a)
+    {
+        float const length = std::sqrt(dot(a, a));
+        return length > 0.f ? a * (1.f / length) : vec3{0.f, 0.f, 0.f};
+    }
+
+    // Ranges smaller than this are not worth a separate thread
+    constexpr std::size_t min_items_per_thread = 1 << 14;
+
+    // Calls f(begin, end) for about equal ranges covering [0, count), in parallel
+    template <typename F>
+    void parallel_ranges(std::size_t count, std::size_t thread_count, F const & f)
+    {
+        if (thread_count == 0)
+            thread_count = std::max(1u, std::thread::hardware_concurrency());
+
+        std::size_t const range_count = std::max<std::size_t>(1, std::min(thread_count, count / min_items_per_thread));
+
+        parallel_for(range_count, [&](std::size_t i){
+            f(count * i / range_count, count * (i + 1) / range_count);
+        });
+    }
+
+    // Triangle corners (index positions) around each key, as offsets into one flat array.
+    // Gathering per key instead of scattering per triangle lets keys be processed in parallel.
+    struct corner_adjacency
+    {
+        std::vector<std::uint32_t> offsets;
+        std::vector<std::uint32_t> corners;
+
+        template <typename Key>
+        corner_adjacency(std::size_t key_count, std::size_t corner_count, Key const & key)
+            : offsets(key_count + 1, 0)
+            , corners(corner_count)
+        {
+            for (std::size_t c = 0; c < corner_count; ++c)
+                ++offsets[key(c) + 1];
+            for (std::size_t k = 0; k < key_count; ++k)
+                offsets[k + 1] += offsets[k];
+
+            std::vector<std::uint32_t> fill(offsets.begin(), offsets.end() - 1);
+            for (std::size_t c = 0; c < corner_count; ++c)
+                corners[fill[key(c)]++] = c;
+        }
+    };
+
+    vec3 const & corner_position(obj_data const & mesh, std::size_t corner)
+    {
+        return mesh.vertices[mesh.indices[corner]].position;
+    }
+
+    // Angle of every triangle corner; degenerate corners get 0 and so don't contribute
+    std::vector<float> corner_angles(obj_data const & mesh, std::size_t thread_count)
+    {
+        std::size_t const triangle_count = mesh.indices.size() / 3;
+        std::vector<float> angles(triangle_count * 3);
+
+        parallel_ranges(triangle_count, thread_count, [&](std::size_t begin, std::size_t end)
+        {
+            for (std::size_t t = begin; t < end; ++t)
+                for (std::size_t k = 0; k < 3; ++k)
+                {
+                    vec3 const & p = corner_position(mesh, 3 * t + k);
+                    vec3 const e1 = normalize(corner_position(mesh, 3 * t + (k + 1) % 3) - p);
+                    vec3 const e2 = normalize(corner_position(mesh, 3 * t + (k + 2) % 3) - p);
+                    float const cosine = dot(e1, e2);
+                    angles[3 * t + k] = (dot(e1, e1) > 0.f && dot(e2, e2) > 0.f) ? std::acos(std::clamp(cosine, -1.f, 1.f)) : 0.f;
+                }
+        });
+
+        return angles;
+    }
+
+    // Id of the first vertex with the same position
+    std::vector<std::uint32_t> position_remap(obj_data const & mesh)
+    {
+        std::vector<std::uint32_t> remap(mesh.vertices.size());
+
+        index_hash_map positions(mesh.vertices.size());
+        for (std::uint32_t v = 0; v < mesh.vertices.size(); ++v)
+        {
+            index_hash_map::key_type key;
+            for (std::size_t k = 0; k < 3; ++k)
+            {
+                // Adding zero turns -0 into +0, so both hash the same
+                float const coordinate = mesh.vertices[v].position[k] + 0.f;
+                std::memcpy(&key[k], &coordinate, sizeof(float));
+            }
+            remap[v] = positions.insert(key, v).first;
+        }
+
+        return remap;
+    }
+
+}
+
+bool has_normals(obj_data const & mesh)
+{
+    for (auto const & v : mesh.vertices)
+        if (v.normal[0] != 0.f || v.normal[1] != 0.f || v.normal[2] != 0.f)
+            return true;
+    return false;
+}
+
+void compute_normals(obj_data & mesh, std::size_t thread_count)
+{
+    std::size_t const vertex_count = mesh.vertices.size();
+    std::size_t const triangle_count = mesh.indices.size() / 3;
+
+    auto const remap = position_remap(mesh);
+    auto const angles = corner_angles(mesh, thread_count);
+
+    std::vector<vec3> face_normals(triangle_count);
+    parallel_ranges(triangle_count, thread_count, [&](std::size_t begin, std::size_t end)
+    {
+        for (std::size_t t = begin; t < end; ++t)
+        {
+            vec3 const & p0 = corner_position(mesh, 3 * t);
+            face_normals[t] = normalize(cross(corner_position(mesh, 3 * t + 1) - p0, corner_position(mesh, 3 * t + 2) - p0));
+        }
+    });
+
+    corner_adjacency adjacency(vertex_count, triangle_count * 3, [&](std::size_t c){ return remap[mesh.indices[c]]; });
+
+    // First the vertex that represents each position, then its copies
+    parallel_ranges(vertex_count, thread_count, [&](std::size_t begin, std::size_t end)
+    {
+        for (std::size_t v = begin; v < end; ++v)
+        {
+            if (remap[v] != v)
+                continue;
+
+            vec3 sum{0.f, 0.f, 0.f};
+            for (std::uint32_t i = adjacency.offsets[v]; i < adjacency.offsets[v + 1]; ++i)
+            {
+                std::uint32_t const c = adjacency.corners[i];
+                vec3 const & n = face_normals[c / 3];
+                for (std::size_t k = 0; k < 3; ++k)
+                    sum[k] += angles[c] * n[k];
+            }
+
+            mesh.vertices[v].normal = normalize(sum);
+        }
+    });
+
+    parallel_ranges(vertex_count, thread_count, [&](std::size_t begin, std::size_t end)
+    {
+        for (std::size_t v = begin; v < end; ++v)
+            mesh.vertices[v].normal = mesh.vertices[remap[v]].normal;
+    });
+}
+
+void compute_tangents(obj_data & mesh, std::size_t thread_count)
+{
+    std::size_t const triangle_count = mesh.indices.size() / 3;
+
+    auto const angles = corner_angles(mesh, thread_count);
+
+    // Unit directions of increasing u and v on each triangle; zero where the texcoords are degenerate
+    std::vector<vec3> face_tangents(triangle_count);
+    std::vector<vec3> face_bitangents(triangle_count);
+    // Whether the texcoords are mirrored on the triangle (negative uv determinant)
+    std::vector<std::uint8_t> face_mirrored(triangle_count);
+    parallel_ranges(triangle_count, thread_count, [&](std::size_t begin, std::size_t end)
+    {
+        for (std::size_t t = begin; t < end; ++t)
+        {
+            auto const & v0 = mesh.vertices[mesh.indices[3 * t]];
+            auto const & v1 = mesh.vertices[mesh.indices[3 * t + 1]];
+            auto const & v2 = mesh.vertices[mesh.indices[3 * t + 2]];
+
+            vec3 const e1 = v1.position - v0.position;
+            vec3 const e2 = v2.position - v0.position;
+            float const du1 = v1.texcoord[0] - v0.texcoord[0];
+            float const dv1 = v1.texcoord[1] - v0.texcoord[1];
+            float const du2 = v2.texcoord[0] - v0.texcoord[0];
+            float const dv2 = v2.texcoord[1] - v0.texcoord[1];
+
+            // Only the directions matter, so the 1 / determinant scale is reduced to its sign
+            face_mirrored[t] = (du1 * dv2 - du2 * dv1) < 0.f;
+            float const sign = face_mirrored[t] ? -1.f : 1.f;
+            face_tangents[t] = normalize((e1 * dv2 - e2 * dv1) * sign);
+            face_bitangents[t] = normalize((e2 * du1 - e1 * du2) * sign);
+        }
+    });
+
+    // Like MikkTSpace, corners of opposite handedness never share a tangent frame:
+    // a vertex used by both mirrored and unmirrored triangles (on a UV mirror seam
+    // without a texcoord split) gets a copy for its mirrored corners
+    {
+        std::size_t const vertex_count = mesh.vertices.size();
+        corner_adjacency adjacency(vertex_count, triangle_count * 3, [&](std::size_t c){ return mesh.indices[c]; });
+
+        for (std::size_t v = 0; v < vertex_count; ++v)
+        {
+            std::uint32_t mirrored = 0;
+            for (std::uint32_t i = adjacency.offsets[v]; i < adjacency.offsets[v + 1]; ++i)
+                mirrored += face_mirrored[adjacency.corners[i] / 3];
+
+            if (mirrored == 0 || mirrored == adjacency.offsets[v + 1] - adjacency.offsets[v])
+                continue;
+
+            std::uint32_t const copy = mesh.vertices.size();
+            auto const vertex = mesh.vertices[v];
+            mesh.vertices.push_back(vertex);
+
+            for (std::uint32_t i = adjacency.offsets[v]; i < adjacency.offsets[v + 1]; ++i)
+            {
+                std::uint32_t const c = adjacency.corners[i];
+                if (face_mirrored[c / 3])
+                    mesh.indices[c] = copy;
+            }
+        }
+    }
+
+    std::size_t const vertex_count = mesh.vertices.size();
+
+    corner_adjacency adjacency(vertex_count, triangle_count * 3, [&](std::size_t c){ return mesh.indices[c]; });
+
+    mesh.tangents.resize(vertex_count);
+    parallel_ranges(vertex_count, thread_count, [&](std::size_t begin, std::size_t end)
+    {
+        for (std::size_t v = begin; v < end; ++v)
+        {
+            vec3 const & n = mesh.vertices[v].normal;
+
+            vec3 tangent_sum{0.f, 0.f, 0.f};
+            vec3 bitangent_sum{0.f, 0.f, 0.f};
+            for (std::uint32_t i = adjacency.offsets[v]; i < adjacency.offsets[v + 1]; ++i)
+            {
+                std::uint32_t const c = adjacency.corners[i];
+                vec3 const & t = face_tangents[c / 3];
+                vec3 const & b = face_bitangents[c / 3];
+
+                // Project onto the vertex's tangent plane before averaging, like MikkTSpace does
+                vec3 const tp = normalize(t - n * dot(n, t));
+                vec3 const bp = normalize(b - n * dot(n, b));
+                for (std::size_t k = 0; k < 3; ++k)
+                {
+                    tangent_sum[k] += angles[c] * tp[k];
+                    bitangent_sum[k] += angles[c] * bp[k];
+                }
+            }
+
+            vec3 tangent = normalize(tangent_sum);
+            if (dot(tangent, tangent) == 0.f)
+            {
+                // No usable texcoords around the vertex: any direction in the tangent plane
+                vec3 const axis = std::abs(n[0]) < 0.9f ? vec3{1.f, 0.f, 0.f} : vec3{0.f, 1.f, 0.f};
+                tangent = normalize(axis - n * dot(n, axis));
+            }
+
+            float const w = dot(cross(n, tangent), bitangent_sum) < 0.f ? -1.f : 1.f;
+            mesh.tangents[v] = {tangent[0], tangent[1], tangent[2], w};
+        }
+    });
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include "obj_parser.hpp"
+
+// Whether any vertex has a non-zero normal; the parsers leave normals zero when the file has no vn
+bool has_normals(obj_data const & mesh);
+
+// Smooth normals: every vertex gets the normals of the triangles around its position,
+// weighted by the triangle's angle at that corner, so the result doesn't depend on how
+// the surface is triangulated. Vertices sharing a position share the normal, even across
+// texcoord seams. thread_count = 0 uses all available cores.
+void compute_normals(obj_data & mesh, std::size_t thread_count = 0);
+
+// Fills mesh.tangents in the MikkTSpace convention: xyz is the angle-weighted average of
+// the triangles' texcoord u directions projected onto the normal's plane, and w is the
+// sign for bitangent = w * cross(normal, tangent). Needs normals and texcoords.
+// Vertices shared by triangles with mirrored and unmirrored texcoords are split, so
+// vertices may be appended and indices changed.
+void compute_tangents(obj_data & mesh, std::size_t thread_count = 0);
@@ -0,0 +1,247 @@
+#include "mip_generator.hpp"
+#include "parallel_for.hpp"
+
+#include <cmath>
+#include <thread>
+#include <algorithm>
+#include <exception>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MIP_GENERATOR_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+
+    // Rows with fewer pixels than this in total are not worth a separate thread
+    constexpr std::size_t min_pixels_per_thread = 1 << 16;
+
+    // Calls f(begin, end) for about equal row ranges covering [0, rows), in parallel
+    template <typename F>
+    void parallel_rows(std::size_t rows, std::size_t row_pixels, std::size_t thread_count, F const & f)
+    {
+        std::size_t const range_count = std::max<std::size_t>(1, std::min(thread_count, rows * row_pixels / min_pixels_per_thread));
+
+        parallel_for(range_count, [&](std::size_t i){
+            f(rows * i / range_count, rows * (i + 1) / range_count);
+        });
+    }
+
+    float srgb_to_linear(float c)
+    {
+        return (c <= 0.04045f) ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+    }
+
+    // Conversions between 8-bit codes and linear values for one channel
+    struct channel_encoding
+    {
+        float decode[256];
+        // Linear values halfway between neighbouring codes, so encoding rounds in linear space
+        float thresholds[255];
+
+        explicit channel_encoding(bool srgb)
+        {
+            for (int i = 0; i < 256; ++i)
+                decode[i] = srgb ? srgb_to_linear(i / 255.f) : i / 255.f;
+            for (int i = 0; i < 255; ++i)
+                thresholds[i] = 0.5f * (decode[i] + decode[i + 1]);
+        }
+
+        std::uint8_t encode(float value) const
+        {
+            int code = 0;
+            for (int step = 128; step > 0; step /= 2)
+                if (value >= thresholds[code + step - 1])
+                    code += step;
+            return code;
+        }
+    };
+
+    channel_encoding const & encoding(bool srgb)
+    {
+        static channel_encoding const srgb_encoding(true);
+        static channel_encoding const linear_encoding(false);
+        return srgb ? srgb_encoding : linear_encoding;
+    }
+
+    // Source pixels and weights of each output pixel along one axis; indices are clamped to the edge
+    struct filter_taps
+    {
+        std::size_t tap_count = 0;
+        std::vector<std::uint32_t> indices;
+        std::vector<float> weights;
+    };
+
+    double bessel_i0(double x)
+    {
+        double sum = 1.0, term = 1.0;
+        for (int k = 1; k < 32; ++k)
+        {
+            term *= (x / (2.0 * k)) * (x / (2.0 * k));
+            sum += term;
+        }
+        return sum;
+    }
+
+    constexpr double pi = 3.14159265358979323846;
+
+    // Radius in output pixels and shape parameter of the Kaiser window
+    constexpr double kaiser_radius = 3.0;
+    constexpr double kaiser_alpha = 4.0;
+
+    double kaiser(double t)
+    {
+        if (std::abs(t) >= kaiser_radius)
+            return 0.0;
+        double const sinc = (t == 0.0) ? 1.0 : std::sin(pi * t) / (pi * t);
+        double const u = t / kaiser_radius;
+        return sinc * bessel_i0(kaiser_alpha * std::sqrt(1.0 - u * u)) / bessel_i0(kaiser_alpha);
+    }
+
+    filter_taps make_taps(std::uint32_t source_size, std::uint32_t size, mip_filter filter)
+    {
+        double const scale = double(source_size) / size;
+
+        std::vector<std::vector<std::pair<std::int64_t, double>>> taps(size);
+        for (std::uint32_t x = 0; x < size; ++x)
+        {
+            if (filter == mip_filter::box)
+            {
+                // Overlap of each source pixel with the output pixel's footprint
+                double const begin = x * scale, end = (x + 1) * scale;
+                for (auto s = static_cast<std::int64_t>(std::floor(begin)); s < end; ++s)
+                {
+                    double const overlap = std::min<double>(s + 1, end) - std::max<double>(s, begin);
+                    if (overlap > 0.0)
+                        taps[x].push_back({s, overlap});
+                }
+            }
+            else
+            {
+                double const center = (x + 0.5) * scale - 0.5;
+                double const radius = kaiser_radius * std::max(scale, 1.0);
+                for (auto s = static_cast<std::int64_t>(std::ceil(center - radius)); s <= center + radius; ++s)
+                    if (double const w = kaiser((s - center) / std::max(scale, 1.0)); w != 0.0)
+                        taps[x].push_back({s, w});
+            }
+        }
+
+        filter_taps result;
+        for (auto const & t : taps)
+            result.tap_count = std::max(result.tap_count, t.size());
+
+        // Pixels with fewer taps are padded with zero weights, so every pixel takes the same loop
+        result.indices.resize(size * result.tap_count, 0);
+        result.weights.resize(size * result.tap_count, 0.f);
+        for (std::uint32_t x = 0; x < size; ++x)
+        {
+            double sum = 0.0;
+            for (auto const & [s, w] : taps[x])
+                sum += w;
+            for (std::size_t k = 0; k < taps[x].size(); ++k)
+            {
+                result.indices[x * result.tap_count + k] = static_cast<std::uint32_t>(std::clamp<std::int64_t>(taps[x][k].first, 0, source_size - 1));
+                result.weights[x * result.tap_count + k] = static_cast<float>(taps[x][k].second / sum);
+            }
+        }
+        return result;
+    }
+
+    // Weighted sum of RGBA pixels, source[index * stride]
+    void accumulate(float const * source, std::size_t stride, filter_taps const & taps, std::size_t x, float * result)
+    {
+        std::uint32_t const * indices = taps.indices.data() + x * taps.tap_count;
+        float const * weights = taps.weights.data() + x * taps.tap_count;
+
+#ifdef MIP_GENERATOR_SSE2
+        __m128 sum = _mm_setzero_ps();
+        for (std::size_t k = 0; k < taps.tap_count; ++k)
+            sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(weights[k]), _mm_loadu_ps(source + indices[k] * stride)));
+        _mm_storeu_ps(result, sum);
+#else
+        float sum[4] = {};
+        for (std::size_t k = 0; k < taps.tap_count; ++k)
+            for (int c = 0; c < 4; ++c)
+                sum[c] += weights[k] * source[indices[k] * stride + c];
+        std::copy(sum, sum + 4, result);
+#endif
+    }
+
+    void clamp_pixel(float * pixel)
+    {
+#ifdef MIP_GENERATOR_SSE2
+        _mm_storeu_ps(pixel, _mm_min_ps(_mm_max_ps(_mm_loadu_ps(pixel), _mm_setzero_ps()), _mm_set1_ps(1.f)));
+#else
+        for (int c = 0; c < 4; ++c)
+            pixel[c] = std::clamp(pixel[c], 0.f, 1.f);
+#endif
+    }
+
+}
+
+std::vector<std::vector<std::uint8_t>> generate_mips(std::uint8_t const * pixels, std::uint32_t width, std::uint32_t height, mip_options const & options)
+{
+    std::size_t const thread_count = options.thread_count ? options.thread_count : std::max(1u, std::thread::hardware_concurrency());
+
+    auto const & color = encoding(options.srgb);
+    auto const & alpha = encoding(false);
+
+    std::vector<float> level(std::size_t(width) * height * 4);
+    parallel_rows(height, width, thread_count, [&](std::size_t begin, std::size_t end)
+    {
+        for (std::size_t i = begin * width * 4; i < end * width * 4; i += 4)
+        {
+            for (int c = 0; c < 3; ++c)
+                level[i + c] = color.decode[pixels[i + c]];
+            level[i + 3] = alpha.decode[pixels[i + 3]];
+        }
+    });
+
+    std::vector<std::vector<std::uint8_t>> result;
+    std::vector<float> horizontal;
+    std::vector<float> next;
+
+    while (width > 1 || height > 1)
+    {
+        std::uint32_t const next_width = std::max<std::uint32_t>(1, width / 2);
+        std::uint32_t const next_height = std::max<std::uint32_t>(1, height / 2);
+
+        auto const column_taps = make_taps(width, next_width, options.filter);
+        auto const row_taps = make_taps(height, next_height, options.filter);
+
+        // Rows are filtered first, then the columns of the narrower result
+        horizontal.resize(std::size_t(next_width) * height * 4);
+        parallel_rows(height, next_width, thread_count, [&](std::size_t begin, std::size_t end)
+        {
+            for (std::size_t y = begin; y < end; ++y)
+                for (std::size_t x = 0; x < next_width; ++x)
+                    accumulate(level.data() + y * width * 4, 4, column_taps, x, horizontal.data() + (y * next_width + x) * 4);
+        });
+
+        next.resize(std::size_t(next_width) * next_height * 4);
+        auto & encoded = result.emplace_back(next.size());
+        parallel_rows(next_height, next_width, thread_count, [&](std::size_t begin, std::size_t end)
+        {
+            for (std::size_t y = begin; y < end; ++y)
+                for (std::size_t x = 0; x < next_width; ++x)
+                {
+                    std::size_t const i = (y * next_width + x) * 4;
+                    accumulate(horizontal.data() + x * 4, next_width * 4, row_taps, y, next.data() + i);
+
+                    // The Kaiser filter's negative lobes can overshoot
+                    clamp_pixel(next.data() + i);
+
+                    for (int c = 0; c < 3; ++c)
+                        encoded[i + c] = color.encode(next[i + c]);
+                    encoded[i + 3] = alpha.encode(next[i + 3]);
+                }
+        });
+
+        std::swap(level, next);
+        width = next_width;
+        height = next_height;
+    }
+
+    return result;
+}
@@ -0,0 +1,477 @@
+#pragma once
+
+#include "obj_parser.hpp"
+#include "index_hash_map.hpp"
+#include "fast_number.hpp"
+
+#include <array>
+#include <string>
+#include <string_view>
+#include <sstream>
+#include <vector>
+#include <limits>
+#include <cstring>
+#include <algorithm>
+#include <stdexcept>
+#include <unordered_map>
+
+// The OBJ tokenizer and vertex builder behind the parse functions, shared by
+// obj_parser.cpp and the layout-specialized parse_obj<Layout> in obj_layout.hpp
+namespace obj_detail
+{
+
+    template <typename ... Args>
+    std::string to_string(Args const & ... args)
+    {
+        std::ostringstream os;
+        (os << ... << args);
+        return os.str();
+    }
+
+    // Turns 1-based or negative (relative) OBJ indices into 0-based ones, given how many
+    // positions, texcoords and normals were read before the face; missing attributes become -1
+    template <typename Fail>
+    std::array<std::int32_t, 3> resolve_index(std::array<std::int32_t, 3> index, bool has_texcoord, bool has_normal,
+        std::array<std::size_t, 3> const & sizes, Fail && fail)
+    {
+        if (index[0] > 0)
+            --index[0];
+        else
+            index[0] = sizes[0] + index[0];
+
+        if (has_texcoord)
+        {
+            if (index[1] > 0)
+                --index[1];
+            else
+                index[1] = sizes[1] + index[1];
+        }
+        else
+            index[1] = -1;
+
+        if (has_normal)
+        {
+            if (index[2] > 0)
+                --index[2];
+            else
+                index[2] = sizes[2] + index[2];
+        }
+        else
+            index[2] = -1;
+
+        if (index[0] >= sizes[0])
+            fail("bad position index (", index[0], ")");
+
+        if (index[1] != -1 && index[1] >= sizes[1])
+            fail("bad texcoord index (", index[1], ")");
+
+        if (index[2] != -1 && index[2] >= sizes[2])
+            fail("bad normal index (", index[2], ")");
+
+        return index;
+    }
+
+    // Whitespace as understood by std::isspace in the "C" locale, minus the line break
+    inline bool is_blank(char c)
+    {
+        return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+    }
+
+    inline bool is_space(char c)
+    {
+        return c == '\n' || is_blank(c);
+    }
+
+    inline std::string_view trim_end(std::string_view s)
+    {
+        while (!s.empty() && is_blank(s.back()))
+            s.remove_suffix(1);
+        return s;
+    }
+
+    // Fills in the used materials from the mtllib files, which are looked up relative to
+    // the OBJ file; missing files and undefined materials keep the defaults
+    void load_materials(std::filesystem::path const & path, std::vector<std::string> const & libraries, std::vector<obj_material> & materials);
+
+    inline bool by_material(obj_submesh const & a, obj_submesh const & b)
+    {
+        return a.material < b.material;
+    }
+
+    // Moves the submeshes' index ranges so that each material's triangles are contiguous,
+    // keeping the file order within a material
+    template <typename Mesh>
+    void sort_by_material(Mesh & data)
+    {
+        if (std::is_sorted(data.submeshes.begin(), data.submeshes.end(), by_material))
+            return;
+
+        std::stable_sort(data.submeshes.begin(), data.submeshes.end(), by_material);
+
+        std::vector<std::uint32_t> indices;
+        indices.reserve(data.indices.size());
+        for (auto & submesh : data.submeshes)
+        {
+            auto begin = data.indices.begin() + submesh.first_index;
+            submesh.first_index = indices.size();
+            indices.insert(indices.end(), begin, begin + submesh.index_count);
+        }
+
+        data.indices = std::move(indices);
+    }
+
+    constexpr float infinity = std::numeric_limits<float>::infinity();
+
+    // Pointer-based tokenizer over a single line of a memory-mapped file
+    struct line_tokenizer
+    {
+        char const * p;
+        char const * end;
+        // End of the readable buffer; numbers never span lines, so they may be scanned up to it
+        char const * buffer_end;
+
+        bool at_end() const
+        {
+            return p == end;
+        }
+
+        void skip_blank()
+        {
+            while (p != end && is_blank(*p))
+                ++p;
+        }
+
+        std::string_view token()
+        {
+            skip_blank();
+            char const * begin = p;
+            while (p != end && !is_blank(*p))
+                ++p;
+            return {begin, static_cast<std::size_t>(p - begin)};
+        }
+
+        // Same as rest_of_line
+        std::string_view rest()
+        {
+            skip_blank();
+            char const * begin = p;
+            p = end;
+            return trim_end({begin, static_cast<std::size_t>(end - begin)});
+        }
+
+        // Mirrors `stream >> value`: skips leading whitespace and accepts an explicit '+'
+        template <typename T>
+        bool number(T & value)
+        {
+            skip_blank();
+            if (p != end && *p == '+' && p + 1 != end && *(p + 1) != '-')
+                ++p;
+            return fast_number::parse(p, buffer_end, value);
+        }
+
+        template <std::size_t N>
+        void numbers(std::array<float, N> & values)
+        {
+            for (auto & value : values)
+                if (!number(value))
+                    return;
+        }
+
+        bool next_is_separator() const
+        {
+            return p == end || is_blank(*p);
+        }
+    };
+
+    // Shared by all parse modes: resolves face indices, deduplicates vertices
+    // and triangulates polygons. Vertices describes the output:
+    //   mesh_type, vertex_type     - the result, with vertices, indices, materials and submeshes
+    //   has_normals, has_texcoords - whether the vertices use these attributes; the others are
+    //                                only counted, and vertices differing in them are merged
+    //   write(vertex, position, normal, texcoord) - fills a vertex; missing attributes are null
+    template <typename Vertices>
+    struct basic_obj_builder
+    {
+        std::vector<std::array<float, 3>> positions;
+        std::vector<std::array<float, 3>> normals;
+        std::vector<std::array<float, 2>> texcoords;
+
+        // vn and vt lines read without storing their values
+        std::size_t skipped_normals = 0;
+        std::size_t skipped_texcoords = 0;
+
+        index_hash_map index_map;
+
+        typename Vertices::mesh_type result;
+
+        // Id of result.vertices[0]; nonzero once earlier vertices were handed out in batches
+        std::uint32_t vertex_base = 0;
+
+        std::size_t line_count = 0;
+
+        std::vector<std::uint32_t> face;
+        // Position index of each face corner, for the submesh bounds
+        std::vector<std::int32_t> face_positions;
+
+        // Current o, g and usemtl names; material ids are handed out in order of first use
+        std::string object;
+        std::string group;
+        std::uint32_t material = obj_no_material;
+        std::unordered_map<std::string, std::uint32_t> material_ids;
+        std::vector<std::string> material_libraries;
+
+        // Whether a directive came since the last submesh was started
+        bool state_changed = true;
+
+        // Number of indices handed out in earlier batches
+        std::size_t index_base = 0;
+
+        template <typename ... Args>
+        [[noreturn]] void fail(Args const & ... args) const
+        {
+            throw std::runtime_error(to_string("Error parsing OBJ data, line ", line_count, ": ", args...));
+        }
+
+        void add_position(line_tokenizer & ls)
+        {
+            ls.numbers(positions.emplace_back());
+        }
+
+        void add_normal(line_tokenizer & ls)
+        {
+            if constexpr (Vertices::has_normals)
+                ls.numbers(normals.emplace_back());
+            else
+                ++skipped_normals;
+        }
+
+        void add_texcoord(line_tokenizer & ls)
+        {
+            if constexpr (Vertices::has_texcoords)
+                ls.numbers(texcoords.emplace_back());
+            else
+                ++skipped_texcoords;
+        }
+
+        // Returns the id of the vertex with the given resolved index, creating it on first use
+        std::uint32_t insert_vertex(std::array<std::int32_t, 3> index)
+        {
+            if constexpr (!Vertices::has_texcoords)
+                index[1] = -1;
+            if constexpr (!Vertices::has_normals)
+                index[2] = -1;
+
+            auto [id, inserted] = index_map.insert(index, vertex_base + result.vertices.size());
+            if (inserted)
+                Vertices::write(result.vertices.emplace_back(), positions[index[0]],
+                    (index[2] != -1) ? &normals[index[2]] : nullptr,
+                    (index[1] != -1) ? &texcoords[index[1]] : nullptr);
+
+            return id;
+        }
+
+        void add_face_vertex(std::array<std::int32_t, 3> index, bool has_texcoord, bool has_normal)
+        {
+            std::array<std::size_t, 3> const sizes{positions.size(), texcoords.size() + skipped_texcoords, normals.size() + skipped_normals};
+            index = resolve_index(index, has_texcoord, has_normal, sizes, [this](auto const & ... args){ fail(args...); });
+
+            // Most files list their attributes before the first face, and each stored attribute
+            // value is usually used by at least one vertex, so the largest count is a close lower
+            // bound for the number of unique vertices
+            if (index_map.size() == 0)
+                index_map.reserve(std::max({positions.size(), texcoords.size(), normals.size()}));
+
+            face.push_back(insert_vertex(index));
+            face_positions.push_back(index[0]);
+        }
+
+        void end_face()
+        {
+            if (face.size() >= 3)
+            {
+                add_indices(index_base + result.indices.size(), 3 * (face.size() - 2));
+
+                auto & submesh = result.submeshes.back();
+                for (auto p : face_positions)
+                    for (std::size_t k = 0; k < 3; ++k)
+                    {
+                        submesh.min[k] = std::min(submesh.min[k], positions[p][k]);
+                        submesh.max[k] = std::max(submesh.max[k], positions[p][k]);
+                    }
+            }
+
+            for (std::size_t i = 1; i + 1 < face.size(); ++i)
+            {
+                result.indices.push_back(face[0]);
+                result.indices.push_back(face[i]);
+                result.indices.push_back(face[i + 1]);
+            }
+
+            face.clear();
+            face_positions.clear();
+        }
+
+        void set_object(std::string_view name)
+        {
+            object = name;
+            state_changed = true;
+        }
+
+        void set_group(std::string_view name)
+        {
+            group = name;
+            state_changed = true;
+        }
+
+        void use_material(std::string_view name)
+        {
+            auto [it, inserted] = material_ids.try_emplace(std::string(name), result.materials.size());
+            if (inserted)
+            {
+                obj_material new_material;
+                new_material.name = name;
+                result.materials.push_back(std::move(new_material));
+            }
+
+            material = it->second;
+            state_changed = true;
+        }
+
+        void add_material_library(std::string_view name)
+        {
+            material_libraries.emplace_back(name);
+        }
+
+        // Whether the next triangles belong to a different submesh than the last ones
+        bool starts_submesh() const
+        {
+            if (!state_changed) return false;
+            if (result.submeshes.empty()) return true;
+
+            auto const & last = result.submeshes.back();
+            return last.material != material || last.object != object || last.group != group;
+        }
+
+        // Adds count indices starting at first_index to the current submesh
+        void add_indices(std::size_t first_index, std::size_t count)
+        {
+            if (count == 0) return;
+
+            if (starts_submesh())
+                result.submeshes.push_back({
+                    object, group, material,
+                    static_cast<std::uint32_t>(first_index), 0,
+                    {infinity, infinity, infinity},
+                    {-infinity, -infinity, -infinity},
+                });
+            state_changed = false;
+
+            result.submeshes.back().index_count += count;
+        }
+
+        // Result of the parsers that return the whole mesh
+        typename Vertices::mesh_type finish(std::filesystem::path const & path)
+        {
+            load_materials(path, material_libraries, result.materials);
+            sort_by_material(result);
+            return std::move(result);
+        }
+    };
+
+    // Tokenizes OBJ records in [begin, end) and feeds them into the builder
+    template <typename Builder>
+    void scan_obj(char const * begin, char const * end, Builder & builder)
+    {
+        char const * p = begin;
+
+        while (true)
+        {
+            while (p != end && is_space(*p))
+                ++p;
+
+            if (p == end) break;
+
+            ++builder.line_count;
+
+            char const * line_end = static_cast<char const *>(std::memchr(p, '\n', end - p));
+            if (!line_end)
+                line_end = end;
+
+            line_tokenizer ls{p, line_end, end};
+            p = line_end;
+
+            if (*ls.p == '#') continue;
+
+            auto tag = ls.token();
+
+            if (tag == "v")
+                builder.add_position(ls);
+            else if (tag == "vn")
+                builder.add_normal(ls);
+            else if (tag == "vt")
+                builder.add_texcoord(ls);
+            else if (tag == "o")
+                builder.set_object(ls.rest());
+            else if (tag == "g")
+                builder.set_group(ls.rest());
+            else if (tag == "usemtl")
+                builder.use_material(ls.rest());
+            else if (tag == "mtllib")
+            {
+                for (auto name = ls.token(); !name.empty(); name = ls.token())
+                    builder.add_material_library(name);
+            }
+            else if (tag == "f")
+            {
+                while (true)
+                {
+                    std::array<std::int32_t, 3> index{0, 0, 0};
+                    bool has_texcoord = false;
+                    bool has_normal = false;
+
+                    ls.skip_blank();
+                    if (ls.at_end()) break;
+
+                    if (!ls.number(index[0]))
+                        builder.fail("expected position index");
+
+                    if (!ls.next_is_separator())
+                    {
+                        if (*ls.p++ != '/')
+                            builder.fail("expected '/'");
+
+                        if (ls.at_end() || *ls.p != '/')
+                        {
+                            if (!ls.number(index[1]))
+                                builder.fail("expected texcoord index");
+                            has_texcoord = true;
+
+                            if (!ls.next_is_separator())
+                            {
+                                if (*ls.p++ != '/')
+                                    builder.fail("expected '/'");
+
+                                if (!ls.number(index[2]))
+                                    builder.fail("expected normal index");
+                                has_normal = true;
+                            }
+                        }
+                        else
+                        {
+                            ++ls.p;
+
+                            if (!ls.number(index[2]))
+                                builder.fail("expected normal index");
+                            has_normal = true;
+                        }
+                    }
+
+                    builder.add_face_vertex(index, has_texcoord, has_normal);
+                }
+
+                builder.end_face();
+            }
+        }
+    }
+
+}
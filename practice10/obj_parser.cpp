@@ -1,46 +1,389 @@
 #include "obj_parser.hpp"
+#include "mapped_file.hpp"
+#include "obj_builder.hpp"
+#include "parallel_for.hpp"
 
 #include <string>
+#include <string_view>
 #include <sstream>
 #include <fstream>
 #include <stdexcept>
-#include <map>
+#include <cstring>
+#include <optional>
+#include <algorithm>
+#include <thread>
+#include <exception>
+#include <unordered_map>
 
 namespace
 {
 
-    template <typename ... Args>
-    std::string to_string(Args const & ... args)
+    using namespace obj_detail;
+
+    // The rest of the line without surrounding whitespace, for names that may contain spaces
+    std::string rest_of_line(std::istream & is)
     {
-        std::ostringstream os;
-        (os << ... << args);
-        return os.str();
+        std::string rest;
+        std::getline(is >> std::ws, rest);
+        rest.resize(trim_end(rest).size());
+        return rest;
+    }
+
+    void read_mtl(std::filesystem::path const & path, std::unordered_map<std::string_view, obj_material *> const & materials)
+    {
+        std::ifstream is(path);
+
+        obj_material * material = nullptr;
+
+        std::string line;
+        while (std::getline(is >> std::ws, line))
+        {
+            std::istringstream ls(std::move(line));
+
+            std::string tag;
+            ls >> tag;
+
+            if (tag == "newmtl")
+            {
+                auto it = materials.find(rest_of_line(ls));
+                material = (it != materials.end()) ? it->second : nullptr;
+                continue;
+            }
+
+            // Properties of materials the OBJ file never uses are skipped
+            if (!material) continue;
+
+            // Texture options (-bm, -s, ...) come before the file name
+            auto texture_path = [&]
+            {
+                std::string path;
+                for (std::string token; ls >> token;)
+                    path = std::move(token);
+                return path;
+            };
+
+            if (tag == "Ka")
+                ls >> material->ambient[0] >> material->ambient[1] >> material->ambient[2];
+            else if (tag == "Kd")
+                ls >> material->diffuse[0] >> material->diffuse[1] >> material->diffuse[2];
+            else if (tag == "Ks")
+                ls >> material->specular[0] >> material->specular[1] >> material->specular[2];
+            else if (tag == "Ns")
+                ls >> material->shininess;
+            else if (tag == "d")
+                ls >> material->opacity;
+            else if (tag == "Tr")
+            {
+                float transparency;
+                if (ls >> transparency)
+                    material->opacity = 1.f - transparency;
+            }
+            else if (tag == "map_Kd")
+                material->diffuse_texture = texture_path();
+            else if (tag == "map_Bump" || tag == "map_bump" || tag == "bump" || tag == "norm")
+                material->normal_texture = texture_path();
+        }
     }
 
 }
 
-obj_data parse_obj(std::filesystem::path const & path)
+void obj_detail::load_materials(std::filesystem::path const & path, std::vector<std::string> const & libraries, std::vector<obj_material> & materials)
 {
-    std::ifstream is(path);
+    if (materials.empty()) return;
 
-    std::vector<std::array<float, 3>> positions;
-    std::vector<std::array<float, 3>> normals;
-    std::vector<std::array<float, 2>> texcoords;
+    std::unordered_map<std::string_view, obj_material *> by_name;
+    for (auto & material : materials)
+        by_name.emplace(material.name, &material);
 
-    std::map<std::array<std::int32_t, 3>, std::uint32_t> index_map;
+    for (auto const & library : libraries)
+        read_mtl(path.parent_path() / library, by_name);
+}
 
-    obj_data result;
+namespace
+{
 
-    std::string line;
-    std::size_t line_count = 0;
+    void compute_submesh_bounds(obj_data & data)
+    {
+        for (auto & submesh : data.submeshes)
+        {
+            submesh.min = {infinity, infinity, infinity};
+            submesh.max = {-infinity, -infinity, -infinity};
+
+            for (std::size_t i = submesh.first_index; i < submesh.first_index + submesh.index_count; ++i)
+            {
+                auto const & position = data.vertices[data.indices[i]].position;
+                for (std::size_t k = 0; k < 3; ++k)
+                {
+                    submesh.min[k] = std::min(submesh.min[k], position[k]);
+                    submesh.max[k] = std::max(submesh.max[k], position[k]);
+                }
+            }
+        }
+    }
+
+    // Vertices as parse_obj returns them: all attributes, as floats
+    struct obj_data_vertices
+    {
+        using mesh_type = obj_data;
+        using vertex_type = obj_data::vertex;
+
+        static constexpr bool has_normals = true;
+        static constexpr bool has_texcoords = true;
+
+        static void write(vertex_type & v, std::array<float, 3> const & position, std::array<float, 3> const * normal,
+            std::array<float, 2> const * texcoord)
+        {
+            v.position = position;
+            v.normal = normal ? *normal : std::array<float, 3>{0.f, 0.f, 0.f};
+            v.texcoord = texcoord ? *texcoord : std::array<float, 2>{0.f, 0.f};
+        }
+    };
+
+    using obj_builder = basic_obj_builder<obj_data_vertices>;
+
+    // Hands out the vertices and triangles accumulated so far once a batch is full
+    struct obj_stream_builder
+        : obj_builder
+    {
+        std::size_t batch_size;
+        obj_batch_consumer const & consumer;
+
+        obj_stream_builder(std::size_t batch_size, obj_batch_consumer const & consumer)
+            : batch_size(batch_size)
+            , consumer(consumer)
+        {
+            result.vertices.reserve(batch_size);
+            result.indices.reserve(3 * batch_size);
+        }
+
+        void end_face()
+        {
+            // Keeps every batch within one submesh
+            if (face.size() >= 3 && starts_submesh())
+                flush();
+
+            obj_builder::end_face();
+
+            if (result.vertices.size() >= batch_size || result.indices.size() >= 3 * batch_size)
+                flush();
+        }
+
+        void flush()
+        {
+            if (result.vertices.empty() && result.indices.empty())
+                return;
+
+            std::uint32_t const batch_material = result.indices.empty() ? obj_no_material : result.submeshes.back().material;
+            consumer(obj_batch{vertex_base, result.vertices, result.indices, {}, batch_material});
+
+            vertex_base += result.vertices.size();
+            index_base += result.indices.size();
+            result.vertices.clear();
+            result.indices.clear();
+        }
+    };
+
+    // Chunks smaller than this are not worth a separate thread
+    constexpr std::size_t min_chunk_size = 1 << 20;
+
+    // Records from one line-aligned chunk of the file. Face indices are kept as written
+    // until the attribute counts of the preceding chunks are known.
+    struct obj_chunk
+    {
+        struct corner
+        {
+            std::array<std::int32_t, 3> index;
+            bool has_texcoord;
+            bool has_normal;
+        };
+
+        struct face_info
+        {
+            std::uint32_t size;
+            std::uint32_t line;
+            // Positions, texcoords and normals read so far in this chunk
+            std::array<std::uint32_t, 3> counts;
+        };
+
+        // An o, g, usemtl or mtllib line, replayed on the builder once the chunks are merged
+        struct directive
+        {
+            void (obj_builder::*apply)(std::string_view);
+            std::string name;
+            // Indices of the faces before it in this chunk
+            std::size_t index_position;
+        };
+
+        struct parse_error {};
+
+        std::vector<std::array<float, 3>> positions;
+        std::vector<std::array<float, 3>> normals;
+        std::vector<std::array<float, 2>> texcoords;
+
+        std::vector<corner> corners;
+        std::vector<face_info> faces;
+        std::size_t face_start = 0;
+
+        std::vector<directive> directives;
+        std::size_t scanned_index_count = 0;
+
+        std::size_t line_count = 0;
+
+        // First error in the chunk, with a chunk-local line number
+        std::optional<std::pair<std::size_t, std::string>> error;
+
+        // Resolved indices of the vertices first used in this chunk, in order of appearance,
+        // and the local vertex id of each face corner
+        std::vector<std::array<std::int32_t, 3>> unique_indices;
+        std::vector<std::uint32_t> corner_ids;
+        std::size_t index_count = 0;
+
+        template <typename ... Args>
+        [[noreturn]] void fail(Args const & ... args)
+        {
+            error.emplace(line_count, to_string(args...));
+            throw parse_error{};
+        }
+
+        void add_position(line_tokenizer & ls)
+        {
+            ls.numbers(positions.emplace_back());
+        }
+
+        void add_normal(line_tokenizer & ls)
+        {
+            ls.numbers(normals.emplace_back());
+        }
+
+        void add_texcoord(line_tokenizer & ls)
+        {
+            ls.numbers(texcoords.emplace_back());
+        }
+
+        void add_face_vertex(std::array<std::int32_t, 3> index, bool has_texcoord, bool has_normal)
+        {
+            corners.push_back({index, has_texcoord, has_normal});
+        }
+
+        void end_face()
+        {
+            faces.push_back({
+                static_cast<std::uint32_t>(corners.size() - face_start),
+                static_cast<std::uint32_t>(line_count),
+                {
+                    static_cast<std::uint32_t>(positions.size()),
+                    static_cast<std::uint32_t>(texcoords.size()),
+                    static_cast<std::uint32_t>(normals.size()),
+                },
+            });
+            face_start = corners.size();
+
+            if (faces.back().size >= 3)
+                scanned_index_count += 3 * (faces.back().size - 2);
+        }
+
+        void set_object(std::string_view name)
+        {
+            directives.push_back({&obj_builder::set_object, std::string(name), scanned_index_count});
+        }
+
+        void set_group(std::string_view name)
+        {
+            directives.push_back({&obj_builder::set_group, std::string(name), scanned_index_count});
+        }
+
+        void use_material(std::string_view name)
+        {
+            directives.push_back({&obj_builder::use_material, std::string(name), scanned_index_count});
+        }
+
+        void add_material_library(std::string_view name)
+        {
+            directives.push_back({&obj_builder::add_material_library, std::string(name), scanned_index_count});
+        }
+
+        void parse(char const * begin, char const * end)
+        {
+            try
+            {
+                scan_obj(begin, end, *this);
+            }
+            catch (parse_error const &)
+            {
+                corners.resize(face_start);
+            }
+        }
+
+        // offsets: number of positions, texcoords and normals in the preceding chunks
+        void resolve(std::array<std::size_t, 3> const & offsets)
+        {
+            index_hash_map local_map(corners.size());
+
+            corner_ids.reserve(corners.size());
+
+            auto c = corners.begin();
+            for (auto const & face : faces)
+            {
+                std::array<std::size_t, 3> const sizes{
+                    offsets[0] + face.counts[0],
+                    offsets[1] + face.counts[1],
+                    offsets[2] + face.counts[2],
+                };
+
+                try
+                {
+                    for (std::uint32_t i = 0; i < face.size; ++i, ++c)
+                    {
+                        auto index = resolve_index(c->index, c->has_texcoord, c->has_normal, sizes,
+                            [&](auto const & ... args){ error.emplace(face.line, to_string(args...)); throw parse_error{}; });
+
+                        auto [id, inserted] = local_map.insert(index, unique_indices.size());
+                        if (inserted)
+                            unique_indices.push_back(index);
+
+                        corner_ids.push_back(id);
+                    }
+                }
+                catch (parse_error const &)
+                {
+                    return;
+                }
+
+                if (face.size >= 3)
+                    index_count += 3 * (face.size - 2);
+            }
+        }
 
-    auto fail = [&](auto const & ... args){
-        throw std::runtime_error(to_string("Error parsing OBJ data, line ", line_count, ": ", args...));
+        // Triangulates the faces, mapping local vertex ids to global ones
+        void emit(std::vector<std::uint32_t> const & global_ids, std::uint32_t * out) const
+        {
+            auto id = corner_ids.begin();
+            for (auto const & face : faces)
+            {
+                for (std::size_t i = 1; i + 1 < face.size; ++i)
+                {
+                    *out++ = global_ids[id[0]];
+                    *out++ = global_ids[id[i]];
+                    *out++ = global_ids[id[i + 1]];
+                }
+                id += face.size;
+            }
+        }
     };
 
+}
+
+obj_data parse_obj(std::filesystem::path const & path)
+{
+    std::ifstream is(path);
+
+    obj_builder builder;
+
+    std::string line;
+
     while (std::getline(is >> std::ws, line))
     {
-        ++line_count;
+        ++builder.line_count;
 
         if (line.empty()) continue;
 
@@ -53,54 +396,64 @@ obj_data parse_obj(std::filesystem::path const & path)
 
         if (tag == "v")
         {
-            auto & p = positions.emplace_back();
+            auto & p = builder.positions.emplace_back();
             ls >> p[0] >> p[1] >> p[2];
         }
         else if (tag == "vn")
         {
-            auto & n = normals.emplace_back();
+            auto & n = builder.normals.emplace_back();
             ls >> n[0] >> n[1] >> n[2];
         }
         else if (tag == "vt")
         {
-            auto & t = texcoords.emplace_back();
+            auto & t = builder.texcoords.emplace_back();
             ls >> t[0] >> t[1];
         }
+        else if (tag == "o")
+            builder.set_object(rest_of_line(ls));
+        else if (tag == "g")
+            builder.set_group(rest_of_line(ls));
+        else if (tag == "usemtl")
+            builder.use_material(rest_of_line(ls));
+        else if (tag == "mtllib")
+        {
+            for (std::string name; ls >> name;)
+                builder.add_material_library(name);
+        }
         else if (tag == "f")
         {
-            std::vector<std::uint32_t> vertices;
-
             while (ls)
             {
                 std::array<std::int32_t, 3> index{0, 0, 0};
                 bool has_texcoord = false;
                 bool has_normal = false;
 
+                if ((ls >> std::ws).eof()) break;
+
                 ls >> index[0];
-                if (ls.eof()) break;
                 if (!ls)
-                    fail("expected position index");
+                    builder.fail("expected position index");
 
                 if (!std::isspace(ls.peek()) && !ls.eof())
                 {
                     if (ls.get() != '/')
-                        fail("expected '/'");
+                        builder.fail("expected '/'");
 
                     if (ls.peek() != '/')
                     {
                         ls >> index[1];
                         if (!ls)
-                            fail("expected texcoord index");
+                            builder.fail("expected texcoord index");
                         has_texcoord = true;
 
                         if (!std::isspace(ls.peek()) && !ls.eof())
                         {
                             if (ls.get() != '/')
-                                fail("expected '/'");
+                                builder.fail("expected '/'");
 
                             ls >> index[2];
                             if (!ls)
-                                fail("expected normal index");
+                                builder.fail("expected normal index");
                             has_normal = true;
                         }
                     }
@@ -110,76 +463,160 @@ obj_data parse_obj(std::filesystem::path const & path)
 
                         ls >> index[2];
                         if (!ls)
-                            fail("expected normal index");
+                            builder.fail("expected normal index");
                         has_normal = true;
                     }
                 }
 
-                if (index[0] > 0)
-                    --index[0];
-                else
-                    index[0] = positions.size() + index[0];
+                builder.add_face_vertex(index, has_texcoord, has_normal);
+            }
 
-                if (has_texcoord)
-                {
-                    if (index[1] > 0)
-                        --index[1];
-                    else
-                        index[1] = texcoords.size() + index[1];
-                }
-                else
-                    index[1] = -1;
+            builder.end_face();
+        }
+    }
 
-                if (has_normal)
-                {
-                    if (index[2] > 0)
-                        --index[2];
-                    else
-                        index[2] = normals.size() + index[2];
-                }
-                else
-                    index[2] = -1;
+    return builder.finish(path);
+}
 
-                if (index[0] >= positions.size())
-                    fail("bad position index (", index[0], ")");
+obj_data parse_obj_mapped(std::filesystem::path const & path)
+{
+    mapped_file file(path);
 
-                if (index[1] != -1 && index[1] >= texcoords.size())
-                    fail("bad texcoord index (", index[1], ")");
+    obj_builder builder;
+    scan_obj(file.begin(), file.end(), builder);
 
-                if (index[2] != -1 && index[2] >= normals.size())
-                    fail("bad normal index (", index[2], ")");
+    return builder.finish(path);
+}
 
-                auto it = index_map.find(index);
-                if (it == index_map.end())
-                {
-                    it = index_map.insert({index, result.vertices.size()}).first;
+obj_data parse_obj_parallel(std::filesystem::path const & path, std::size_t thread_count)
+{
+    mapped_file file(path);
 
-                    auto & v = result.vertices.emplace_back();
+    if (thread_count == 0)
+        thread_count = std::max(1u, std::thread::hardware_concurrency());
 
-                    v.position = positions[index[0]];
+    std::size_t const chunk_count = std::max<std::size_t>(1, std::min(thread_count, file.size() / min_chunk_size));
 
-                    if (index[1] != -1)
-                        v.texcoord = texcoords[index[1]];
-                    else
-                        v.texcoord = {0.f, 0.f};
+    std::vector<char const *> bounds{file.begin()};
+    for (std::size_t i = 1; i < chunk_count; ++i)
+    {
+        char const * p = std::max(bounds.back(), file.begin() + file.size() * i / chunk_count);
+        char const * line_end = static_cast<char const *>(std::memchr(p, '\n', file.end() - p));
+        bounds.push_back(line_end ? line_end + 1 : file.end());
+    }
+    bounds.push_back(file.end());
 
-                    if (index[2] != -1)
-                        v.normal = normals[index[2]];
-                    else
-                        v.normal = {0.f, 0.f, 0.f};
-                }
+    std::vector<obj_chunk> chunks(chunk_count);
 
-                vertices.push_back(it->second);
-            }
+    parallel_for(chunk_count, [&](std::size_t i){
+        chunks[i].parse(bounds[i], bounds[i + 1]);
+    });
 
-            for (std::size_t i = 1; i + 1 < vertices.size(); ++i)
-            {
-                result.indices.push_back(vertices[0]);
-                result.indices.push_back(vertices[i]);
-                result.indices.push_back(vertices[i + 1]);
-            }
+    obj_builder builder;
+
+    std::vector<std::array<std::size_t, 3>> offsets(chunk_count);
+    std::vector<std::size_t> line_offsets(chunk_count);
+    {
+        std::array<std::size_t, 3> total{0, 0, 0};
+        std::size_t lines = 0;
+        for (std::size_t i = 0; i < chunk_count; ++i)
+        {
+            offsets[i] = total;
+            line_offsets[i] = lines;
+            total[0] += chunks[i].positions.size();
+            total[1] += chunks[i].texcoords.size();
+            total[2] += chunks[i].normals.size();
+            lines += chunks[i].line_count;
+        }
+
+        builder.positions.resize(total[0]);
+        builder.texcoords.resize(total[1]);
+        builder.normals.resize(total[2]);
+    }
+
+    parallel_for(chunk_count, [&](std::size_t i){
+        auto & chunk = chunks[i];
+        std::copy(chunk.positions.begin(), chunk.positions.end(), builder.positions.begin() + offsets[i][0]);
+        std::copy(chunk.texcoords.begin(), chunk.texcoords.end(), builder.texcoords.begin() + offsets[i][1]);
+        std::copy(chunk.normals.begin(), chunk.normals.end(), builder.normals.begin() + offsets[i][2]);
+        chunk.resolve(offsets[i]);
+    });
+
+    // Chunks only stop at their first error, so the first failed chunk holds the first error in the file
+    for (std::size_t i = 0; i < chunk_count; ++i)
+    {
+        if (auto const & error = chunks[i].error)
+        {
+            builder.line_count = line_offsets[i] + error->first;
+            builder.fail(error->second);
         }
     }
 
-    return result;
+    // Going through the chunks in file order assigns vertex ids in order of first use,
+    // same as the serial parser does
+    std::vector<std::vector<std::uint32_t>> global_ids(chunk_count);
+    {
+        std::size_t unique_count = 0;
+        for (auto const & chunk : chunks)
+            unique_count += chunk.unique_indices.size();
+        builder.index_map.reserve(unique_count);
+    }
+    std::vector<std::size_t> index_offsets(chunk_count + 1, 0);
+    for (std::size_t i = 0; i < chunk_count; ++i)
+    {
+        global_ids[i].reserve(chunks[i].unique_indices.size());
+        for (auto const & index : chunks[i].unique_indices)
+            global_ids[i].push_back(builder.insert_vertex(index));
+
+        index_offsets[i + 1] = index_offsets[i] + chunks[i].index_count;
+    }
+
+    // Replaying the o / g / usemtl lines between the chunks' faces forms the same submeshes
+    // as the serial parser
+    for (std::size_t i = 0; i < chunk_count; ++i)
+    {
+        std::size_t position = 0;
+        for (auto const & directive : chunks[i].directives)
+        {
+            builder.add_indices(index_offsets[i] + position, directive.index_position - position);
+            position = directive.index_position;
+            (builder.*directive.apply)(directive.name);
+        }
+        builder.add_indices(index_offsets[i] + position, chunks[i].index_count - position);
+    }
+
+    builder.result.indices.resize(index_offsets.back());
+
+    parallel_for(chunk_count, [&](std::size_t i){
+        chunks[i].emit(global_ids[i], builder.result.indices.data() + index_offsets[i]);
+    });
+
+    compute_submesh_bounds(builder.result);
+
+    return builder.finish(path);
+}
+
+obj_stream_stats parse_obj_streaming(std::filesystem::path const & path, std::size_t batch_size, obj_batch_consumer const & consumer)
+{
+    mapped_file file(path);
+
+    obj_stream_stats stats;
+
+    // Count what was handed out, since the builder forgets each batch after the consumer returns
+    obj_batch_consumer counting_consumer = [&](obj_batch const & batch)
+    {
+        stats.vertex_count += batch.vertices.size();
+        stats.index_count += batch.indices.size();
+        consumer(batch);
+    };
+    obj_stream_builder builder(std::max<std::size_t>(batch_size, 1), counting_consumer);
+
+    scan_obj(file.begin(), file.end(), builder);
+    builder.flush();
+
+    load_materials(path, builder.material_libraries, builder.result.materials);
+    stats.materials = std::move(builder.result.materials);
+    stats.submeshes = std::move(builder.result.submeshes);
+
+    return stats;
 }
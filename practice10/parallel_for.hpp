@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstddef>
+#include <exception>
+#include <thread>
+#include <vector>
+
+// Runs f(0), ..., f(count - 1) on separate threads (f(0) on the calling one),
+// rethrowing the first exception once all of them have finished
+template <typename F>
+void parallel_for(std::size_t count, F const & f)
+{
+    std::vector<std::exception_ptr> errors(count);
+
+    auto run = [&](std::size_t i)
+    {
+        try
+        {
+            f(i);
+        }
+        catch (...)
+        {
+            errors[i] = std::current_exception();
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (std::size_t i = 1; i < count; ++i)
+        threads.emplace_back(run, i);
+
+    if (count > 0)
+        run(0);
+
+    for (auto & thread : threads)
+        thread.join();
+
+    for (auto const & error : errors)
+        if (error)
+            std::rethrow_exception(error);
+}
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <array>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <utility>
+#include <optional>
+
+// Flat open-addressing (linear probing) hash map from resolved OBJ index triples
+// (position, texcoord, normal) to vertex ids. Position indices are never negative,
+// so a slot with key[0] == -1 is empty. The backing array is kept across clear()
+// calls and only ever grows.
+struct index_hash_map
+{
+    using key_type = std::array<std::int32_t, 3>;
+
+    index_hash_map() = default;
+
+    explicit index_hash_map(std::size_t count)
+    {
+        reserve(count);
+    }
+
+    std::size_t size() const
+    {
+        return size_;
+    }
+
+    // Makes room for count entries without rehashing
+    void reserve(std::size_t count)
+    {
+        std::size_t capacity = 16;
+        while (capacity * max_load_num < count * max_load_den)
+            capacity *= 2;
+
+        if (capacity > slots_.size())
+            rehash(capacity);
+    }
+
+    void clear()
+    {
+        for (auto & slot : slots_)
+            slot.key[0] = -1;
+        size_ = 0;
+    }
+
+    // Returns the value stored for the key and whether it was inserted by this call
+    std::pair<std::uint32_t, bool> insert(key_type const & key, std::uint32_t value)
+    {
+        if ((size_ + 1) * max_load_den > slots_.size() * max_load_num)
+            rehash(slots_.empty() ? 16 : slots_.size() * 2);
+
+        std::size_t const mask = slots_.size() - 1;
+        for (std::size_t i = hash(key) & mask;; i = (i + 1) & mask)
+        {
+            auto & slot = slots_[i];
+            if (slot.key[0] == -1)
+            {
+                slot.key = key;
+                slot.value = value;
+                ++size_;
+                return {value, true};
+            }
+            if (slot.key == key)
+                return {slot.value, false};
+        }
+    }
+
+    std::optional<std::uint32_t> find(key_type const & key) const
+    {
+        if (slots_.empty())
+            return std::nullopt;
+
+        std::size_t const mask = slots_.size() - 1;
+        for (std::size_t i = hash(key) & mask;; i = (i + 1) & mask)
+        {
+            auto const & slot = slots_[i];
+            if (slot.key[0] == -1)
+                return std::nullopt;
+            if (slot.key == key)
+                return slot.value;
+        }
+    }
+
+private:
+    struct slot
+    {
+        key_type key{-1, -1, -1};
+        std::uint32_t value = 0;
+    };
+
+    // Keep the table at most half full so that probe sequences stay short
+    static constexpr std::size_t max_load_num = 1;
+    static constexpr std::size_t max_load_den = 2;
+
+    std::vector<slot> slots_;
+    std::size_t size_ = 0;
+
+    static std::size_t hash(key_type const & key)
+    {
+        std::uint64_t h = static_cast<std::uint32_t>(key[0]);
+        h = h * 0x9E3779B97F4A7C15ull + static_cast<std::uint32_t>(key[1]);
+        h = h * 0x9E3779B97F4A7C15ull + static_cast<std::uint32_t>(key[2]);
+        h ^= h >> 29;
+        h *= 0xBF58476D1CE4E5B9ull;
+        h ^= h >> 32;
+        return static_cast<std::size_t>(h);
+    }
+
+    void rehash(std::size_t capacity)
+    {
+        std::vector<slot> old(capacity);
+        old.swap(slots_);
+
+        std::size_t const mask = slots_.size() - 1;
+        for (auto const & s : old)
+        {
+            if (s.key[0] == -1) continue;
+
+            std::size_t i = hash(s.key) & mask;
+            while (slots_[i].key[0] != -1)
+                i = (i + 1) & mask;
+            slots_[i] = s;
+        }
+    }
+};
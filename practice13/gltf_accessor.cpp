@@ -0,0 +1,113 @@
+#include "gltf_accessor.hpp"
+
+#include <limits>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define GLTF_ACCESSOR_SSE2
+#include <emmintrin.h>
+#endif
+
+unsigned int gltf_component_size(unsigned int type)
+{
+    switch (type)
+    {
+    case gltf_byte:
+    case gltf_unsigned_byte:
+        return 1;
+    case gltf_short:
+    case gltf_unsigned_short:
+        return 2;
+    case gltf_unsigned_int:
+    case gltf_float:
+        return 4;
+    }
+    throw std::runtime_error("Unknown component type " + std::to_string(type));
+}
+
+namespace
+{
+
+#ifdef GLTF_ACCESSOR_SSE2
+
+    // Converts four 32-bit integers and applies the normalization divisor and lower limit;
+    // dividing rather than multiplying by the reciprocal keeps results equal to the scalar path
+    void store(float * result, __m128i values, __m128 divisor, __m128 min)
+    {
+        _mm_storeu_ps(result, _mm_max_ps(_mm_div_ps(_mm_cvtepi32_ps(values), divisor), min));
+    }
+
+    // Converts the whole 16-byte blocks of 8-bit or 16-bit components and returns how many
+    // components were converted
+    std::size_t convert_blocks(char const * data, unsigned int type, bool normalized, std::size_t count, float * result)
+    {
+        float divisor = 1.f;
+        float min = -std::numeric_limits<float>::infinity();
+        if (normalized) switch (type)
+        {
+        case gltf_byte: divisor = 127.f; min = -1.f; break;
+        case gltf_unsigned_byte: divisor = 255.f; break;
+        case gltf_short: divisor = 32767.f; min = -1.f; break;
+        case gltf_unsigned_short: divisor = 65535.f; break;
+        }
+
+        __m128 const divisor4 = _mm_set1_ps(divisor);
+        __m128 const min4 = _mm_set1_ps(min);
+        __m128i const zero = _mm_setzero_si128();
+
+        std::size_t i = 0;
+        switch (type)
+        {
+        case gltf_byte:
+        case gltf_unsigned_byte:
+            for (; i + 16 <= count; i += 16)
+            {
+                __m128i const bytes = _mm_loadu_si128(reinterpret_cast<__m128i const *>(data + i));
+
+                // Signed bytes are widened by duplicating them into the high half and shifting back
+                __m128i const low = type == gltf_byte ? _mm_srai_epi16(_mm_unpacklo_epi8(bytes, bytes), 8) : _mm_unpacklo_epi8(bytes, zero);
+                __m128i const high = type == gltf_byte ? _mm_srai_epi16(_mm_unpackhi_epi8(bytes, bytes), 8) : _mm_unpackhi_epi8(bytes, zero);
+
+                __m128i const words[2] = {low, high};
+                for (int w = 0; w < 2; ++w)
+                {
+                    __m128i const word_sign = type == gltf_byte ? _mm_srai_epi16(words[w], 15) : zero;
+                    store(result + i + w * 8, _mm_unpacklo_epi16(words[w], word_sign), divisor4, min4);
+                    store(result + i + w * 8 + 4, _mm_unpackhi_epi16(words[w], word_sign), divisor4, min4);
+                }
+            }
+            break;
+        case gltf_short:
+        case gltf_unsigned_short:
+            for (; i + 8 <= count; i += 8)
+            {
+                __m128i const words = _mm_loadu_si128(reinterpret_cast<__m128i const *>(data + i * 2));
+                __m128i const sign = type == gltf_short ? _mm_srai_epi16(words, 15) : zero;
+                store(result + i, _mm_unpacklo_epi16(words, sign), divisor4, min4);
+                store(result + i + 4, _mm_unpackhi_epi16(words, sign), divisor4, min4);
+            }
+            break;
+        }
+        return i;
+    }
+
+#endif
+
+}
+
+void convert_components(char const * data, unsigned int type, bool normalized, std::size_t count, float * result)
+{
+    if (type == gltf_float)
+    {
+        std::memcpy(result, data, count * sizeof(float));
+        return;
+    }
+
+    std::size_t i = 0;
+#ifdef GLTF_ACCESSOR_SSE2
+    i = convert_blocks(data, type, normalized, count, result);
+#endif
+
+    std::size_t const component_size = gltf_component_size(type);
+    for (; i < count; ++i)
+        result[i] = gltf_detail::read_component<float>(data + i * component_size, type, normalized);
+}
@@ -0,0 +1,319 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <type_traits>
+#include <iterator>
+#include <algorithm>
+#include <stdexcept>
+
+#include <glm/vec2.hpp>
+#include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+#include <glm/mat4x4.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+// Component types of glTF accessors, same values as the GL enums
+enum gltf_component_type : unsigned int
+{
+    gltf_byte = 0x1400,
+    gltf_unsigned_byte = 0x1401,
+    gltf_short = 0x1402,
+    gltf_unsigned_short = 0x1403,
+    gltf_unsigned_int = 0x1405,
+    gltf_float = 0x1406,
+};
+
+unsigned int gltf_component_size(unsigned int type);
+
+// An accessor resolved to pointers into mapped buffers, see gltf_model::resolve
+struct accessor_source
+{
+    // Null for an accessor without a buffer view, whose elements are zero unless sparse
+    char const * data = nullptr;
+    std::size_t stride = 0;
+    unsigned int type = gltf_float;
+    unsigned int components = 0;
+    bool normalized = false;
+    std::size_t count = 0;
+
+    // Elements substituted by a sparse accessor: strictly increasing indices and their values
+    std::size_t sparse_count = 0;
+    char const * sparse_indices = nullptr;
+    unsigned int sparse_index_type = gltf_unsigned_int;
+    char const * sparse_values = nullptr;
+};
+
+// Converts count * components components, stored contiguously, to floats; uses SSE2 where available
+void convert_components(char const * data, unsigned int type, bool normalized, std::size_t count, float * result);
+
+namespace gltf_detail
+{
+
+    template <typename Scalar, typename Stored>
+    Scalar load(char const * data)
+    {
+        Stored value;
+        std::memcpy(&value, data, sizeof(value));
+        return static_cast<Scalar>(value);
+    }
+
+    template <typename Scalar>
+    Scalar read_component(char const * data, unsigned int type, bool normalized)
+    {
+        if constexpr (std::is_floating_point_v<Scalar>)
+            if (normalized) switch (type)
+            {
+            case gltf_byte:
+                return std::max(load<Scalar, std::int8_t>(data) / Scalar(127), Scalar(-1));
+            case gltf_unsigned_byte:
+                return load<Scalar, std::uint8_t>(data) / Scalar(255);
+            case gltf_short:
+                return std::max(load<Scalar, std::int16_t>(data) / Scalar(32767), Scalar(-1));
+            case gltf_unsigned_short:
+                return load<Scalar, std::uint16_t>(data) / Scalar(65535);
+            }
+
+        switch (type)
+        {
+        case gltf_byte:
+            return load<Scalar, std::int8_t>(data);
+        case gltf_unsigned_byte:
+            return load<Scalar, std::uint8_t>(data);
+        case gltf_short:
+            return load<Scalar, std::int16_t>(data);
+        case gltf_unsigned_short:
+            return load<Scalar, std::uint16_t>(data);
+        case gltf_unsigned_int:
+            return load<Scalar, std::uint32_t>(data);
+        case gltf_float:
+            return load<Scalar, float>(data);
+        }
+        throw std::runtime_error("Unknown component type " + std::to_string(type));
+    }
+
+}
+
+// How elements of type T are built from accessor components; packed types are laid out
+// exactly as their components, so bulk conversion can write them directly
+template <typename T>
+struct accessor_element;
+
+template <>
+struct accessor_element<float>
+{
+    using scalar = float;
+    static constexpr unsigned int components = 1;
+    static constexpr bool packed = true;
+    static float make(scalar const * c) { return c[0]; }
+};
+
+template <>
+struct accessor_element<std::uint32_t>
+{
+    using scalar = std::uint32_t;
+    static constexpr unsigned int components = 1;
+    static constexpr bool packed = true;
+    static std::uint32_t make(scalar const * c) { return c[0]; }
+};
+
+template <glm::length_t N, typename S>
+struct accessor_element<glm::vec<N, S>>
+{
+    using scalar = S;
+    static constexpr unsigned int components = N;
+    static constexpr bool packed = sizeof(glm::vec<N, S>) == N * sizeof(S);
+    static glm::vec<N, S> make(scalar const * c)
+    {
+        glm::vec<N, S> result;
+        for (glm::length_t k = 0; k < N; ++k)
+            result[k] = c[k];
+        return result;
+    }
+};
+
+// glTF stores quaternions as x, y, z, w, while glm::quat starts with w
+template <>
+struct accessor_element<glm::quat>
+{
+    using scalar = float;
+    static constexpr unsigned int components = 4;
+    static constexpr bool packed = false;
+    static glm::quat make(scalar const * c) { return glm::quat(c[3], c[0], c[1], c[2]); }
+};
+
+// Only float matrices are supported, since integer ones pad their columns
+template <>
+struct accessor_element<glm::mat4>
+{
+    using scalar = float;
+    static constexpr unsigned int components = 16;
+    static constexpr bool packed = true;
+    static glm::mat4 make(scalar const * c)
+    {
+        // Both are column-major
+        glm::mat4 result;
+        for (int column = 0; column < 4; ++column)
+            for (int row = 0; row < 4; ++row)
+                result[column][row] = c[column * 4 + row];
+        return result;
+    }
+};
+
+// Elements of an accessor read in place from the buffer, converting component types,
+// normalizing, following the stride and substituting sparse values on the fly
+template <typename T>
+struct accessor_view
+{
+    using traits = accessor_element<T>;
+    using scalar = typename traits::scalar;
+
+    struct iterator
+    {
+        using iterator_category = std::random_access_iterator_tag;
+        using value_type = T;
+        using difference_type = std::ptrdiff_t;
+        using pointer = void;
+        using reference = T;
+
+        accessor_view const * view = nullptr;
+        std::size_t index = 0;
+
+        T operator * () const { return (*view)[index]; }
+        T operator [] (difference_type n) const { return (*view)[index + n]; }
+
+        iterator & operator ++ () { ++index; return *this; }
+        iterator & operator -- () { --index; return *this; }
+        iterator operator ++ (int) { auto copy = *this; ++index; return copy; }
+        iterator operator -- (int) { auto copy = *this; --index; return copy; }
+        iterator & operator += (difference_type n) { index += n; return *this; }
+        iterator & operator -= (difference_type n) { index -= n; return *this; }
+
+        friend iterator operator + (iterator it, difference_type n) { return it += n; }
+        friend iterator operator + (difference_type n, iterator it) { return it += n; }
+        friend iterator operator - (iterator it, difference_type n) { return it -= n; }
+        friend difference_type operator - (iterator const & a, iterator const & b) { return static_cast<difference_type>(a.index) - static_cast<difference_type>(b.index); }
+
+        friend bool operator == (iterator const & a, iterator const & b) { return a.index == b.index; }
+        friend auto operator <=> (iterator const & a, iterator const & b) { return a.index <=> b.index; }
+    };
+
+    accessor_view() = default;
+
+    explicit accessor_view(accessor_source const & source)
+        : source_(source)
+    {
+        if (source.components != traits::components)
+            throw std::runtime_error("Accessor has " + std::to_string(source.components) + " components, expected " + std::to_string(traits::components));
+        if (traits::components == 16 && source.type != gltf_float)
+            throw std::runtime_error("Only float matrix accessors are supported");
+    }
+
+    std::size_t size() const { return source_.count; }
+    bool empty() const { return source_.count == 0; }
+
+    T operator [] (std::size_t index) const
+    {
+        scalar c[traits::components];
+
+        char const * element = nullptr;
+        if (auto sparse = find_sparse(index); sparse != source_.sparse_count)
+            element = source_.sparse_values + sparse * element_size();
+        else if (source_.data)
+            element = source_.data + index * source_.stride;
+
+        std::size_t const component_size = gltf_component_size(source_.type);
+        for (unsigned int k = 0; k < traits::components; ++k)
+            c[k] = element ? gltf_detail::read_component<scalar>(element + k * component_size, source_.type, source_.normalized) : scalar(0);
+
+        return traits::make(c);
+    }
+
+    T front() const { return (*this)[0]; }
+    T back() const { return (*this)[size() - 1]; }
+
+    iterator begin() const { return {this, 0}; }
+    iterator end() const { return {this, size()}; }
+
+    // Bulk conversion, for when the elements really need to be copied
+    void copy_to(T * result) const
+    {
+        if constexpr (traits::packed)
+            copy_packed(reinterpret_cast<scalar *>(result));
+        else
+            for (std::size_t i = 0; i < size(); ++i)
+                result[i] = (*this)[i];
+    }
+
+    std::vector<T> to_vector() const
+    {
+        std::vector<T> result(size());
+        copy_to(result.data());
+        return result;
+    }
+
+private:
+    accessor_source source_;
+
+    std::size_t element_size() const
+    {
+        return gltf_component_size(source_.type) * traits::components;
+    }
+
+    std::size_t sparse_index(std::size_t i) const
+    {
+        return gltf_detail::read_component<std::size_t>(source_.sparse_indices + i * gltf_component_size(source_.sparse_index_type), source_.sparse_index_type, false);
+    }
+
+    // Position of index among the sparse indices, or sparse_count if it isn't substituted
+    std::size_t find_sparse(std::size_t index) const
+    {
+        std::size_t begin = 0, end = source_.sparse_count;
+        while (begin < end)
+        {
+            std::size_t const middle = (begin + end) / 2;
+            std::size_t const value = sparse_index(middle);
+            if (value == index)
+                return middle;
+            if (value < index)
+                begin = middle + 1;
+            else
+                end = middle;
+        }
+        return source_.sparse_count;
+    }
+
+    void copy_packed(scalar * result) const
+    {
+        std::size_t const components = traits::components;
+
+        if (!source_.data)
+            std::fill(result, result + size() * components, scalar(0));
+        else if constexpr (std::is_same_v<scalar, float>)
+        {
+            // Tightly packed elements convert as one run of components
+            if (source_.stride == element_size())
+                convert_components(source_.data, source_.type, source_.normalized, size() * components, result);
+            else for (std::size_t i = 0; i < size(); ++i)
+                convert_components(source_.data + i * source_.stride, source_.type, source_.normalized, components, result + i * components);
+        }
+        else
+        {
+            std::size_t const component_size = gltf_component_size(source_.type);
+            for (std::size_t i = 0; i < size(); ++i)
+                for (std::size_t k = 0; k < components; ++k)
+                    result[i * components + k] = gltf_detail::read_component<scalar>(source_.data + i * source_.stride + k * component_size, source_.type, source_.normalized);
+        }
+
+        std::size_t const component_size = gltf_component_size(source_.type);
+        for (std::size_t s = 0; s < source_.sparse_count; ++s)
+        {
+            std::size_t const index = sparse_index(s);
+            for (std::size_t k = 0; k < components; ++k)
+                result[index * components + k] = gltf_detail::read_component<scalar>(source_.sparse_values + s * element_size() + k * component_size, source_.type, source_.normalized);
+        }
+    }
+};
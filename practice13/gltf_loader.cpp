@@ -1,10 +1,13 @@
 #include "gltf_loader.hpp"
 
 #include <rapidjson/document.h>
-#include <rapidjson/istreamwrapper.h>
 
-#include <fstream>
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
 #include <stdexcept>
+#include <string_view>
+#include <vector>
 
 static unsigned int attribute_type_to_size(std::string const & type)
 {
@@ -12,69 +15,363 @@ static unsigned int attribute_type_to_size(std::string const & type)
     if (type == "VEC2") return 2;
     if (type == "VEC3") return 3;
     if (type == "VEC4") return 4;
+    if (type == "MAT2") return 4;
+    if (type == "MAT3") return 9;
+    if (type == "MAT4") return 16;
     return 0;
     throw std::runtime_error("Unknown attribute type: " + type);
 }
 
-gltf_model load_gltf(std::filesystem::path const & path)
+static unsigned int get_uint(rapidjson::Value const & object, char const * name, unsigned int default_value)
+{
+    auto it = object.FindMember(name);
+    return (it == object.MemberEnd()) ? default_value : it->value.GetUint();
+}
+
+static std::uint32_t read_uint32(char const * data)
 {
-    rapidjson::Document document;
+    std::uint32_t result;
+    std::memcpy(&result, data, sizeof(result));
+    return result;
+}
 
+static constexpr std::uint32_t glb_magic = 0x46546C67; // "glTF"
+static constexpr std::uint32_t glb_json_chunk = 0x4E4F534A; // "JSON"
+static constexpr std::uint32_t glb_bin_chunk = 0x004E4942; // "BIN\0"
+
+static bool is_glb(mapped_file const & file)
+{
+    return file.size() >= 12 && read_uint32(file.data()) == glb_magic;
+}
+
+// Splits a .glb into its JSON chunk and optional BIN chunk, both pointing into the mapping
+static std::pair<std::string_view, std::span<char const>> read_glb_chunks(mapped_file const & file, std::filesystem::path const & path)
+{
+    if (read_uint32(file.data() + 4) != 2)
+        throw std::runtime_error("Unsupported .glb version in " + path.string());
+
+    std::size_t const length = std::min<std::size_t>(read_uint32(file.data() + 8), file.size());
+
+    std::string_view json;
+    std::span<char const> bin;
+
+    for (std::size_t offset = 12; offset + 8 <= length;)
     {
-        std::ifstream input(path, std::ios::binary);
-        rapidjson::IStreamWrapper stream(input);
-        document.ParseStream(stream);
+        std::size_t const chunk_length = read_uint32(file.data() + offset);
+        std::uint32_t const chunk_type = read_uint32(file.data() + offset + 4);
+        offset += 8;
+
+        if (chunk_length > length - offset)
+            throw std::runtime_error("Truncated .glb chunk in " + path.string());
+
+        // The JSON chunk comes first and the BIN chunk, if any, right after it
+        if (chunk_type == glb_json_chunk && json.empty())
+            json = {file.data() + offset, chunk_length};
+        else if (chunk_type == glb_bin_chunk && bin.empty())
+            bin = {file.data() + offset, chunk_length};
+
+        offset += chunk_length;
     }
 
-    gltf_model result;
+    if (json.empty())
+        throw std::runtime_error("No JSON chunk in " + path.string());
 
-    {
-        auto buffers = document["buffers"].GetArray();
-        assert(buffers.Size() == 1);
+    return {json, bin};
+}
+
+// Members that hold arrays are optional in glTF
+static rapidjson::Value::ConstArray get_array(rapidjson::Value const & object, char const * name)
+{
+    static rapidjson::Value const empty(rapidjson::kArrayType);
+    auto it = object.FindMember(name);
+    return (it == object.MemberEnd()) ? empty.GetArray() : it->value.GetArray();
+}
 
-        auto const buffer_uri = buffers[0]["uri"].GetString();
+// The arrays of a glTF that are referenced by index, converted once up front, so that
+// every reference is a vector lookup instead of another walk through the DOM
+struct gltf_tables
+{
+    std::vector<gltf_model::buffer_view> buffer_views;
+    std::vector<gltf_model::accessor> accessors;
+    std::vector<gltf_model::material> materials;
 
-        auto const buffer_path = path.parent_path() / buffer_uri;
+    struct node
+    {
+        std::string_view name;
+        // Range of node_children
+        std::uint32_t children_begin;
+        std::uint32_t children_end;
+    };
 
-        result.buffer.resize(std::filesystem::file_size(buffer_path));
-        std::ifstream buffer(buffer_path, std::ios::binary);
-        buffer.read(result.buffer.data(), result.buffer.size());
+    std::vector<node> nodes;
+    std::vector<std::uint32_t> node_children;
+
+    std::span<std::uint32_t const> children(std::uint32_t node) const
+    {
+        auto const & n = nodes.at(node);
+        return std::span<std::uint32_t const>(node_children).subspan(n.children_begin, n.children_end - n.children_begin);
     }
+};
+
+static gltf_model::buffer_view parse_buffer_view(rapidjson::Value const & view)
+{
+    return {
+        view["buffer"].GetUint(),
+        get_uint(view, "byteOffset", 0),
+        view["byteLength"].GetUint(),
+        get_uint(view, "byteStride", 0),
+    };
+}
 
-    auto parse_buffer_view = [&](int index) -> gltf_model::buffer_view
+static gltf_model::accessor parse_accessor(rapidjson::Value const & accessor, std::vector<gltf_model::buffer_view> const & views)
+{
+    auto view = [&](rapidjson::Value const & object)
     {
-        auto view = document["bufferViews"].GetArray()[index].GetObject();
-        return {view["byteOffset"].GetUint(), view["byteLength"].GetUint()};
+        return views.at(object["bufferView"].GetUint());
     };
 
-    auto parse_accessor = [&](int index) -> gltf_model::accessor
+    gltf_model::accessor result{
+        accessor.HasMember("bufferView") ? view(accessor) : gltf_model::buffer_view{gltf_model::no_buffer, 0, 0},
+        accessor["componentType"].GetUint(),
+        attribute_type_to_size(accessor["type"].GetString()),
+        accessor["count"].GetUint(),
+        get_uint(accessor, "byteOffset", 0),
+        accessor.HasMember("normalized") && accessor["normalized"].GetBool(),
+        std::nullopt,
+    };
+
+    if (accessor.HasMember("sparse"))
     {
-        auto accessor = document["accessors"].GetArray()[index].GetObject();
-        return {
-            parse_buffer_view(accessor["bufferView"].GetInt()),
-            accessor["componentType"].GetUint(),
-            attribute_type_to_size(accessor["type"].GetString()),
-            accessor["count"].GetUint(),
+        auto const & sparse = accessor["sparse"];
+        auto const & indices = sparse["indices"];
+        auto const & values = sparse["values"];
+
+        result.sparse = gltf_model::sparse{
+            sparse["count"].GetUint(),
+            view(indices),
+            get_uint(indices, "byteOffset", 0),
+            indices["componentType"].GetUint(),
+            view(values),
+            get_uint(values, "byteOffset", 0),
         };
+    }
+
+    return result;
+}
+
+static gltf_tables parse_tables(rapidjson::Document const & document)
+{
+    gltf_tables result;
+
+    for (auto const & view : get_array(document, "bufferViews"))
+        result.buffer_views.push_back(parse_buffer_view(view));
+
+    for (auto const & accessor : get_array(document, "accessors"))
+        result.accessors.push_back(parse_accessor(accessor, result.buffer_views));
+
+    auto images = get_array(document, "images");
+    auto textures = get_array(document, "textures");
+
+    for (auto const & material : get_array(document, "materials"))
+    {
+        auto & result_material = result.materials.emplace_back();
+
+        result_material.two_sided = material.HasMember("doubleSided") && material["doubleSided"].GetBool();
+        result_material.transparent = material.HasMember("alphaMode") && (material["alphaMode"].GetString() == std::string_view("BLEND"));
+
+        // Every material is converted, not only the ones primitives use
+        if (!material.HasMember("pbrMetallicRoughness"))
+            continue;
+
+        auto const & pbr = material["pbrMetallicRoughness"];
+        if (pbr.HasMember("baseColorTexture"))
+        {
+            auto const & texture = textures[pbr["baseColorTexture"]["index"].GetUint()];
+            result_material.texture_path = images[texture["source"].GetUint()]["uri"].GetString();
+        }
+        else if (pbr.HasMember("baseColorFactor"))
+        {
+            auto const & color = pbr["baseColorFactor"];
+            result_material.color = glm::vec4{
+                color[0].GetFloat(),
+                color[1].GetFloat(),
+                color[2].GetFloat(),
+                color[3].GetFloat(),
+            };
+        }
+    }
+
+    for (auto const & node : get_array(document, "nodes"))
+    {
+        auto & result_node = result.nodes.emplace_back();
+        result_node.name = node.HasMember("name") ? std::string_view(node["name"].GetString(), node["name"].GetStringLength()) : std::string_view();
+        result_node.children_begin = result.node_children.size();
+        for (auto const & child : get_array(node, "children"))
+            result.node_children.push_back(child.GetUint());
+        result_node.children_end = result.node_children.size();
+    }
+
+    return result;
+}
+
+std::span<char const> gltf_model::buffer_data(unsigned int index)
+{
+    auto & buffer = buffers.at(index);
+    if (buffer.data.empty() && buffer.size > 0)
+    {
+        if (buffer.path.empty())
+            throw std::runtime_error("BIN chunk buffer " + std::to_string(index) + " was released");
+
+        buffer.file = mapped_file(buffer.path);
+        if (buffer.file.size() < buffer.size)
+            throw std::runtime_error(buffer.path.string() + " is smaller than its byteLength");
+
+        buffer.data = {buffer.file.data(), buffer.size};
+    }
+    return buffer.data;
+}
+
+std::span<char const> gltf_model::view_data(buffer_view const & view)
+{
+    auto data = buffer_data(view.buffer);
+    if (view.offset > data.size() || view.size > data.size() - view.offset)
+        throw std::runtime_error("Buffer view is out of bounds of buffer " + std::to_string(view.buffer));
+    return data.subspan(view.offset, view.size);
+}
+
+accessor_source gltf_model::resolve(accessor const & accessor)
+{
+    accessor_source source;
+    source.type = accessor.type;
+    source.components = accessor.size;
+    source.normalized = accessor.normalized;
+    source.count = accessor.count;
+
+    std::size_t const element_size = gltf_component_size(accessor.type) * accessor.size;
+    source.stride = accessor.view.stride ? accessor.view.stride : element_size;
+
+    auto check_bounds = [](std::span<char const> data, std::size_t offset, std::size_t stride, std::size_t count, std::size_t element_size)
+    {
+        if (count > 0 && (offset > data.size() || (count - 1) * stride + element_size > data.size() - offset))
+            throw std::runtime_error("Accessor is out of bounds of its buffer view");
     };
 
-    auto parse_texture = [&](int index) -> std::string
+    if (accessor.view.buffer != no_buffer)
+    {
+        auto data = view_data(accessor.view);
+        check_bounds(data, accessor.offset, source.stride, accessor.count, element_size);
+        source.data = data.data() + accessor.offset;
+    }
+
+    if (accessor.sparse)
+    {
+        auto const & sparse = *accessor.sparse;
+        std::size_t const index_size = gltf_component_size(sparse.index_type);
+
+        auto indices = view_data(sparse.indices);
+        auto values = view_data(sparse.values);
+        check_bounds(indices, sparse.index_offset, index_size, sparse.count, index_size);
+        check_bounds(values, sparse.value_offset, element_size, sparse.count, element_size);
+
+        source.sparse_count = sparse.count;
+        source.sparse_indices = indices.data() + sparse.index_offset;
+        source.sparse_index_type = sparse.index_type;
+        source.sparse_values = values.data() + sparse.value_offset;
+
+        // Indices are strictly increasing, so only the last one can be out of range
+        if (sparse.count > 0 && gltf_detail::read_component<std::size_t>(source.sparse_indices + (sparse.count - 1) * index_size, sparse.index_type, false) >= accessor.count)
+            throw std::runtime_error("Sparse accessor index is out of range");
+    }
+
+    return source;
+}
+
+void gltf_model::release_geometry_buffers()
+{
+    for (auto & buffer : buffers)
     {
-        auto const source_index = document["textures"].GetArray()[index]["source"].GetInt();
-        return document["images"].GetArray()[source_index]["uri"].GetString();
+        if (!buffer.geometry || buffer.animation) continue;
+
+        buffer.data = {};
+        buffer.file = mapped_file();
+    }
+}
+
+gltf_model load_gltf(std::filesystem::path const & path)
+{
+    // A .glb keeps its mapping after loading, since the BIN chunk follows the JSON in the same file
+    mapped_file file(path);
+    bool const binary = is_glb(file);
+
+    std::string_view json(file.data(), file.size());
+    std::span<char const> bin;
+    if (binary)
+        std::tie(json, bin) = read_glb_chunks(file, path);
+
+    // Parsed in situ from one copy of the JSON: strings point into the copy instead of
+    // being allocated, and the DOM comes from a pool sized after the text
+    std::vector<char> text(json.size() + 1, '\0');
+    std::memcpy(text.data(), json.data(), json.size());
+
+    rapidjson::MemoryPoolAllocator<> allocator(std::max<std::size_t>(json.size(), 64 * 1024));
+    rapidjson::Document document(&allocator);
+    document.ParseInsitu(text.data());
+    if (document.HasParseError())
+        throw std::runtime_error("Failed to parse " + path.string());
+
+    // No required extension is supported. KHR_mesh_quantization in particular needs the node
+    // (or skin) transforms to dequantize positions, and the renderer doesn't apply either.
+    // Known gap: quantized assets (e.g. gltfpack output) don't load here; practice14 and
+    // practice15 accept them
+    for (auto const & extension : get_array(document, "extensionsRequired"))
+        throw std::runtime_error("Unsupported required extension " + std::string(extension.GetString()) + " in " + path.string());
+
+    auto const tables = parse_tables(document);
+
+    gltf_model result;
+
+    for (auto const & buffer : get_array(document, "buffers"))
+    {
+        auto & result_buffer = result.buffers.emplace_back();
+        result_buffer.size = buffer["byteLength"].GetUint();
+
+        if (buffer.HasMember("uri"))
+            result_buffer.path = path.parent_path() / buffer["uri"].GetString();
+        else if (binary && result.buffers.size() == 1 && !bin.empty())
+        {
+            // The .glb is mapped already and its pages are only read once touched, so the BIN
+            // chunk keeps the mapping instead of mapping the file again; moving the mapping
+            // doesn't move the mapped memory, so bin stays valid
+            if (bin.size() < result_buffer.size)
+                throw std::runtime_error("BIN chunk is smaller than its byteLength in " + path.string());
+
+            result_buffer.data = bin.first(result_buffer.size);
+            result_buffer.file = std::move(file);
+        }
+        else
+            throw std::runtime_error("Buffer without uri in " + path.string());
+    }
+
+    // Records what the buffers an accessor reads from are used for
+    auto mark_buffers = [&](gltf_model::accessor const & accessor, bool gltf_model::buffer::* usage)
+    {
+        if (accessor.view.buffer != gltf_model::no_buffer)
+            result.buffers.at(accessor.view.buffer).*usage = true;
+        if (accessor.sparse)
+        {
+            result.buffers.at(accessor.sparse->indices.buffer).*usage = true;
+            result.buffers.at(accessor.sparse->values.buffer).*usage = true;
+        }
     };
 
-    auto parse_color = [&](auto const & array)
+    auto geometry_accessor = [&](rapidjson::Value const & index)
     {
-        return glm::vec4{
-            array[0].GetFloat(),
-            array[1].GetFloat(),
-            array[2].GetFloat(),
-            array[3].GetFloat(),
-        };
+        auto const & accessor = tables.accessors.at(index.GetUint());
+        mark_buffers(accessor, &gltf_model::buffer::geometry);
+        return accessor;
     };
 
-    for (auto const & mesh : document["meshes"].GetArray())
+    for (auto const & mesh : get_array(document, "meshes"))
     {
         auto & result_mesh = result.meshes.emplace_back();
         result_mesh.name = mesh["name"].GetString();
@@ -85,82 +382,61 @@ gltf_model load_gltf(std::filesystem::path const & path)
 
             auto const & attributes = primitive["attributes"];
 
-            result_primitive.indices = parse_accessor(primitive["indices"].GetInt());
-            result_primitive.position = parse_accessor(attributes["POSITION"].GetInt());
-            result_primitive.normal = parse_accessor(attributes["NORMAL"].GetInt());
-            result_primitive.texcoord = parse_accessor(attributes["TEXCOORD_0"].GetInt());
-            result_primitive.joints = parse_accessor(attributes["JOINTS_0"].GetInt());
-            result_primitive.weights = parse_accessor(attributes["WEIGHTS_0"].GetInt());
-
-            auto const & material = document["materials"].GetArray()[primitive["material"].GetInt()];
+            result_primitive.indices = geometry_accessor(primitive["indices"]);
+            result_primitive.position = geometry_accessor(attributes["POSITION"]);
+            result_primitive.normal = geometry_accessor(attributes["NORMAL"]);
+            result_primitive.texcoord = geometry_accessor(attributes["TEXCOORD_0"]);
+            result_primitive.joints = geometry_accessor(attributes["JOINTS_0"]);
+            result_primitive.weights = geometry_accessor(attributes["WEIGHTS_0"]);
 
-            result_primitive.material.two_sided = material.HasMember("doubleSided") && material["doubleSided"].GetBool();
-            result_primitive.material.transparent = material.HasMember("alphaMode") && (material["alphaMode"].GetString() == std::string("BLEND"));
-
-            auto const & pbr = material["pbrMetallicRoughness"];
-            if (pbr.HasMember("baseColorTexture"))
-                result_primitive.material.texture_path = parse_texture(pbr["baseColorTexture"]["index"].GetInt());
-            else if (pbr.HasMember("baseColorFactor"))
-                result_primitive.material.color = parse_color(pbr["baseColorFactor"].GetArray());
+            result_primitive.material = tables.materials.at(primitive["material"].GetUint());
         }
     }
 
-    auto skins = document["skins"].GetArray();
+    auto skins = get_array(document, "skins");
     assert(skins.Size() == 1);
 
     {
-        auto fill_buffer = [&](auto & vector, gltf_model::accessor const & accessor)
-        {
-            assert(accessor.type == 0x1406); // GL_FLOAT
-            using value_type = std::decay_t<decltype(vector[0])>;
-            auto begin = reinterpret_cast<value_type const *>(result.buffer.data() + accessor.view.offset);
-            vector.assign(begin, begin + accessor.count);
-        };
-
-        auto fix_rotations = [](std::vector<glm::quat> & rotations)
+        // Animation data is read in place, so the buffers it comes from stay mapped
+        auto set_view = [&](auto & view, gltf_model::accessor const & accessor)
         {
-            for (auto & r : rotations)
-                r = glm::quat(r.z, r.w, r.x, r.y);
+            mark_buffers(accessor, &gltf_model::buffer::animation);
+            view = std::decay_t<decltype(view)>(result.resolve(accessor));
         };
 
         auto joints = skins[0]["joints"].GetArray();
 
-        std::vector<glm::mat4> inverse_bind_matrices(joints.Size());
-        fill_buffer(inverse_bind_matrices, parse_accessor(skins[0]["inverseBindMatrices"].GetInt()));
+        // Copied into the bones, so the buffer doesn't need to stay mapped for them:
+        // counted as geometry, release_geometry_buffers unmaps it unless animations use it
+        auto const & inverse_bind_accessor = tables.accessors.at(skins[0]["inverseBindMatrices"].GetUint());
+        mark_buffers(inverse_bind_accessor, &gltf_model::buffer::geometry);
+        auto inverse_bind_matrices = result.elements<glm::mat4>(inverse_bind_accessor);
 
         result.bones.resize(joints.Size());
 
-        std::unordered_map<int, int> bone_node_to_index;
+        // Bone of each node, or -1
+        std::vector<int> node_bone(tables.nodes.size(), -1);
         for (int i = 0; i < joints.Size(); ++i)
         {
-            int const node_id = joints[i].GetInt();
-            bone_node_to_index[node_id] = i;
-            result.bones[i].name = document["nodes"].GetArray()[node_id]["name"].GetString();
+            std::uint32_t const node_id = joints[i].GetUint();
+            node_bone.at(node_id) = i;
+            result.bones[i].name = tables.nodes[node_id].name;
             result.bones[i].inverse_bind_matrix = inverse_bind_matrices[i];
         }
 
-        auto nodes = document["nodes"].GetArray();
-
-        for (int i = 0; i < nodes.Size(); ++i)
+        for (std::uint32_t i = 0; i < tables.nodes.size(); ++i)
         {
-            if (!bone_node_to_index.contains(i)) continue;
-
-            auto const & node = nodes[i];
-
-            if (!node.HasMember("children")) continue;
+            if (node_bone[i] == -1) continue;
 
-            for (auto const & child : node["children"].GetArray())
-            {
-                int child_id = child.GetInt();
-                if (bone_node_to_index.contains(child_id))
-                    result.bones[bone_node_to_index.at(child_id)].parent = bone_node_to_index.at(i);
-            }
+            for (auto child_id : tables.children(i))
+                if (node_bone.at(child_id) != -1)
+                    result.bones[node_bone[child_id]].parent = node_bone[i];
         }
 
         for (int i = 0; i < result.bones.size(); ++i)
             assert(result.bones[i].parent == -1 || result.bones[i].parent < i);
 
-        for (auto const & animation : document["animations"].GetArray())
+        for (auto const & animation : get_array(document, "animations"))
         {
             std::string name = animation["name"].GetString();
 
@@ -171,37 +447,38 @@ gltf_model load_gltf(std::filesystem::path const & path)
 
             for (auto const & channel : animation["channels"].GetArray())
             {
-                int node_id = channel["target"]["node"].GetInt();
-                if (!bone_node_to_index.contains(node_id)) continue;
+                auto const & target = channel["target"];
+
+                std::uint32_t const node_id = target["node"].GetUint();
+                if (node_id >= node_bone.size() || node_bone[node_id] == -1) continue;
 
-                auto & bone = result_animation.bones[bone_node_to_index.at(node_id)];
+                auto & bone = result_animation.bones[node_bone[node_id]];
 
-                std::string path = channel["target"]["path"].GetString();
+                std::string_view path(target["path"].GetString(), target["path"].GetStringLength());
 
-                auto const & sampler = samplers[channel["sampler"].GetInt()];
+                auto const & sampler = samplers[channel["sampler"].GetUint()];
 
-                auto input = parse_accessor(sampler["input"].GetInt());
-                auto output = parse_accessor(sampler["output"].GetInt());
+                auto const & input = tables.accessors.at(sampler["input"].GetUint());
+                auto const & output = tables.accessors.at(sampler["output"].GetUint());
 
                 if (path == "translation")
                 {
-                    fill_buffer(bone.translation.timestamps, input);
-                    fill_buffer(bone.translation.values, output);
+                    set_view(bone.translation.timestamps, input);
+                    set_view(bone.translation.values, output);
                 }
                 else if (path == "rotation")
                 {
-                    fill_buffer(bone.rotation.timestamps, input);
-                    fill_buffer(bone.rotation.values, output);
-                    fix_rotations(bone.rotation.values);
+                    set_view(bone.rotation.timestamps, input);
+                    set_view(bone.rotation.values, output);
                 }
                 else if (path == "scale")
                 {
-                    fill_buffer(bone.scale.timestamps, input);
-                    fill_buffer(bone.scale.values, output);
+                    set_view(bone.scale.timestamps, input);
+                    set_view(bone.scale.values, output);
                 }
             }
 
-            auto update_max_time = [&](std::vector<float> const & timestamps)
+            auto update_max_time = [&](accessor_view<float> const & timestamps)
             {
                 for (float t : timestamps)
                     result_animation.max_time = std::max(result_animation.max_time, t);
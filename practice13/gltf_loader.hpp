@@ -1,6 +1,9 @@
 #pragma once
 
+#include "mapped_file.hpp"
+
 #include <filesystem>
+#include <span>
 #include <vector>
 #include <string>
 #include <optional>
@@ -14,20 +17,57 @@
 #include <glm/gtx/quaternion.hpp>
 #include <glm/gtx/compatibility.hpp>
 
+#include "gltf_accessor.hpp"
+
 struct gltf_model
 {
+    struct buffer
+    {
+        // External file holding the data; empty for the BIN chunk of a .glb
+        std::filesystem::path path;
+        unsigned int size;
+
+        // Which accessors read from the buffer, filled while loading
+        bool geometry = false;
+        bool animation = false;
+
+        // Empty until the buffer is first used
+        std::span<char const> data;
+        mapped_file file;
+    };
+
+    static constexpr unsigned int no_buffer = -1;
+
     struct buffer_view
     {
+        unsigned int buffer;
         unsigned int offset;
         unsigned int size;
+        // Zero if elements are tightly packed
+        unsigned int stride = 0;
+    };
+
+    struct sparse
+    {
+        unsigned int count;
+        buffer_view indices;
+        unsigned int index_offset;
+        unsigned int index_type;
+        buffer_view values;
+        unsigned int value_offset;
     };
 
     struct accessor
     {
+        // An accessor without a buffer view reads from no_buffer
         buffer_view view;
         unsigned int type;
         unsigned int size;
         unsigned int count;
+        // Of the first element within the view
+        unsigned int offset = 0;
+        bool normalized = false;
+        std::optional<struct sparse> sparse;
     };
 
     struct material
@@ -48,8 +88,8 @@ struct gltf_model
     template <typename T>
     struct spline
     {
-        std::vector<float> timestamps;
-        std::vector<T> values;
+        accessor_view<float> timestamps;
+        accessor_view<T> values;
 
         T operator()(float time) const;
     };
@@ -87,12 +127,32 @@ struct gltf_model
         std::vector<primitive> primitives;
     };
 
-    std::vector<char> buffer;
+    // Binary data the accessors point into: BIN chunk of a .glb or external files, read in
+    // place from memory mappings, so that they can be passed straight to glBufferData
+    std::vector<buffer> buffers;
     std::vector<mesh> meshes;
     std::vector<bone> bones;
     std::unordered_map<std::string, animation> animations;
+
+    // Maps the buffer on first use; buffers no accessor uses are never read
+    std::span<char const> buffer_data(unsigned int index);
+    std::span<char const> view_data(buffer_view const & view);
+
+    // Maps the buffers the accessor reads from and checks that its elements are within them
+    accessor_source resolve(accessor const & accessor);
+
+    template <typename T>
+    accessor_view<T> elements(accessor const & accessor)
+    {
+        return accessor_view<T>(resolve(accessor));
+    }
+
+    // Unmaps the buffers only mesh geometry (and the copied skin data) reads from, once they are uploaded;
+    // buffers animations read from stay mapped
+    void release_geometry_buffers();
 };
 
+// Loads a .gltf with an external .bin buffer or a binary .glb
 gltf_model load_gltf(std::filesystem::path const & path);
 
 template <>
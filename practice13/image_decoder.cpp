@@ -0,0 +1,76 @@
+#include "image_decoder.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+image_decoder::image_decoder(std::vector<std::filesystem::path> paths, std::optional<texture_compression> compression,
+    std::size_t thread_count)
+    : paths_(std::move(paths))
+    , compression_(compression)
+{
+    std::size_t const core_count = std::max(1u, std::thread::hardware_concurrency());
+    if (thread_count == 0)
+        thread_count = core_count;
+    thread_count = std::min(thread_count, paths_.size());
+
+    options_.thread_count = std::max<std::size_t>(1, core_count / std::max<std::size_t>(thread_count, 1));
+
+    for (std::size_t i = 0; i < thread_count; ++i)
+        threads_.emplace_back([this]{ run(); });
+}
+
+image_decoder::~image_decoder()
+{
+    // Workers stop after the image they are decoding
+    next_path_ = paths_.size();
+    for (auto & thread : threads_)
+        thread.join();
+}
+
+void image_decoder::run()
+{
+    for (std::size_t i; (i = next_path_++) < paths_.size();)
+    {
+        std::optional<decoded_image> image;
+        std::string error;
+        try
+        {
+            image = decoded_image{i, load_texture_cached(paths_[i], options_, compression_)};
+        }
+        catch (std::exception const & e)
+        {
+            error = e.what();
+        }
+
+        {
+            std::lock_guard lock(mutex_);
+            if (image)
+                queue_.push_back(std::move(*image));
+            else
+                errors_.push_back(std::move(error));
+        }
+        decoded_.notify_one();
+    }
+}
+
+std::optional<decoded_image> image_decoder::next()
+{
+    if (returned_ == paths_.size())
+        return std::nullopt;
+
+    std::unique_lock lock(mutex_);
+    decoded_.wait(lock, [this]{ return !queue_.empty() || !errors_.empty(); });
+
+    ++returned_;
+
+    if (!errors_.empty())
+    {
+        std::string error = std::move(errors_.front());
+        errors_.pop_front();
+        throw std::runtime_error(error);
+    }
+
+    auto image = std::move(queue_.front());
+    queue_.pop_front();
+    return image;
+}
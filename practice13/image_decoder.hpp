@@ -0,0 +1,56 @@
+#pragma once
+
+#include "texture_cache.hpp"
+
+#include <filesystem>
+#include <vector>
+#include <deque>
+#include <string>
+#include <optional>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+
+struct decoded_image
+{
+    // Position of the image in the list passed to image_decoder
+    std::size_t index;
+    cached_texture texture;
+};
+
+// Loads images through load_texture_cached on worker threads, so that decoding scales
+// with cores while the GL context stays on the calling thread, which takes the results
+// in completion order
+struct image_decoder
+{
+    // Zero threads means one per core
+    explicit image_decoder(std::vector<std::filesystem::path> paths, std::optional<texture_compression> compression = std::nullopt,
+        std::size_t thread_count = 0);
+    ~image_decoder();
+
+    image_decoder(image_decoder const &) = delete;
+    image_decoder & operator = (image_decoder const &) = delete;
+
+    // Blocks until another image is decoded; empty once all images were returned.
+    // Throws if the image failed to decode
+    std::optional<decoded_image> next();
+
+private:
+    std::vector<std::filesystem::path> paths_;
+    std::optional<texture_compression> compression_;
+    // Splits the cores between the workers, so that mip generation and compression inside
+    // each of them don't start another thread per core
+    mip_options options_;
+    std::atomic<std::size_t> next_path_{0};
+    std::size_t returned_ = 0;
+
+    std::mutex mutex_;
+    std::condition_variable decoded_;
+    std::deque<decoded_image> queue_;
+    std::deque<std::string> errors_;
+
+    std::vector<std::thread> threads_;
+
+    void run();
+};
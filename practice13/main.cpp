@@ -28,7 +28,8 @@
 #include <glm/gtx/string_cast.hpp>
 
 #include "gltf_loader.hpp"
-#include "stb_image.h"
+#include "image_decoder.hpp"
+#include "texture_cache_gl.hpp"
 
 std::string to_string(std::string_view str)
 {
@@ -190,11 +191,34 @@ int main() try
     const std::string project_root = PROJECT_ROOT;
     const std::string model_path = project_root + "/dancing/dancing.gltf";
 
-    auto const input_model = load_gltf(model_path);
-    GLuint vbo;
-    glGenBuffers(1, &vbo);
-    glBindBuffer(GL_ARRAY_BUFFER, vbo);
-    glBufferData(GL_ARRAY_BUFFER, input_model.buffer.size(), input_model.buffer.data(), GL_STATIC_DRAW);
+    auto input_model = load_gltf(model_path);
+
+    // One GL buffer per glTF buffer the meshes use, created when first needed
+    std::map<unsigned int, GLuint> vbos;
+    auto buffer_object = [&](unsigned int index)
+    {
+        if (auto it = vbos.find(index); it != vbos.end())
+            return it->second;
+
+        auto data = input_model.buffer_data(index);
+
+        GLuint vbo;
+        glGenBuffers(1, &vbo);
+        glBindBuffer(GL_ARRAY_BUFFER, vbo);
+        glBufferData(GL_ARRAY_BUFFER, data.size(), data.data(), GL_STATIC_DRAW);
+        return vbos[index] = vbo;
+    };
+
+    // Accessors are drawn straight from the uploaded glTF buffers, which only works when
+    // their data is there: zero-filled (no bufferView) and sparse accessors aren't supported
+    auto accessor_buffer = [&](gltf_model::accessor const & accessor, std::string const & usage)
+    {
+        if (accessor.view.buffer == gltf_model::no_buffer)
+            throw std::runtime_error("Accessor without a bufferView can't be used as " + usage + " in " + model_path);
+        if (accessor.sparse)
+            throw std::runtime_error("Sparse accessor can't be used as " + usage + " in " + model_path);
+        return buffer_object(accessor.view.buffer);
+    };
 
     struct mesh
     {
@@ -203,13 +227,14 @@ int main() try
         gltf_model::material material;
     };
 
-    auto setup_attribute = [](int index, gltf_model::accessor const & accessor, bool integer = false)
+    auto setup_attribute = [&](int index, gltf_model::accessor const & accessor, bool integer = false)
     {
+        glBindBuffer(GL_ARRAY_BUFFER, accessor_buffer(accessor, "vertex attribute " + std::to_string(index)));
         glEnableVertexAttribArray(index);
         if (integer)
-            glVertexAttribIPointer(index, accessor.size, accessor.type, 0, reinterpret_cast<void *>(accessor.view.offset));
+            glVertexAttribIPointer(index, accessor.size, accessor.type, accessor.view.stride, reinterpret_cast<void *>(accessor.view.offset + accessor.offset));
         else
-            glVertexAttribPointer(index, accessor.size, accessor.type, GL_FALSE, 0, reinterpret_cast<void *>(accessor.view.offset));
+            glVertexAttribPointer(index, accessor.size, accessor.type, accessor.normalized ? GL_TRUE : GL_FALSE, accessor.view.stride, reinterpret_cast<void *>(accessor.view.offset + accessor.offset));
     };
 
     std::vector<mesh> meshes;
@@ -218,10 +243,14 @@ int main() try
         for (auto const & primitive : mesh.primitives)
         {
             auto & result = meshes.emplace_back();
+
+            // Creating the buffer binds GL_ARRAY_BUFFER, so it is done before binding the VAO
+            GLuint const ebo = accessor_buffer(primitive.indices, "indices");
+
             glGenVertexArrays(1, &result.vao);
             glBindVertexArray(result.vao);
 
-            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, vbo);
+            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
             result.indices = primitive.indices;
 
             setup_attribute(0, primitive.position);
@@ -234,29 +263,38 @@ int main() try
         }
     }
 
+    input_model.release_geometry_buffers();
+
+    // Each texture is decoded (or read from its cache) once, on the decoder's threads, and
+    // uploaded here as soon as it is ready
+    std::vector<std::string> texture_paths;
     std::map<std::string, GLuint> textures;
     for (auto const & mesh : meshes)
     {
         if (!mesh.material.texture_path) continue;
-        if (textures.contains(*mesh.material.texture_path)) continue;
-
-        auto path = std::filesystem::path(model_path).parent_path() / *mesh.material.texture_path;
-
-        int width, height, channels;
-        auto data = stbi_load(path.c_str(), &width, &height, &channels, 4);
-        assert(data);
+        if (!textures.emplace(*mesh.material.texture_path, 0).second) continue;
 
-        GLuint texture;
-        glGenTextures(1, &texture);
-        glBindTexture(GL_TEXTURE_2D, texture);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
+        texture_paths.push_back(*mesh.material.texture_path);
+    }
 
-        stbi_image_free(data);
+    {
+        std::vector<std::filesystem::path> paths;
+        for (auto const & texture_path : texture_paths)
+            paths.push_back(std::filesystem::path(model_path).parent_path() / texture_path);
 
-        textures[*mesh.material.texture_path] = texture;
+        // The textures may have alpha, so BC1 is no fallback
+        image_decoder decoder(std::move(paths), pick_compression({{block_format::bc7}, {block_format::bc3}}));
+        while (auto image = decoder.next())
+        {
+            GLuint texture;
+            glGenTextures(1, &texture);
+            glBindTexture(GL_TEXTURE_2D, texture);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+            upload_texture(image->texture);
+
+            textures[texture_paths[image->index]] = texture;
+        }
     }
 
     auto last_frame_start = std::chrono::high_resolution_clock::now();
@@ -386,7 +424,7 @@ int main() try
                     continue;
 
                 glBindVertexArray(mesh.vao);
-                glDrawElements(GL_TRIANGLES, mesh.indices.count, mesh.indices.type, reinterpret_cast<void *>(mesh.indices.view.offset));
+                glDrawElements(GL_TRIANGLES, mesh.indices.count, mesh.indices.type, reinterpret_cast<void *>(mesh.indices.view.offset + mesh.indices.offset));
             }
         };
 
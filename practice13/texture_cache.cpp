@@ -0,0 +1,464 @@
+#include "texture_cache.hpp"
+
+#include "stb_image.h"
+
+#include <map>
+#include <fstream>
+#include <cstring>
+#include <string>
+#include <stdexcept>
+#include <algorithm>
+
+namespace
+{
+
+    constexpr char cache_magic[8] = {'T', 'E', 'X', 'C', 'A', 'C', 'H', 'E'};
+    constexpr std::uint32_t cache_version = 4;
+
+    // Levels start at multiples of this, so each one is page-aligned in the mapping
+    constexpr std::uint64_t cache_alignment = 4096;
+
+    // Enough for any size that fits in an int
+    constexpr std::uint32_t max_levels = 32;
+
+    struct cache_header
+    {
+        char magic[8];
+        std::uint32_t version;
+        std::uint32_t level_count;
+
+        std::uint64_t source_size;
+        std::int64_t source_mtime;
+        std::uint64_t source_hash;
+
+        std::uint64_t path_length;
+
+        // How the mip chain was built
+        std::uint32_t filter;
+        std::uint32_t srgb;
+
+        // Zero for uncompressed levels, otherwise one plus the requested block format
+        std::uint32_t format;
+        std::uint32_t quality;
+
+        // Channels found in the image, see detect_channels
+        std::uint32_t channels;
+
+        std::uint32_t width;
+        std::uint32_t height;
+        std::uint64_t level_offset[max_levels];
+    };
+
+    std::uint64_t align(std::uint64_t offset)
+    {
+        return (offset + cache_alignment - 1) / cache_alignment * cache_alignment;
+    }
+
+    std::uint32_t level_size(std::uint32_t size, std::uint32_t level)
+    {
+        return std::max<std::uint32_t>(1, size >> level);
+    }
+
+    std::uint32_t format_code(std::optional<texture_compression> const & compression)
+    {
+        return compression ? 1 + static_cast<std::uint32_t>(compression->format) : 0;
+    }
+
+    // Gray images are stored as BC4 and gray ones with alpha as BC5, whatever format was requested
+    std::optional<block_format> stored_format(std::optional<texture_compression> const & compression, std::uint32_t channels)
+    {
+        if (!compression)
+            return std::nullopt;
+        if (channels == 1)
+            return block_format::bc4;
+        if (channels == 2)
+            return block_format::bc5;
+        return compression->format;
+    }
+
+    std::uint64_t level_bytes(std::optional<block_format> format, std::uint32_t channels, std::uint32_t width, std::uint32_t height)
+    {
+        return format ? compressed_size(*format, width, height) : std::uint64_t(width) * height * channels;
+    }
+
+    channel_swizzle stored_swizzle(std::uint32_t channels)
+    {
+        if (channels == 1)
+            return {swizzle_source::red, swizzle_source::red, swizzle_source::red, swizzle_source::one};
+        if (channels == 2)
+            return {swizzle_source::red, swizzle_source::red, swizzle_source::red, swizzle_source::green};
+        return identity_swizzle;
+    }
+
+    // 1 if the image is gray and opaque, 2 if it is gray with alpha (kept in green), otherwise 4
+    std::uint32_t detect_channels(std::uint8_t const * pixels, std::size_t count)
+    {
+        bool gray = true, opaque = true;
+        for (std::size_t i = 0; i < count && gray; ++i)
+        {
+            std::uint8_t const * p = pixels + i * 4;
+            gray = p[0] == p[1] && p[0] == p[2];
+            opaque = opaque && p[3] == 255;
+        }
+
+        if (!gray)
+            return 4;
+        return opaque ? 1 : 2;
+    }
+
+    std::uint32_t level_count(std::uint32_t width, std::uint32_t height)
+    {
+        std::uint32_t count = 1;
+        while ((width >> count) > 0 || (height >> count) > 0)
+            ++count;
+        return count;
+    }
+
+    // 64-bit multiplicative hash processing 8 bytes at a time; only used to detect changes
+    std::uint64_t hash_bytes(char const * data, std::size_t size)
+    {
+        constexpr std::uint64_t multiplier = 0x9E3779B97F4A7C15ull;
+
+        std::uint64_t h = size * multiplier;
+
+        std::size_t i = 0;
+        for (; i + 8 <= size; i += 8)
+        {
+            std::uint64_t word;
+            std::memcpy(&word, data + i, 8);
+            h = (h ^ word) * multiplier;
+            h ^= h >> 32;
+        }
+
+        std::uint64_t tail = 0;
+        if (i < size)
+            std::memcpy(&tail, data + i, size - i);
+        h = (h ^ tail) * multiplier;
+        h ^= h >> 29;
+
+        return h;
+    }
+
+    struct source_key
+    {
+        std::string path;
+        std::uint64_t size;
+        std::int64_t mtime;
+        mip_options options;
+        std::optional<texture_compression> compression;
+    };
+
+    bool header_matches(cache_header const & header, mapped_file const & cache, source_key const & key)
+    {
+        if (cache.size() < sizeof(cache_header)) return false;
+        if (std::memcmp(header.magic, cache_magic, sizeof(cache_magic)) != 0) return false;
+        if (header.version != cache_version) return false;
+        if (header.source_size != key.size) return false;
+        if (header.source_mtime != key.mtime) return false;
+        if (header.path_length != key.path.size()) return false;
+        if (header.filter != static_cast<std::uint32_t>(key.options.filter)) return false;
+        if (header.srgb != key.options.srgb) return false;
+        if (header.format != format_code(key.compression)) return false;
+        if (key.compression && header.quality != static_cast<std::uint32_t>(key.compression->quality)) return false;
+        if (header.channels != 1 && header.channels != 2 && header.channels != 4) return false;
+        if (sizeof(cache_header) + header.path_length > cache.size()) return false;
+        if (std::memcmp(cache.data() + sizeof(cache_header), key.path.data(), key.path.size()) != 0) return false;
+        if (header.width == 0 || header.height == 0) return false;
+        if (header.level_count != level_count(header.width, header.height)) return false;
+        for (std::uint32_t i = 0; i < header.level_count; ++i)
+        {
+            std::uint64_t const size = level_bytes(stored_format(key.compression, header.channels), header.channels,
+                level_size(header.width, i), level_size(header.height, i));
+            if (header.level_offset[i] % cache_alignment != 0) return false;
+            if (header.level_offset[i] + size > cache.size()) return false;
+        }
+        return true;
+    }
+
+    struct decoded_levels
+    {
+        std::uint32_t width;
+        std::uint32_t height;
+        std::uint32_t channels;
+        std::vector<std::vector<std::uint8_t>> levels;
+    };
+
+    decoded_levels decode(std::filesystem::path const & path, mip_options const & options, std::optional<texture_compression> const & compression)
+    {
+        int width, height, channels;
+        auto pixels = stbi_load(path.string().c_str(), &width, &height, &channels, 4);
+        if (!pixels)
+            throw std::runtime_error("Failed to load " + path.string() + ": " + stbi_failure_reason());
+
+        decoded_levels result{static_cast<std::uint32_t>(width), static_cast<std::uint32_t>(height), 4, {}};
+        result.levels.emplace_back(pixels, pixels + std::size_t(width) * height * 4);
+        stbi_image_free(pixels);
+
+        // JPEG and many PNG maps are gray but decode to RGB; filtering keeps the channels equal
+        result.channels = detect_channels(result.levels[0].data(), std::size_t(width) * height);
+
+        for (auto & level : generate_mips(result.levels[0].data(), result.width, result.height, options))
+            result.levels.push_back(std::move(level));
+
+        if (result.channels == 4 && !compression)
+            return result;
+
+        for (std::uint32_t i = 0; i < result.levels.size(); ++i)
+        {
+            auto & level = result.levels[i];
+            std::size_t const pixel_count = level.size() / 4;
+
+            // Gray and alpha go to red and green
+            for (std::size_t p = 0; p < pixel_count && result.channels == 2; ++p)
+                level[p * 4 + 1] = level[p * 4 + 3];
+
+            if (auto const format = stored_format(compression, result.channels))
+                level = compress_blocks(level.data(), level_size(result.width, i), level_size(result.height, i), *format, compression->quality,
+                    options.thread_count);
+            else
+            {
+                for (std::size_t p = 0; p < pixel_count; ++p)
+                    for (std::uint32_t c = 0; c < result.channels; ++c)
+                        level[p * result.channels + c] = level[p * 4 + c];
+                level.resize(pixel_count * result.channels);
+            }
+        }
+
+        return result;
+    }
+
+    // Returns false if the cache could not be written
+    bool write_cache(decoded_levels const & image, std::filesystem::path const & cache_path,
+        source_key const & key, std::uint64_t source_hash)
+    {
+        cache_header header{};
+        std::memcpy(header.magic, cache_magic, sizeof(cache_magic));
+        header.version = cache_version;
+        header.level_count = image.levels.size();
+        header.source_size = key.size;
+        header.source_mtime = key.mtime;
+        header.source_hash = source_hash;
+        header.path_length = key.path.size();
+        header.filter = static_cast<std::uint32_t>(key.options.filter);
+        header.srgb = key.options.srgb;
+        header.format = format_code(key.compression);
+        header.quality = key.compression ? static_cast<std::uint32_t>(key.compression->quality) : 0;
+        header.channels = image.channels;
+        header.width = image.width;
+        header.height = image.height;
+
+        std::uint64_t offset = sizeof(cache_header) + key.path.size();
+        for (std::size_t i = 0; i < image.levels.size(); ++i)
+        {
+            header.level_offset[i] = align(offset);
+            offset = header.level_offset[i] + image.levels[i].size();
+        }
+
+        // Write to a temporary file and rename it, so that a concurrent or interrupted
+        // run never sees a partially written cache
+        auto temp_path = cache_path;
+        temp_path += ".tmp";
+
+        auto cleanup = [&]
+        {
+            std::error_code ec;
+            std::filesystem::remove(temp_path, ec);
+            return false;
+        };
+
+        {
+            std::ofstream out(temp_path, std::ios::binary | std::ios::trunc);
+            if (!out)
+                return cleanup();
+
+            char const padding[cache_alignment] = {};
+
+            out.write(reinterpret_cast<char const *>(&header), sizeof(header));
+            out.write(key.path.data(), key.path.size());
+            for (std::size_t i = 0; i < image.levels.size(); ++i)
+            {
+                out.write(padding, header.level_offset[i] - static_cast<std::uint64_t>(out.tellp()));
+                out.write(reinterpret_cast<char const *>(image.levels[i].data()), image.levels[i].size());
+            }
+
+            if (!out)
+                return cleanup();
+        }
+
+        std::error_code ec;
+        std::filesystem::rename(temp_path, cache_path, ec);
+        if (ec)
+            return cleanup();
+
+        return true;
+    }
+
+}
+
+cached_texture load_texture_cached(std::filesystem::path const & path, mip_options const & options,
+    std::optional<texture_compression> const & compression)
+{
+    auto cache_path = path;
+    cache_path += ".texcache";
+
+    source_key key;
+    key.path = std::filesystem::absolute(path).string();
+    key.size = std::filesystem::file_size(path);
+    key.mtime = std::filesystem::last_write_time(path).time_since_epoch().count();
+    key.options = options;
+    key.compression = compression;
+
+    std::uint64_t const source_hash = [&]
+    {
+        mapped_file source(path);
+        return hash_bytes(source.data(), source.size());
+    }();
+
+    cached_texture result;
+
+    auto set_layout = [&](std::uint32_t channels)
+    {
+        result.format = stored_format(compression, channels);
+        result.channels = channels;
+        result.swizzle = stored_swizzle(channels);
+    };
+
+    auto try_cache = [&]
+    {
+        std::error_code ec;
+        if (!std::filesystem::exists(cache_path, ec))
+            return false;
+
+        mapped_file cache(cache_path);
+
+        cache_header header{};
+        if (cache.size() >= sizeof(header))
+            std::memcpy(&header, cache.data(), sizeof(header));
+
+        if (!header_matches(header, cache, key) || header.source_hash != source_hash)
+            return false;
+
+        set_layout(header.channels);
+        for (std::uint32_t i = 0; i < header.level_count; ++i)
+        {
+            std::uint32_t const width = level_size(header.width, i);
+            std::uint32_t const height = level_size(header.height, i);
+            auto const data = reinterpret_cast<std::uint8_t const *>(cache.data() + header.level_offset[i]);
+            result.levels.push_back({static_cast<int>(width), static_cast<int>(height), {data, level_bytes(result.format, result.channels, width, height)}});
+        }
+        result.file = std::move(cache);
+        return true;
+    };
+
+    if (try_cache())
+        return result;
+
+    auto image = decode(path, options, compression);
+
+    if (write_cache(image, cache_path, key, source_hash) && try_cache())
+        return result;
+
+    // The cache could not be written (e.g. a read-only directory), keep the decoded levels
+    set_layout(image.channels);
+    std::vector<std::size_t> offsets;
+    for (auto const & level : image.levels)
+    {
+        offsets.push_back(result.storage.size());
+        result.storage.insert(result.storage.end(), level.begin(), level.end());
+    }
+    for (std::uint32_t i = 0; i < image.levels.size(); ++i)
+        result.levels.push_back({static_cast<int>(level_size(image.width, i)), static_cast<int>(level_size(image.height, i)),
+            std::span<std::uint8_t const>(result.storage).subspan(offsets[i], image.levels[i].size())});
+    return result;
+}
+
+cached_texture pack_textures(std::array<packed_channel, 4> const & channels, mip_options const & options)
+{
+    std::map<std::filesystem::path, cached_texture> sources;
+    for (auto const & channel : channels)
+        if (!channel.path.empty() && !sources.contains(channel.path))
+            sources.emplace(channel.path, load_texture_cached(channel.path, options));
+
+    if (sources.empty())
+        throw std::runtime_error("A packed texture needs at least one channel from an image");
+
+    auto const & first = sources.begin()->second;
+    for (auto const & [path, source] : sources)
+        if (source.levels[0].width != first.levels[0].width || source.levels[0].height != first.levels[0].height)
+            throw std::runtime_error("Packed texture " + path.string() + " differs in size from " + sources.begin()->first.string());
+
+    cached_texture result;
+    result.channels = 0;
+
+    // Stored channel of each image channel, or a constant
+    struct stored_source
+    {
+        cached_texture const * texture;
+        swizzle_source channel;
+    };
+    std::vector<stored_source> stored;
+
+    for (int c = 0; c < 4; ++c)
+    {
+        auto const & channel = channels[c];
+        if (channel.path.empty())
+        {
+            if (channel.source != swizzle_source::zero && channel.source != swizzle_source::one)
+                throw std::runtime_error("A packed channel without an image must be zero or one");
+            result.swizzle[c] = channel.source;
+            continue;
+        }
+
+        auto const & texture = sources.at(channel.path);
+        auto const source = (channel.source == swizzle_source::zero || channel.source == swizzle_source::one) ? channel.source
+            : texture.swizzle[static_cast<int>(channel.source)];
+
+        if (source == swizzle_source::zero || source == swizzle_source::one)
+            result.swizzle[c] = source;
+        else
+        {
+            result.swizzle[c] = static_cast<swizzle_source>(result.channels++);
+            stored.push_back({&texture, source});
+        }
+    }
+
+    // Only constants: keep one stored channel, so that there is something to upload
+    if (stored.empty())
+    {
+        stored.push_back({&first, swizzle_source::zero});
+        result.channels = 1;
+    }
+
+    for (auto const & level : first.levels)
+        result.storage.resize(result.storage.size() + std::size_t(level.width) * level.height * result.channels);
+
+    std::size_t offset = 0;
+    for (std::size_t i = 0; i < first.levels.size(); ++i)
+    {
+        std::size_t const pixel_count = std::size_t(first.levels[i].width) * first.levels[i].height;
+        std::uint8_t * out = result.storage.data() + offset;
+
+        for (std::size_t c = 0; c < stored.size(); ++c)
+        {
+            auto const & source = stored[c];
+            if (source.channel == swizzle_source::zero)
+            {
+                for (std::size_t p = 0; p < pixel_count; ++p)
+                    out[p * result.channels + c] = 0;
+                continue;
+            }
+
+            auto const data = source.texture->levels[i].data.data();
+            int const stride = source.texture->channels;
+            int const k = static_cast<int>(source.channel);
+            for (std::size_t p = 0; p < pixel_count; ++p)
+                out[p * result.channels + c] = data[p * stride + k];
+        }
+
+        result.levels.push_back({first.levels[i].width, first.levels[i].height,
+            std::span<std::uint8_t const>(result.storage).subspan(offset, pixel_count * result.channels)});
+        offset += pixel_count * result.channels;
+    }
+
+    return result;
+}
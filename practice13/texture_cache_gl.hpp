@@ -0,0 +1,97 @@
+#pragma once
+
+#include "texture_cache.hpp"
+
+#include <GL/glew.h>
+
+#include <initializer_list>
+
+inline GLenum compressed_internal_format(block_format format)
+{
+    switch (format)
+    {
+    case block_format::bc1:
+        return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+    case block_format::bc3:
+        return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+    case block_format::bc4:
+        return GL_COMPRESSED_RED_RGTC1;
+    case block_format::bc5:
+        return GL_COMPRESSED_RG_RGTC2;
+    case block_format::bc7:
+        return GL_COMPRESSED_RGBA_BPTC_UNORM_ARB;
+    }
+    return GL_NONE;
+}
+
+// RGTC is core in GL 3.0, while S3TC and BPTC need extensions on a 3.3 context
+inline bool block_format_supported(block_format format)
+{
+    switch (format)
+    {
+    case block_format::bc1:
+    case block_format::bc3:
+        return GLEW_EXT_texture_compression_s3tc;
+    case block_format::bc4:
+    case block_format::bc5:
+        return true;
+    case block_format::bc7:
+        return GLEW_ARB_texture_compression_bptc;
+    }
+    return false;
+}
+
+// The first of the candidates the driver supports, or none to keep RGBA8
+inline std::optional<texture_compression> pick_compression(std::initializer_list<texture_compression> candidates)
+{
+    for (auto const & candidate : candidates)
+        if (block_format_supported(candidate.format))
+            return candidate;
+    return std::nullopt;
+}
+
+inline GLint swizzle_parameter(swizzle_source source)
+{
+    switch (source)
+    {
+    case swizzle_source::red: return GL_RED;
+    case swizzle_source::green: return GL_GREEN;
+    case swizzle_source::blue: return GL_BLUE;
+    case swizzle_source::alpha: return GL_ALPHA;
+    case swizzle_source::zero: return GL_ZERO;
+    case swizzle_source::one: return GL_ONE;
+    }
+    return GL_ZERO;
+}
+
+// Uploads every level of the texture to the bound GL_TEXTURE_2D, so no glGenerateMipmap is
+// needed, and sets its swizzle
+inline void upload_texture(cached_texture const & texture)
+{
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, static_cast<GLint>(texture.levels.size()) - 1);
+
+    GLint swizzle[4];
+    for (int c = 0; c < 4; ++c)
+        swizzle[c] = swizzle_parameter(texture.swizzle[c]);
+    glTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA, swizzle);
+
+    static GLenum const internal_formats[] = {GL_R8, GL_RG8, GL_RGB8, GL_RGBA8};
+    static GLenum const formats[] = {GL_RED, GL_RG, GL_RGB, GL_RGBA};
+
+    // Rows of one- to three-channel levels are not padded to 4 bytes
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+    for (std::size_t i = 0; i < texture.levels.size(); ++i)
+    {
+        auto const & level = texture.levels[i];
+        if (texture.format)
+            glCompressedTexImage2D(GL_TEXTURE_2D, i, compressed_internal_format(*texture.format), level.width, level.height, 0,
+                static_cast<GLsizei>(level.data.size()), level.data.data());
+        else
+            glTexImage2D(GL_TEXTURE_2D, i, internal_formats[texture.channels - 1], level.width, level.height, 0,
+                formats[texture.channels - 1], GL_UNSIGNED_BYTE, level.data.data());
+    }
+
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+// Block-compressed formats, each encoding 4x4 pixel blocks
+enum class block_format
+{
+    // Opaque RGB, 8 bytes per block
+    bc1,
+    // BC1 color plus a BC4 alpha block, 16 bytes
+    bc3,
+    // Red only, 8 bytes
+    bc4,
+    // Red and green as two BC4 blocks, 16 bytes; meant for normal maps
+    bc5,
+    // RGBA, 16 bytes; only mode 6 (one subset, 7-bit endpoints with p-bits, 4-bit indices) is used
+    bc7,
+};
+
+enum class compression_quality
+{
+    // Bounding box endpoints
+    fast,
+    // Endpoints along the principal axis of the block's colors
+    normal,
+    // Also refines endpoints by least squares and searches more endpoint encodings
+    high,
+};
+
+std::size_t block_bytes(block_format format);
+
+// Bytes of an image of the given size, in whole blocks
+std::size_t compressed_size(block_format format, std::uint32_t width, std::uint32_t height);
+
+// Encodes an RGBA8 image block by block, blocks in row-major order; blocks past the edge
+// repeat the last row and column. Rows of blocks are encoded in parallel.
+std::vector<std::uint8_t> compress_blocks(std::uint8_t const * pixels, std::uint32_t width, std::uint32_t height,
+    block_format format, compression_quality quality = compression_quality::normal, std::size_t thread_count = 0);
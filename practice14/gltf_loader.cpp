@@ -1,10 +1,15 @@
 #include "gltf_loader.hpp"
 
 #include <rapidjson/document.h>
-#include <rapidjson/istreamwrapper.h>
 
-#include <fstream>
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
 #include <stdexcept>
+#include <string_view>
+#include <vector>
+
+#include <glm/ext/matrix_transform.hpp>
 
 static unsigned int attribute_type_to_size(std::string const & type)
 {
@@ -12,86 +17,448 @@ static unsigned int attribute_type_to_size(std::string const & type)
     if (type == "VEC2") return 2;
     if (type == "VEC3") return 3;
     if (type == "VEC4") return 4;
+    if (type == "MAT2") return 4;
+    if (type == "MAT3") return 9;
+    if (type == "MAT4") return 16;
     return 0;
 }
 
-gltf_model load_gltf(std::filesystem::path const & path)
+static unsigned int get_uint(rapidjson::Value const & object, char const * name, unsigned int default_value)
 {
-    rapidjson::Document document;
+    auto it = object.FindMember(name);
+    return (it == object.MemberEnd()) ? default_value : it->value.GetUint();
+}
 
-    {
-        std::ifstream input(path, std::ios::binary);
-        rapidjson::IStreamWrapper stream(input);
-        document.ParseStream(stream);
-    }
+static std::uint32_t read_uint32(char const * data)
+{
+    std::uint32_t result;
+    std::memcpy(&result, data, sizeof(result));
+    return result;
+}
 
-    gltf_model result;
+static constexpr std::uint32_t glb_magic = 0x46546C67; // "glTF"
+static constexpr std::uint32_t glb_json_chunk = 0x4E4F534A; // "JSON"
+static constexpr std::uint32_t glb_bin_chunk = 0x004E4942; // "BIN\0"
 
+static bool is_glb(mapped_file const & file)
+{
+    return file.size() >= 12 && read_uint32(file.data()) == glb_magic;
+}
+
+// Splits a .glb into its JSON chunk and optional BIN chunk, both pointing into the mapping
+static std::pair<std::string_view, std::span<char const>> read_glb_chunks(mapped_file const & file, std::filesystem::path const & path)
+{
+    if (read_uint32(file.data() + 4) != 2)
+        throw std::runtime_error("Unsupported .glb version in " + path.string());
+
+    std::size_t const length = std::min<std::size_t>(read_uint32(file.data() + 8), file.size());
+
+    std::string_view json;
+    std::span<char const> bin;
+
+    for (std::size_t offset = 12; offset + 8 <= length;)
     {
-        auto buffers = document["buffers"].GetArray();
-        assert(buffers.Size() == 1);
+        std::size_t const chunk_length = read_uint32(file.data() + offset);
+        std::uint32_t const chunk_type = read_uint32(file.data() + offset + 4);
+        offset += 8;
 
-        auto const buffer_uri = buffers[0]["uri"].GetString();
+        if (chunk_length > length - offset)
+            throw std::runtime_error("Truncated .glb chunk in " + path.string());
 
-        auto const buffer_path = path.parent_path() / buffer_uri;
+        // The JSON chunk comes first and the BIN chunk, if any, right after it
+        if (chunk_type == glb_json_chunk && json.empty())
+            json = {file.data() + offset, chunk_length};
+        else if (chunk_type == glb_bin_chunk && bin.empty())
+            bin = {file.data() + offset, chunk_length};
 
-        result.buffer.resize(std::filesystem::file_size(buffer_path));
-        std::ifstream buffer(buffer_path, std::ios::binary);
-        buffer.read(result.buffer.data(), result.buffer.size());
+        offset += chunk_length;
     }
 
-    auto parse_buffer_view = [&](int index) -> gltf_model::buffer_view
+    if (json.empty())
+        throw std::runtime_error("No JSON chunk in " + path.string());
+
+    return {json, bin};
+}
+
+// Members that hold arrays are optional in glTF
+static rapidjson::Value::ConstArray get_array(rapidjson::Value const & object, char const * name)
+{
+    static rapidjson::Value const empty(rapidjson::kArrayType);
+    auto it = object.FindMember(name);
+    return (it == object.MemberEnd()) ? empty.GetArray() : it->value.GetArray();
+}
+
+// Extensions a file may list in extensionsRequired; KHR_mesh_quantization only allows
+// integer attribute types, which the accessors handle already
+static bool extension_supported(std::string_view name)
+{
+    return name == "KHR_mesh_quantization";
+}
+
+// The arrays of a glTF that are referenced by index, converted once up front, so that
+// every reference is a vector lookup instead of another walk through the DOM
+struct gltf_tables
+{
+    std::vector<gltf_model::buffer_view> buffer_views;
+    std::vector<gltf_model::accessor> accessors;
+    std::vector<gltf_model::material> materials;
+};
+
+static gltf_model::buffer_view parse_buffer_view(rapidjson::Value const & view)
+{
+    return {
+        view["buffer"].GetUint(),
+        get_uint(view, "byteOffset", 0),
+        view["byteLength"].GetUint(),
+        get_uint(view, "byteStride", 0),
+    };
+}
+
+static gltf_model::accessor parse_accessor(rapidjson::Value const & accessor, std::vector<gltf_model::buffer_view> const & views)
+{
+    auto view = [&](rapidjson::Value const & object)
     {
-        auto view = document["bufferViews"].GetArray()[index].GetObject();
-        return {view["byteOffset"].GetUint(), view["byteLength"].GetUint()};
+        return views.at(object["bufferView"].GetUint());
     };
 
-    auto parse_accessor = [&](int index) -> gltf_model::accessor
+    gltf_model::accessor result{
+        accessor.HasMember("bufferView") ? view(accessor) : gltf_model::buffer_view{gltf_model::no_buffer, 0, 0},
+        accessor["componentType"].GetUint(),
+        attribute_type_to_size(accessor["type"].GetString()),
+        accessor["count"].GetUint(),
+        get_uint(accessor, "byteOffset", 0),
+        accessor.HasMember("normalized") && accessor["normalized"].GetBool(),
+        std::nullopt,
+    };
+
+    if (accessor.HasMember("sparse"))
     {
-        auto accessor = document["accessors"].GetArray()[index].GetObject();
-        return {
-            parse_buffer_view(accessor["bufferView"].GetInt()),
-            accessor["componentType"].GetUint(),
-            attribute_type_to_size(accessor["type"].GetString()),
-            accessor["count"].GetUint(),
+        auto const & sparse = accessor["sparse"];
+        auto const & indices = sparse["indices"];
+        auto const & values = sparse["values"];
+
+        result.sparse = gltf_model::sparse{
+            sparse["count"].GetUint(),
+            view(indices),
+            get_uint(indices, "byteOffset", 0),
+            indices["componentType"].GetUint(),
+            view(values),
+            get_uint(values, "byteOffset", 0),
         };
-    };
+    }
+
+    return result;
+}
+
+static gltf_tables parse_tables(rapidjson::Document const & document)
+{
+    gltf_tables result;
+
+    for (auto const & view : get_array(document, "bufferViews"))
+        result.buffer_views.push_back(parse_buffer_view(view));
+
+    for (auto const & accessor : get_array(document, "accessors"))
+        result.accessors.push_back(parse_accessor(accessor, result.buffer_views));
+
+    auto images = get_array(document, "images");
+    auto textures = get_array(document, "textures");
+
+    for (auto const & material : get_array(document, "materials"))
+    {
+        auto & result_material = result.materials.emplace_back();
+
+        result_material.two_sided = material.HasMember("doubleSided") && material["doubleSided"].GetBool();
+        result_material.transparent = material.HasMember("alphaMode") && (material["alphaMode"].GetString() == std::string_view("BLEND"));
+
+        // Every material is converted, not only the ones primitives use
+        if (!material.HasMember("pbrMetallicRoughness"))
+            continue;
+
+        auto const & pbr = material["pbrMetallicRoughness"];
+        if (pbr.HasMember("baseColorTexture"))
+        {
+            auto const & texture = textures[pbr["baseColorTexture"]["index"].GetUint()];
+            result_material.texture_path = images[texture["source"].GetUint()]["uri"].GetString();
+        }
+        else if (pbr.HasMember("baseColorFactor"))
+        {
+            auto const & color = pbr["baseColorFactor"];
+            result_material.color = glm::vec4{
+                color[0].GetFloat(),
+                color[1].GetFloat(),
+                color[2].GetFloat(),
+                color[3].GetFloat(),
+            };
+        }
+    }
+
+    return result;
+}
+
+static glm::mat4 parse_node_transform(rapidjson::Value const & node)
+{
+    if (node.HasMember("matrix"))
+    {
+        auto const & matrix = node["matrix"];
+        glm::mat4 result;
+        for (int i = 0; i < 16; ++i)
+            result[i / 4][i % 4] = matrix[i].GetFloat();
+        return result;
+    }
+
+    glm::vec3 translation(0.f);
+    glm::quat rotation(1.f, 0.f, 0.f, 0.f);
+    glm::vec3 scale(1.f);
+
+    if (node.HasMember("translation"))
+    {
+        auto const & t = node["translation"];
+        translation = {t[0].GetFloat(), t[1].GetFloat(), t[2].GetFloat()};
+    }
+
+    if (node.HasMember("rotation"))
+    {
+        auto const & r = node["rotation"];
+        rotation = glm::quat(r[3].GetFloat(), r[0].GetFloat(), r[1].GetFloat(), r[2].GetFloat());
+    }
+
+    if (node.HasMember("scale"))
+    {
+        auto const & s = node["scale"];
+        scale = {s[0].GetFloat(), s[1].GetFloat(), s[2].GetFloat()};
+    }
+
+    return glm::translate(glm::mat4(1.f), translation) * glm::toMat4(rotation) * glm::scale(glm::mat4(1.f), scale);
+}
+
+// Global transforms of all nodes; nodes that are no node's child are roots
+static std::vector<glm::mat4> global_transforms(rapidjson::Document const & document)
+{
+    auto nodes = get_array(document, "nodes");
+
+    std::vector<bool> child(nodes.Size(), false);
+    for (auto const & node : nodes)
+        for (auto const & child_id : get_array(node, "children"))
+            child.at(child_id.GetUint()) = true;
+
+    std::vector<glm::mat4> result(nodes.Size());
+    std::vector<std::uint32_t> pending;
+    for (std::uint32_t i = 0; i < nodes.Size(); ++i)
+    {
+        if (child[i]) continue;
+        result[i] = parse_node_transform(nodes[i]);
+        pending.push_back(i);
+    }
 
-    auto parse_texture = [&](int index) -> std::string
+    while (!pending.empty())
     {
-        auto const source_index = document["textures"].GetArray()[index]["source"].GetInt();
-        return document["images"].GetArray()[source_index]["uri"].GetString();
+        std::uint32_t const parent = pending.back();
+        pending.pop_back();
+
+        for (auto const & child_id : get_array(nodes[parent], "children"))
+        {
+            std::uint32_t const i = child_id.GetUint();
+            result[i] = result[parent] * parse_node_transform(nodes[i]);
+            pending.push_back(i);
+        }
+    }
+
+    return result;
+}
+
+// Accessor bounds hold the values as stored, so those of a normalized accessor are
+// normalized the same way as its elements
+static float normalize_bound(float value, unsigned int type)
+{
+    switch (type)
+    {
+    case gltf_byte:
+        return std::max(value / 127.f, -1.f);
+    case gltf_unsigned_byte:
+        return value / 255.f;
+    case gltf_short:
+        return std::max(value / 32767.f, -1.f);
+    case gltf_unsigned_short:
+        return value / 65535.f;
+    }
+    return value;
+}
+
+std::span<char const> gltf_model::buffer_data(unsigned int index)
+{
+    auto & buffer = buffers.at(index);
+    if (buffer.data.empty() && buffer.size > 0)
+    {
+        if (buffer.path.empty())
+            throw std::runtime_error("BIN chunk buffer " + std::to_string(index) + " was released");
+
+        buffer.file = mapped_file(buffer.path);
+        if (buffer.file.size() < buffer.size)
+            throw std::runtime_error(buffer.path.string() + " is smaller than its byteLength");
+
+        buffer.data = {buffer.file.data(), buffer.size};
+    }
+    return buffer.data;
+}
+
+std::span<char const> gltf_model::view_data(buffer_view const & view)
+{
+    auto data = buffer_data(view.buffer);
+    if (view.offset > data.size() || view.size > data.size() - view.offset)
+        throw std::runtime_error("Buffer view is out of bounds of buffer " + std::to_string(view.buffer));
+    return data.subspan(view.offset, view.size);
+}
+
+accessor_source gltf_model::resolve(accessor const & accessor)
+{
+    accessor_source source;
+    source.type = accessor.type;
+    source.components = accessor.size;
+    source.normalized = accessor.normalized;
+    source.count = accessor.count;
+
+    std::size_t const element_size = gltf_component_size(accessor.type) * accessor.size;
+    source.stride = accessor.view.stride ? accessor.view.stride : element_size;
+
+    auto check_bounds = [](std::span<char const> data, std::size_t offset, std::size_t stride, std::size_t count, std::size_t element_size)
+    {
+        if (count > 0 && (offset > data.size() || (count - 1) * stride + element_size > data.size() - offset))
+            throw std::runtime_error("Accessor is out of bounds of its buffer view");
     };
 
-    auto parse_color = [&](auto const & array)
+    if (accessor.view.buffer != no_buffer)
     {
-        return glm::vec4{
-            array[0].GetFloat(),
-            array[1].GetFloat(),
-            array[2].GetFloat(),
-            array[3].GetFloat(),
-        };
+        auto data = view_data(accessor.view);
+        check_bounds(data, accessor.offset, source.stride, accessor.count, element_size);
+        source.data = data.data() + accessor.offset;
+    }
+
+    if (accessor.sparse)
+    {
+        auto const & sparse = *accessor.sparse;
+        std::size_t const index_size = gltf_component_size(sparse.index_type);
+
+        auto indices = view_data(sparse.indices);
+        auto values = view_data(sparse.values);
+        check_bounds(indices, sparse.index_offset, index_size, sparse.count, index_size);
+        check_bounds(values, sparse.value_offset, element_size, sparse.count, element_size);
+
+        source.sparse_count = sparse.count;
+        source.sparse_indices = indices.data() + sparse.index_offset;
+        source.sparse_index_type = sparse.index_type;
+        source.sparse_values = values.data() + sparse.value_offset;
+
+        // Indices are strictly increasing, so only the last one can be out of range
+        if (sparse.count > 0 && gltf_detail::read_component<std::size_t>(source.sparse_indices + (sparse.count - 1) * index_size, sparse.index_type, false) >= accessor.count)
+            throw std::runtime_error("Sparse accessor index is out of range");
+    }
+
+    return source;
+}
+
+void gltf_model::release_geometry_buffers()
+{
+    for (auto & buffer : buffers)
+    {
+        if (!buffer.geometry || buffer.animation) continue;
+
+        buffer.data = {};
+        buffer.file = mapped_file();
+    }
+}
+
+gltf_model load_gltf(std::filesystem::path const & path)
+{
+    // A .glb keeps its mapping after loading, since the BIN chunk follows the JSON in the same file
+    mapped_file file(path);
+    bool const binary = is_glb(file);
+
+    std::string_view json(file.data(), file.size());
+    std::span<char const> bin;
+    if (binary)
+        std::tie(json, bin) = read_glb_chunks(file, path);
+
+    // Parsed in situ from one copy of the JSON: strings point into the copy instead of
+    // being allocated, and the DOM comes from a pool sized after the text
+    std::vector<char> text(json.size() + 1, '\0');
+    std::memcpy(text.data(), json.data(), json.size());
+
+    rapidjson::MemoryPoolAllocator<> allocator(std::max<std::size_t>(json.size(), 64 * 1024));
+    rapidjson::Document document(&allocator);
+    document.ParseInsitu(text.data());
+    if (document.HasParseError())
+        throw std::runtime_error("Failed to parse " + path.string());
+
+    for (auto const & extension : get_array(document, "extensionsRequired"))
+        if (!extension_supported(extension.GetString()))
+            throw std::runtime_error("Unsupported required extension " + std::string(extension.GetString()) + " in " + path.string());
+
+    auto const tables = parse_tables(document);
+    auto const accessors = get_array(document, "accessors");
+
+    gltf_model result;
+
+    for (auto const & buffer : get_array(document, "buffers"))
+    {
+        auto & result_buffer = result.buffers.emplace_back();
+        result_buffer.size = buffer["byteLength"].GetUint();
+
+        if (buffer.HasMember("uri"))
+            result_buffer.path = path.parent_path() / buffer["uri"].GetString();
+        else if (binary && result.buffers.size() == 1 && !bin.empty())
+        {
+            // The .glb is mapped already and its pages are only read once touched, so the BIN
+            // chunk keeps the mapping instead of mapping the file again; moving the mapping
+            // doesn't move the mapped memory, so bin stays valid
+            if (bin.size() < result_buffer.size)
+                throw std::runtime_error("BIN chunk is smaller than its byteLength in " + path.string());
+
+            result_buffer.data = bin.first(result_buffer.size);
+            result_buffer.file = std::move(file);
+        }
+        else
+            throw std::runtime_error("Buffer without uri in " + path.string());
+    }
+
+    // Records what the buffers an accessor reads from are used for
+    auto mark_buffers = [&](gltf_model::accessor const & accessor, bool gltf_model::buffer::* usage)
+    {
+        if (accessor.view.buffer != gltf_model::no_buffer)
+            result.buffers.at(accessor.view.buffer).*usage = true;
+        if (accessor.sparse)
+        {
+            result.buffers.at(accessor.sparse->indices.buffer).*usage = true;
+            result.buffers.at(accessor.sparse->values.buffer).*usage = true;
+        }
     };
 
-    auto parse_vector = [&](auto const & array)
+    auto geometry_accessor = [&](rapidjson::Value const & index)
     {
-        return glm::vec3{
-            array[0].GetFloat(),
-            array[1].GetFloat(),
-            array[2].GetFloat(),
-        };
+        auto const & accessor = tables.accessors.at(index.GetUint());
+        mark_buffers(accessor, &gltf_model::buffer::geometry);
+        return accessor;
     };
 
-    auto parse_bounds = [&](int index)
+    auto parse_bounds = [&](rapidjson::Value const & index)
     {
-        auto accessor = document["accessors"].GetArray()[index].GetObject();
+        auto const & accessor = accessors[index.GetUint()];
+        auto const & result_accessor = tables.accessors.at(index.GetUint());
+
+        auto parse_vector = [&](auto const & array)
+        {
+            glm::vec3 result;
+            for (int i = 0; i < 3; ++i)
+                result[i] = result_accessor.normalized ? normalize_bound(array[i].GetFloat(), result_accessor.type) : array[i].GetFloat();
+            return result;
+        };
+
         return std::make_pair(
             parse_vector(accessor["min"]),
             parse_vector(accessor["max"])
         );
     };
 
-    for (auto const & mesh : document["meshes"].GetArray())
+    for (auto const & mesh : get_array(document, "meshes"))
     {
         auto & result_mesh = result.meshes.emplace_back();
         result_mesh.name = mesh["name"].GetString();
@@ -101,23 +468,33 @@ gltf_model load_gltf(std::filesystem::path const & path)
 
         auto const & attributes = primitives[0]["attributes"];
 
-        result_mesh.indices = parse_accessor(primitives[0]["indices"].GetInt());
-        result_mesh.position = parse_accessor(attributes["POSITION"].GetInt());
-        result_mesh.normal = parse_accessor(attributes["NORMAL"].GetInt());
-        result_mesh.texcoord = parse_accessor(attributes["TEXCOORD_0"].GetInt());
+        result_mesh.indices = geometry_accessor(primitives[0]["indices"]);
+        result_mesh.position = geometry_accessor(attributes["POSITION"]);
+        result_mesh.normal = geometry_accessor(attributes["NORMAL"]);
+        result_mesh.texcoord = geometry_accessor(attributes["TEXCOORD_0"]);
 
-        std::tie(result_mesh.min, result_mesh.max) = parse_bounds(attributes["POSITION"].GetInt());
+        std::tie(result_mesh.min, result_mesh.max) = parse_bounds(attributes["POSITION"]);
 
-        auto const & material = document["materials"].GetArray()[primitives[0]["material"].GetInt()];
+        result_mesh.material = tables.materials.at(primitives[0]["material"].GetUint());
+    }
 
-        result_mesh.material.two_sided = material.HasMember("doubleSided") && material["doubleSided"].GetBool();
-        result_mesh.material.transparent = material.HasMember("alphaMode") && (material["alphaMode"].GetString() == std::string("BLEND"));
+    // A mesh takes the transform of the first node that instances it; with quantized
+    // positions this transform also maps them back to the scene's units
+    {
+        auto const transforms = global_transforms(document);
+        auto nodes = get_array(document, "nodes");
 
-        auto const & pbr = material["pbrMetallicRoughness"];
-        if (pbr.HasMember("baseColorTexture"))
-            result_mesh.material.texture_path = parse_texture(pbr["baseColorTexture"]["index"].GetInt());
-        else if (pbr.HasMember("baseColorFactor"))
-            result_mesh.material.color = parse_color(pbr["baseColorFactor"].GetArray());
+        std::vector<bool> placed(result.meshes.size(), false);
+        for (std::uint32_t i = 0; i < nodes.Size(); ++i)
+        {
+            if (!nodes[i].HasMember("mesh")) continue;
+
+            std::uint32_t const mesh_id = nodes[i]["mesh"].GetUint();
+            if (placed.at(mesh_id)) continue;
+
+            result.meshes[mesh_id].transform = transforms[i];
+            placed[mesh_id] = true;
+        }
     }
 
     return result;
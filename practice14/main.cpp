@@ -18,6 +18,7 @@
 #include <cmath>
 
 #include <glm/vec3.hpp>
+#include <glm/mat3x3.hpp>
 #include <glm/mat4x4.hpp>
 #include <glm/ext/matrix_transform.hpp>
 #include <glm/ext/matrix_clip_space.hpp>
@@ -26,10 +27,11 @@
 #include <glm/gtx/string_cast.hpp>
 
 #include "gltf_loader.hpp"
-#include "stb_image.h"
+#include "texture_cache_gl.hpp"
 #include "aabb.hpp"
 #include "frustum.hpp"
 #include "intersect.hpp"
+#include "meshlet.hpp"
 
 std::string to_string(std::string_view str)
 {
@@ -50,6 +52,7 @@ const char vertex_shader_source[] =
 R"(#version 330 core
 
 uniform mat4 model;
+uniform mat3 normal_matrix;
 uniform mat4 view;
 uniform mat4 projection;
 
@@ -63,7 +66,7 @@ out vec2 texcoord;
 void main()
 {
     gl_Position = projection * view * model * vec4(in_position, 1.0);
-    normal = mat3(model) * in_normal;
+    normal = normal_matrix * in_normal;
     texcoord = in_texcoord;
 }
 )";
@@ -173,6 +176,7 @@ int main() try
     auto program = create_program(vertex_shader, fragment_shader);
 
     GLuint model_location = glGetUniformLocation(program, "model");
+    GLuint normal_matrix_location = glGetUniformLocation(program, "normal_matrix");
     GLuint view_location = glGetUniformLocation(program, "view");
     GLuint projection_location = glGetUniformLocation(program, "projection");
     GLuint albedo_location = glGetUniformLocation(program, "albedo");
@@ -184,28 +188,54 @@ int main() try
     const std::string project_root = PROJECT_ROOT;
     const std::string model_path = project_root + "/bunny/bunny.gltf";
 
-    auto const input_model = load_gltf(model_path);
-    GLuint vbo;
-    glGenBuffers(1, &vbo);
-    glBindBuffer(GL_ARRAY_BUFFER, vbo);
-    glBufferData(GL_ARRAY_BUFFER, input_model.buffer.size(), input_model.buffer.data(), GL_STATIC_DRAW);
+    auto input_model = load_gltf(model_path);
+
+    // One GL buffer per glTF buffer the meshes use, created when first needed
+    std::map<unsigned int, GLuint> vbos;
+    auto buffer_object = [&](unsigned int index)
+    {
+        if (auto it = vbos.find(index); it != vbos.end())
+            return it->second;
+
+        auto data = input_model.buffer_data(index);
+
+        GLuint vbo;
+        glGenBuffers(1, &vbo);
+        glBindBuffer(GL_ARRAY_BUFFER, vbo);
+        glBufferData(GL_ARRAY_BUFFER, data.size(), data.data(), GL_STATIC_DRAW);
+        return vbos[index] = vbo;
+    };
+
+    // Accessors are drawn straight from the uploaded glTF buffers, which only works when
+    // their data is there: zero-filled (no bufferView) and sparse accessors aren't supported
+    auto accessor_buffer = [&](gltf_model::accessor const & accessor, std::string const & usage)
+    {
+        if (accessor.view.buffer == gltf_model::no_buffer)
+            throw std::runtime_error("Accessor without a bufferView can't be used as " + usage + " in " + model_path);
+        if (accessor.sparse)
+            throw std::runtime_error("Sparse accessor can't be used as " + usage + " in " + model_path);
+        return buffer_object(accessor.view.buffer);
+    };
 
     std::vector<GLuint> vaos;
     for (int i = 0; i < input_model.meshes.size(); ++i)
     {
+        // Creating the buffer binds GL_ARRAY_BUFFER, so it is done before binding the VAO
+        GLuint const ebo = accessor_buffer(input_model.meshes[i].indices, "indices");
+
         GLuint vao;
         glGenVertexArrays(1, &vao);
         glBindVertexArray(vao);
 
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, vbo);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
 
-        auto setup_attribute = [](int index, gltf_model::accessor const & accessor)
+        auto setup_attribute = [&](int index, gltf_model::accessor const & accessor)
         {
+            glBindBuffer(GL_ARRAY_BUFFER, accessor_buffer(accessor, "vertex attribute " + std::to_string(index)));
             glEnableVertexAttribArray(index);
-            glVertexAttribPointer(index, accessor.size, accessor.type, GL_FALSE, 0, reinterpret_cast<void *>(accessor.view.offset));
+            glVertexAttribPointer(index, accessor.size, accessor.type, accessor.normalized ? GL_TRUE : GL_FALSE, accessor.view.stride, reinterpret_cast<void *>(accessor.view.offset + accessor.offset));
         };
 
-        glBindBuffer(GL_ARRAY_BUFFER, vbo);
         setup_attribute(0, input_model.meshes[i].position);
         setup_attribute(1, input_model.meshes[i].normal);
         setup_attribute(2, input_model.meshes[i].texcoord);
@@ -213,24 +243,36 @@ int main() try
         vaos.push_back(vao);
     }
 
+    // The first mesh is split into meshlets, which are culled against the view frustum
+    // and by their normal cones before drawing
+    auto const & culled_mesh = input_model.meshes[0];
+    auto const meshlets = build_meshlets(
+        input_model.elements<glm::vec3>(culled_mesh.position).to_vector(),
+        input_model.elements<std::uint32_t>(culled_mesh.indices).to_vector());
+    std::cout << "Meshlets: " << meshlets.meshlets.size() << std::endl;
+
+    input_model.release_geometry_buffers();
+
+    GLuint meshlet_ebo;
+    glGenBuffers(1, &meshlet_ebo);
+    glBindVertexArray(vaos[0]);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, meshlet_ebo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, meshlets.indices.size() * sizeof(meshlets.indices[0]), meshlets.indices.data(), GL_STATIC_DRAW);
+
+    std::vector<GLsizei> draw_counts;
+    std::vector<void const *> draw_offsets;
+
     GLuint texture;
     {
         auto const & mesh = input_model.meshes[0];
 
         auto path = std::filesystem::path(model_path).parent_path() / *mesh.material.texture_path;
 
-        int width, height, channels;
-        auto data = stbi_load(path.c_str(), &width, &height, &channels, 4);
-        assert(data);
-
         glGenTextures(1, &texture);
         glBindTexture(GL_TEXTURE_2D, texture);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
-
-        stbi_image_free(data);
+        upload_texture(load_texture_cached(path, {}, pick_compression({{block_format::bc7}, {block_format::bc1}})));
     }
 
     auto last_frame_start = std::chrono::high_resolution_clock::now();
@@ -316,7 +358,9 @@ int main() try
         float near = 0.1f;
         float far = 100.f;
 
-        glm::mat4 model(1.f);
+        glm::mat4 model = culled_mesh.transform;
+        // The model matrix dequantizes positions, so it is usually a non-uniform scale
+        glm::mat3 normal_matrix = glm::transpose(glm::inverse(glm::mat3(model)));
 
         glm::mat4 view(1.f);
         view = glm::rotate(view, camera_rotation, {0.f, 1.f, 0.f});
@@ -330,6 +374,7 @@ int main() try
 
         glUseProgram(program);
         glUniformMatrix4fv(model_location, 1, GL_FALSE, reinterpret_cast<float *>(&model));
+        glUniformMatrix3fv(normal_matrix_location, 1, GL_FALSE, reinterpret_cast<float *>(&normal_matrix));
         glUniformMatrix4fv(view_location, 1, GL_FALSE, reinterpret_cast<float *>(&view));
         glUniformMatrix4fv(projection_location, 1, GL_FALSE, reinterpret_cast<float *>(&projection));
         glUniform3fv(light_direction_location, 1, reinterpret_cast<float *>(&light_direction));
@@ -337,9 +382,32 @@ int main() try
         glBindTexture(GL_TEXTURE_2D, texture);
 
         {
-            auto const & mesh = input_model.meshes[0];
+            frustum view_frustum(projection * view * model);
+            glm::vec3 model_camera_position = glm::vec3(glm::inverse(model) * glm::vec4(camera_position, 1.f));
+
+            // Visible meshlets, with neighbouring index ranges merged into one draw
+            draw_counts.clear();
+            draw_offsets.clear();
+            std::uint32_t range_end = 0;
+            for (auto const & m : meshlets.meshlets)
+            {
+                if (!m.visible(view_frustum))
+                    continue;
+                if (!culled_mesh.material.two_sided && m.backfacing(model_camera_position))
+                    continue;
+
+                if (!draw_counts.empty() && range_end == m.first_index)
+                    draw_counts.back() += m.index_count;
+                else
+                {
+                    draw_counts.push_back(m.index_count);
+                    draw_offsets.push_back(reinterpret_cast<void const *>(m.first_index * sizeof(std::uint32_t)));
+                }
+                range_end = m.first_index + m.index_count;
+            }
+
             glBindVertexArray(vaos[0]);
-            glDrawElements(GL_TRIANGLES, mesh.indices.count, mesh.indices.type, reinterpret_cast<void *>(mesh.indices.view.offset));
+            glMultiDrawElements(GL_TRIANGLES, draw_counts.data(), GL_UNSIGNED_INT, draw_offsets.data(), draw_counts.size());
         }
 
         SDL_GL_SwapWindow(window);
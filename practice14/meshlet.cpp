@@ -0,0 +1,267 @@
+#include "meshlet.hpp"
+#include "intersect.hpp"
+
+#include <glm/geometric.hpp>
+
+#include <limits>
+#include <algorithm>
+
+namespace
+{
+
+	constexpr std::uint32_t invalid = std::numeric_limits<std::uint32_t>::max();
+
+	// Ritter's bounding sphere: start from the most distant pair of axis extremes, then grow to fit every point
+	void compute_sphere(meshlet & m, std::span<glm::vec3 const> points)
+	{
+		std::size_t extremes[6] = {0, 0, 0, 0, 0, 0};
+		for (std::size_t i = 0; i < points.size(); ++i)
+			for (int axis = 0; axis < 3; ++axis)
+			{
+				if (points[i][axis] < points[extremes[2 * axis]][axis])
+					extremes[2 * axis] = i;
+				if (points[i][axis] > points[extremes[2 * axis + 1]][axis])
+					extremes[2 * axis + 1] = i;
+			}
+
+		int best_axis = 0;
+		float best_distance = -1.f;
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			float d = glm::distance(points[extremes[2 * axis]], points[extremes[2 * axis + 1]]);
+			if (d > best_distance)
+			{
+				best_distance = d;
+				best_axis = axis;
+			}
+		}
+
+		m.center = (points[extremes[2 * best_axis]] + points[extremes[2 * best_axis + 1]]) * 0.5f;
+		m.radius = best_distance * 0.5f;
+
+		for (auto const & p : points)
+		{
+			float d = glm::distance(p, m.center);
+			if (d > m.radius)
+			{
+				float new_radius = (m.radius + d) * 0.5f;
+				m.center += (p - m.center) * ((new_radius - m.radius) / d);
+				m.radius = new_radius;
+			}
+		}
+	}
+
+	void compute_bounds(meshlet & m, std::span<glm::vec3 const> positions, std::span<std::uint32_t const> indices,
+		std::vector<glm::vec3> & points)
+	{
+		points.clear();
+		for (auto i : indices)
+			points.push_back(positions[i]);
+
+		m.min = glm::vec3(std::numeric_limits<float>::infinity());
+		m.max = -m.min;
+		for (auto const & p : points)
+		{
+			m.min = glm::min(m.min, p);
+			m.max = glm::max(m.max, p);
+		}
+
+		compute_sphere(m, points);
+
+		// Normal cone around the average normal; degenerate triangles don't face anywhere
+		std::vector<glm::vec3> normals;
+		glm::vec3 sum(0.f);
+		for (std::size_t t = 0; t + 2 < indices.size(); t += 3)
+		{
+			glm::vec3 n = glm::cross(positions[indices[t + 1]] - positions[indices[t]], positions[indices[t + 2]] - positions[indices[t]]);
+			float length = glm::length(n);
+			if (length == 0.f)
+				continue;
+			normals.push_back(n / length);
+			sum += normals.back();
+		}
+
+		m.cone_axis = glm::vec3(0.f, 0.f, 1.f);
+		m.cone_cutoff = 1.f;
+
+		float sum_length = glm::length(sum);
+		if (normals.empty() || sum_length == 0.f)
+			return;
+
+		m.cone_axis = sum / sum_length;
+
+		float min_dot = 1.f;
+		for (auto const & n : normals)
+			min_dot = std::min(min_dot, glm::dot(n, m.cone_axis));
+
+		// Cones wider than ~84 degrees are practically never fully backfacing
+		if (min_dot > 0.1f)
+			m.cone_cutoff = std::sqrt(1.f - min_dot * min_dot);
+	}
+
+}
+
+bool meshlet::backfacing(glm::vec3 const & camera_position) const
+{
+	glm::vec3 d = center - camera_position;
+	return glm::dot(d, cone_axis) >= cone_cutoff * glm::length(d) + radius;
+}
+
+bool meshlet::visible(frustum const & f) const
+{
+	return intersect(f, aabb(min, max));
+}
+
+meshlet_mesh build_meshlets(std::span<glm::vec3 const> positions, std::span<std::uint32_t const> indices,
+	std::size_t max_vertices, std::size_t max_triangles)
+{
+	std::size_t const vertex_count = positions.size();
+	std::size_t const triangle_count = indices.size() / 3;
+
+	// Triangles around each vertex, as offsets into one flat array
+	std::vector<std::uint32_t> adjacency_offset(vertex_count + 1, 0);
+	for (std::size_t i = 0; i < triangle_count * 3; ++i)
+		++adjacency_offset[indices[i] + 1];
+	for (std::size_t v = 0; v < vertex_count; ++v)
+		adjacency_offset[v + 1] += adjacency_offset[v];
+
+	std::vector<std::uint32_t> adjacency(triangle_count * 3);
+	{
+		std::vector<std::uint32_t> fill(adjacency_offset.begin(), adjacency_offset.end() - 1);
+		for (std::size_t i = 0; i < triangle_count * 3; ++i)
+			adjacency[fill[indices[i]]++] = i / 3;
+	}
+
+	meshlet_mesh result;
+	result.indices.reserve(triangle_count * 3);
+
+	std::vector<bool> emitted(triangle_count, false);
+
+	// Vertex -> id of the meshlet that last used it
+	std::vector<std::uint32_t> vertex_meshlet(vertex_count, invalid);
+
+	std::vector<std::uint32_t> candidates;
+	std::vector<glm::vec3> points;
+
+	meshlet current{};
+	std::uint32_t current_vertices = 0;
+	glm::vec3 centroid_sum(0.f);
+
+	auto new_vertex_count = [&](std::uint32_t t)
+	{
+		std::uint32_t count = 0;
+		for (std::size_t k = 0; k < 3; ++k)
+			count += vertex_meshlet[indices[3 * t + k]] != result.meshlets.size();
+		return count;
+	};
+
+	auto triangle_center = [&](std::uint32_t t)
+	{
+		return (positions[indices[3 * t]] + positions[indices[3 * t + 1]] + positions[indices[3 * t + 2]]) / 3.f;
+	};
+
+	auto finish_meshlet = [&]
+	{
+		current.index_count = result.indices.size() - current.first_index;
+		current.vertex_count = current_vertices;
+		compute_bounds(current, positions, std::span(result.indices).subspan(current.first_index, current.index_count), points);
+		result.meshlets.push_back(current);
+
+		current = meshlet{};
+		current.first_index = result.indices.size();
+		current_vertices = 0;
+		centroid_sum = glm::vec3(0.f);
+	};
+
+	auto add_triangle = [&](std::uint32_t t)
+	{
+		emitted[t] = true;
+		for (std::size_t k = 0; k < 3; ++k)
+		{
+			std::uint32_t v = indices[3 * t + k];
+			result.indices.push_back(v);
+
+			if (vertex_meshlet[v] == result.meshlets.size())
+				continue;
+
+			vertex_meshlet[v] = result.meshlets.size();
+			++current_vertices;
+			centroid_sum += positions[v];
+
+			for (std::uint32_t i = adjacency_offset[v]; i < adjacency_offset[v + 1]; ++i)
+				if (!emitted[adjacency[i]])
+					candidates.push_back(adjacency[i]);
+		}
+	};
+
+	std::size_t scan_position = 0;
+
+	for (std::size_t added = 0; added < triangle_count; ++added)
+	{
+		// Best neighbouring triangle: fewest new vertices first, then closest to the meshlet's centroid
+		std::uint32_t best = invalid;
+		std::uint32_t best_new_vertices = 0;
+		float best_distance = 0.f;
+
+		if (current_vertices > 0)
+		{
+			glm::vec3 centroid = centroid_sum / static_cast<float>(current_vertices);
+
+			std::size_t write = 0;
+			for (auto t : candidates)
+			{
+				if (emitted[t])
+					continue;
+				candidates[write++] = t;
+
+				std::uint32_t n = new_vertex_count(t);
+				if (current_vertices + n > max_vertices)
+					continue;
+
+				glm::vec3 offset = triangle_center(t) - centroid;
+				float distance = glm::dot(offset, offset);
+				if (best == invalid || n < best_new_vertices || (n == best_new_vertices && distance < best_distance))
+				{
+					best = t;
+					best_new_vertices = n;
+					best_distance = distance;
+				}
+			}
+			candidates.resize(write);
+
+			// Full, or nothing connected is left
+			if (best == invalid)
+				finish_meshlet();
+		}
+
+		if (best == invalid)
+		{
+			// Seed a new meshlet next to the previous one, or with the next triangle in order
+			for (auto t : candidates)
+				if (!emitted[t])
+				{
+					best = t;
+					break;
+				}
+
+			if (best == invalid)
+			{
+				while (emitted[scan_position])
+					++scan_position;
+				best = scan_position;
+			}
+
+			candidates.clear();
+		}
+
+		add_triangle(best);
+
+		if ((result.indices.size() - current.first_index) / 3 >= max_triangles)
+			finish_meshlet();
+	}
+
+	if (current_vertices > 0)
+		finish_meshlet();
+
+	return result;
+}
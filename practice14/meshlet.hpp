@@ -0,0 +1,52 @@
+#pragma once
+
+#include "aabb.hpp"
+#include "frustum.hpp"
+
+#include <glm/vec3.hpp>
+
+#include <span>
+#include <vector>
+#include <cstdint>
+
+// A small spatially coherent cluster of triangles that is culled as a whole
+struct meshlet
+{
+	// Range of meshlet_mesh::indices, in indices (a multiple of 3)
+	std::uint32_t first_index;
+	std::uint32_t index_count;
+	std::uint32_t vertex_count;
+
+	glm::vec3 min;
+	glm::vec3 max;
+
+	glm::vec3 center;
+	float radius;
+
+	// All triangle normals are within the cone around the axis. cone_cutoff is the
+	// sine of its half-angle, or 1 if the triangles face too many directions to cull.
+	glm::vec3 cone_axis;
+	float cone_cutoff;
+
+	// Whether every triangle faces away from a camera at this position
+	bool backfacing(glm::vec3 const & camera_position) const;
+
+	// Whether the bounding box may be visible; relies on the SAT test from intersect.hpp
+	bool visible(frustum const & f) const;
+};
+
+struct meshlet_mesh
+{
+	// The source triangles reordered so that every meshlet is a contiguous range
+	std::vector<std::uint32_t> indices;
+	std::vector<meshlet> meshlets;
+};
+
+constexpr std::size_t meshlet_max_vertices = 64;
+constexpr std::size_t meshlet_max_triangles = 124;
+
+// Greedily grows meshlets over shared edges, preferring triangles that add the fewest
+// new vertices and stay close to the meshlet's center. Works for any indexed triangle
+// list, e.g. obj_data positions or a glTF primitive.
+meshlet_mesh build_meshlets(std::span<glm::vec3 const> positions, std::span<std::uint32_t const> indices,
+	std::size_t max_vertices = meshlet_max_vertices, std::size_t max_triangles = meshlet_max_triangles);
@@ -0,0 +1,86 @@
+#pragma once
+
+#include "mapped_file.hpp"
+#include "mip_generator.hpp"
+#include "block_compression.hpp"
+
+#include <filesystem>
+#include <cstdint>
+#include <vector>
+#include <array>
+#include <span>
+#include <optional>
+
+// What a sampled channel reads: one of the stored channels, or a constant
+enum class swizzle_source : std::uint8_t
+{
+    red,
+    green,
+    blue,
+    alpha,
+    zero,
+    one,
+};
+
+// Sources of the sampled red, green, blue and alpha, applied with GL_TEXTURE_SWIZZLE_RGBA
+using channel_swizzle = std::array<swizzle_source, 4>;
+
+inline constexpr channel_swizzle identity_swizzle = {swizzle_source::red, swizzle_source::green, swizzle_source::blue, swizzle_source::alpha};
+
+// An image with its full mip chain, down to 1x1, as pixels of 1 to 4 8-bit channels or
+// compressed blocks. Usually the levels point straight into a memory-mapped cache, so
+// they can be handed to glTexImage2D or glCompressedTexImage2D as is.
+struct cached_texture
+{
+    struct level
+    {
+        int width;
+        int height;
+        std::span<std::uint8_t const> data;
+    };
+
+    std::vector<level> levels;
+
+    // Set if the levels hold blocks of this format instead of pixels
+    std::optional<block_format> format;
+
+    // Stored channels per pixel (or per block texel), and how sampling maps them to RGBA
+    int channels = 4;
+    channel_swizzle swizzle = identity_swizzle;
+
+    // Backing storage: the mapped cache, or the decoded levels if the cache could not be written
+    mapped_file file;
+    std::vector<std::uint8_t> storage;
+};
+
+struct texture_compression
+{
+    block_format format;
+    compression_quality quality = compression_quality::normal;
+};
+
+// Loads an image through a cache stored next to it (<path>.texcache) that holds the
+// decoded pixels and every mip level, each starting on a page boundary. Like
+// load_obj_cached, the cache is keyed by the source path, size, modification time and
+// content hash, the mip options and the compression, and is rebuilt whenever any of them
+// changes; only then is the image decoded (with stb_image), its mip chain built with
+// generate_mips and, if requested, each level block-compressed.
+// Gray images are stored as one channel (R8, or BC4 when compressed) and gray images with
+// alpha as two (RG8 or BC5), with a swizzle that samples them as before. Throws if the
+// image can't be decoded.
+cached_texture load_texture_cached(std::filesystem::path const & path, mip_options const & options = {},
+    std::optional<texture_compression> const & compression = std::nullopt);
+
+// A channel of a packed texture: a channel of an image (as sampled), or a constant zero
+// or one if the path is empty
+struct packed_channel
+{
+    std::filesystem::path path;
+    swizzle_source source = swizzle_source::red;
+};
+
+// Packs channels of same-sized images, e.g. ambient occlusion, roughness and metallic
+// maps, into one texture. Each image goes through load_texture_cached; only channels
+// that come from images are stored, constants become part of the swizzle. The result is
+// kept in memory and not compressed. Throws if the images differ in size.
+cached_texture pack_textures(std::array<packed_channel, 4> const & channels, mip_options const & options = {});
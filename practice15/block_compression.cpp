@@ -0,0 +1,585 @@
+#include "block_compression.hpp"
+#include "parallel_for.hpp"
+
+#include <cmath>
+#include <array>
+#include <thread>
+#include <string>
+#include <cstring>
+#include <utility>
+#include <algorithm>
+#include <exception>
+#include <stdexcept>
+
+namespace
+{
+
+    // Fewer blocks than this are not worth a separate thread
+    constexpr std::size_t min_blocks_per_thread = 256;
+
+    template <int N>
+    using color = std::array<float, N>;
+
+    struct block
+    {
+        std::uint8_t pixels[16][4];
+    };
+
+    block load_block(std::uint8_t const * pixels, std::uint32_t width, std::uint32_t height, std::uint32_t block_x, std::uint32_t block_y)
+    {
+        block result;
+        for (std::uint32_t y = 0; y < 4; ++y)
+            for (std::uint32_t x = 0; x < 4; ++x)
+            {
+                std::uint32_t const px = std::min(block_x * 4 + x, width - 1);
+                std::uint32_t const py = std::min(block_y * 4 + y, height - 1);
+                std::memcpy(result.pixels[y * 4 + x], pixels + (std::size_t(py) * width + px) * 4, 4);
+            }
+        return result;
+    }
+
+    template <int N>
+    void block_colors(block const & b, int first_channel, color<N> * colors)
+    {
+        for (int i = 0; i < 16; ++i)
+            for (int c = 0; c < N; ++c)
+                colors[i][c] = b.pixels[i][first_channel + c];
+    }
+
+    // Appends fields to zero-initialized memory, starting from the lowest bit
+    struct bit_writer
+    {
+        std::uint8_t * data;
+        std::size_t position = 0;
+
+        void write(std::uint32_t value, int bits)
+        {
+            for (int i = 0; i < bits; ++i, ++position)
+                if ((value >> i) & 1)
+                    data[position / 8] |= 1 << (position % 8);
+        }
+    };
+
+    template <int N>
+    float distance2(color<N> const & a, color<N> const & b)
+    {
+        float result = 0.f;
+        for (int c = 0; c < N; ++c)
+            result += (a[c] - b[c]) * (a[c] - b[c]);
+        return result;
+    }
+
+    template <int N>
+    color<N> clamp_color(color<N> c)
+    {
+        for (auto & v : c)
+            v = std::clamp(v, 0.f, 255.f);
+        return c;
+    }
+
+    // Ends of a line through the colors: the bounding box diagonal for the fast preset,
+    // otherwise the principal axis clipped to the extent of the projected colors
+    template <int N>
+    std::pair<color<N>, color<N>> fit_line(color<N> const * colors, compression_quality quality)
+    {
+        color<N> lo = colors[0], hi = colors[0];
+        for (int i = 1; i < 16; ++i)
+            for (int c = 0; c < N; ++c)
+            {
+                lo[c] = std::min(lo[c], colors[i][c]);
+                hi[c] = std::max(hi[c], colors[i][c]);
+            }
+
+        if (quality == compression_quality::fast)
+        {
+            // The extremes rarely land exactly on the endpoints, so move them inwards a little
+            for (int c = 0; c < N; ++c)
+            {
+                float const inset = (hi[c] - lo[c]) / 16.f;
+                lo[c] += inset;
+                hi[c] -= inset;
+            }
+            return {lo, hi};
+        }
+
+        color<N> mean{};
+        for (int i = 0; i < 16; ++i)
+            for (int c = 0; c < N; ++c)
+                mean[c] += colors[i][c] / 16.f;
+
+        float covariance[N][N] = {};
+        for (int i = 0; i < 16; ++i)
+            for (int a = 0; a < N; ++a)
+                for (int b = 0; b < N; ++b)
+                    covariance[a][b] += (colors[i][a] - mean[a]) * (colors[i][b] - mean[b]);
+
+        // Power iteration, starting from the bounding box diagonal
+        color<N> axis;
+        for (int c = 0; c < N; ++c)
+            axis[c] = hi[c] - lo[c];
+        for (int iteration = 0; iteration < 8; ++iteration)
+        {
+            color<N> next{};
+            for (int a = 0; a < N; ++a)
+                for (int b = 0; b < N; ++b)
+                    next[a] += covariance[a][b] * axis[b];
+
+            float scale = 0.f;
+            for (int c = 0; c < N; ++c)
+                scale = std::max(scale, std::abs(next[c]));
+            if (scale == 0.f)
+                break;
+            for (int c = 0; c < N; ++c)
+                axis[c] = next[c] / scale;
+        }
+
+        float const length2 = distance2<N>(axis, color<N>{});
+        if (length2 < 1e-12f)
+            return {mean, mean};
+
+        float t_min = 0.f, t_max = 0.f;
+        for (int i = 0; i < 16; ++i)
+        {
+            float t = 0.f;
+            for (int c = 0; c < N; ++c)
+                t += (colors[i][c] - mean[c]) * axis[c];
+            t_min = std::min(t_min, t / length2);
+            t_max = std::max(t_max, t / length2);
+        }
+
+        std::pair<color<N>, color<N>> result;
+        for (int c = 0; c < N; ++c)
+        {
+            result.first[c] = mean[c] + t_min * axis[c];
+            result.second[c] = mean[c] + t_max * axis[c];
+        }
+        result.first = clamp_color<N>(result.first);
+        result.second = clamp_color<N>(result.second);
+        return result;
+    }
+
+    // Least squares endpoints for pixels interpolated with the given weights of e1;
+    // leaves the endpoints alone if the weights can't determine them
+    template <int N>
+    void refine_endpoints(color<N> const * colors, float const * weights, color<N> & e0, color<N> & e1)
+    {
+        float a = 0.f, b = 0.f, c = 0.f;
+        color<N> x{}, y{};
+        for (int i = 0; i < 16; ++i)
+        {
+            float const w = weights[i];
+            a += (1.f - w) * (1.f - w);
+            b += (1.f - w) * w;
+            c += w * w;
+            for (int k = 0; k < N; ++k)
+            {
+                x[k] += (1.f - w) * colors[i][k];
+                y[k] += w * colors[i][k];
+            }
+        }
+
+        float const det = a * c - b * b;
+        if (std::abs(det) < 1e-6f)
+            return;
+
+        for (int k = 0; k < N; ++k)
+        {
+            e0[k] = (c * x[k] - b * y[k]) / det;
+            e1[k] = (a * y[k] - b * x[k]) / det;
+        }
+        e0 = clamp_color<N>(e0);
+        e1 = clamp_color<N>(e1);
+    }
+
+    // BC1: two RGB565 endpoints and 2-bit indices; only the four-color mode (c0 > c1) is used
+
+    std::uint16_t pack_565(color<3> const & c)
+    {
+        auto r = static_cast<std::uint16_t>(std::lround(c[0] * 31.f / 255.f));
+        auto g = static_cast<std::uint16_t>(std::lround(c[1] * 63.f / 255.f));
+        auto b = static_cast<std::uint16_t>(std::lround(c[2] * 31.f / 255.f));
+        return (r << 11) | (g << 5) | b;
+    }
+
+    color<3> unpack_565(std::uint16_t v)
+    {
+        int const r = (v >> 11) & 31, g = (v >> 5) & 63, b = v & 31;
+        return {float((r << 3) | (r >> 2)), float((g << 2) | (g >> 4)), float((b << 3) | (b >> 2))};
+    }
+
+    // Weight of c1 in the palette entry of each index
+    constexpr float bc1_weights[4] = {0.f, 1.f, 1.f / 3.f, 2.f / 3.f};
+
+    struct bc1_encoding
+    {
+        std::uint16_t c0, c1;
+        std::uint32_t indices;
+        float error;
+    };
+
+    bc1_encoding encode_bc1_endpoints(color<3> const * colors, color<3> const & e0, color<3> const & e1)
+    {
+        bc1_encoding result{pack_565(e0), pack_565(e1), 0, 0.f};
+        if (result.c0 < result.c1)
+            std::swap(result.c0, result.c1);
+
+        color<3> palette[4] = {unpack_565(result.c0), unpack_565(result.c1)};
+        for (int c = 0; c < 3; ++c)
+        {
+            palette[2][c] = (2.f * palette[0][c] + palette[1][c]) / 3.f;
+            palette[3][c] = (palette[0][c] + 2.f * palette[1][c]) / 3.f;
+        }
+
+        // Equal endpoints would select the three-color mode, where index 0 is still c0
+        int const palette_size = (result.c0 == result.c1) ? 1 : 4;
+
+        for (int i = 0; i < 16; ++i)
+        {
+            int best = 0;
+            float best_error = distance2<3>(colors[i], palette[0]);
+            for (int j = 1; j < palette_size; ++j)
+                if (float const error = distance2<3>(colors[i], palette[j]); error < best_error)
+                {
+                    best = j;
+                    best_error = error;
+                }
+            result.indices |= std::uint32_t(best) << (2 * i);
+            result.error += best_error;
+        }
+        return result;
+    }
+
+    void encode_bc1(block const & b, compression_quality quality, std::uint8_t * out)
+    {
+        color<3> colors[16];
+        block_colors<3>(b, 0, colors);
+
+        auto const [e0, e1] = fit_line<3>(colors, quality);
+        auto best = encode_bc1_endpoints(colors, e0, e1);
+
+        if (quality == compression_quality::high)
+            for (int iteration = 0; iteration < 2; ++iteration)
+            {
+                float weights[16];
+                for (int i = 0; i < 16; ++i)
+                    weights[i] = bc1_weights[(best.indices >> (2 * i)) & 3];
+
+                auto r0 = unpack_565(best.c0), r1 = unpack_565(best.c1);
+                refine_endpoints<3>(colors, weights, r0, r1);
+
+                auto const candidate = encode_bc1_endpoints(colors, r0, r1);
+                if (candidate.error >= best.error)
+                    break;
+                best = candidate;
+            }
+
+        bit_writer writer{out};
+        writer.write(best.c0, 16);
+        writer.write(best.c1, 16);
+        writer.write(best.indices, 32);
+    }
+
+    // BC4: two 8-bit endpoints and 3-bit indices, used for single channels
+
+    struct bc4_encoding
+    {
+        std::uint8_t e0, e1;
+        std::uint64_t indices;
+        float error;
+    };
+
+    bc4_encoding encode_bc4_endpoints(float const * values, std::uint8_t e0, std::uint8_t e1)
+    {
+        // With e0 > e1 there are six values in between, otherwise four plus exact 0 and 255
+        float palette[8] = {float(e0), float(e1)};
+        if (e0 > e1)
+            for (int i = 1; i <= 6; ++i)
+                palette[i + 1] = ((7 - i) * e0 + i * e1) / 7.f;
+        else
+        {
+            for (int i = 1; i <= 4; ++i)
+                palette[i + 1] = ((5 - i) * e0 + i * e1) / 5.f;
+            palette[6] = 0.f;
+            palette[7] = 255.f;
+        }
+
+        bc4_encoding result{e0, e1, 0, 0.f};
+        for (int i = 0; i < 16; ++i)
+        {
+            int best = 0;
+            float best_error = (values[i] - palette[0]) * (values[i] - palette[0]);
+            for (int j = 1; j < 8; ++j)
+                if (float const error = (values[i] - palette[j]) * (values[i] - palette[j]); error < best_error)
+                {
+                    best = j;
+                    best_error = error;
+                }
+            result.indices |= std::uint64_t(best) << (3 * i);
+            result.error += best_error;
+        }
+        return result;
+    }
+
+    std::uint8_t round_byte(float v)
+    {
+        return static_cast<std::uint8_t>(std::lround(std::clamp(v, 0.f, 255.f)));
+    }
+
+    void encode_bc4(block const & b, int channel, compression_quality quality, std::uint8_t * out)
+    {
+        float values[16];
+        for (int i = 0; i < 16; ++i)
+            values[i] = b.pixels[i][channel];
+
+        float const lo = *std::min_element(values, values + 16);
+        float const hi = *std::max_element(values, values + 16);
+
+        auto best = encode_bc4_endpoints(values, round_byte(hi), round_byte(lo));
+
+        if (quality == compression_quality::high)
+        {
+            // Blocks that also hold the extremes may do better with exact 0 and 255
+            float inner_lo = 255.f, inner_hi = 0.f;
+            for (float v : values)
+                if (v > 0.f && v < 255.f)
+                {
+                    inner_lo = std::min(inner_lo, v);
+                    inner_hi = std::max(inner_hi, v);
+                }
+            if (inner_lo <= inner_hi)
+                if (auto const candidate = encode_bc4_endpoints(values, round_byte(inner_lo), round_byte(inner_hi)); candidate.error < best.error)
+                    best = candidate;
+
+            if (best.e0 > best.e1)
+            {
+                float weights[16];
+                for (int i = 0; i < 16; ++i)
+                {
+                    auto const index = (best.indices >> (3 * i)) & 7;
+                    weights[i] = (index < 2) ? float(index) : (index - 1) / 7.f;
+                }
+
+                color<1> colors[16];
+                for (int i = 0; i < 16; ++i)
+                    colors[i][0] = values[i];
+
+                color<1> r0{float(best.e0)}, r1{float(best.e1)};
+                refine_endpoints<1>(colors, weights, r0, r1);
+
+                auto const e0 = round_byte(r0[0]), e1 = round_byte(r1[0]);
+                if (e0 > e1)
+                    if (auto const candidate = encode_bc4_endpoints(values, e0, e1); candidate.error < best.error)
+                        best = candidate;
+            }
+        }
+
+        out[0] = best.e0;
+        out[1] = best.e1;
+        for (int i = 0; i < 6; ++i)
+            out[2 + i] = static_cast<std::uint8_t>(best.indices >> (8 * i));
+    }
+
+    // BC7 mode 6: one RGBA subset, 7-bit endpoints with a p-bit each as the shared lowest
+    // bit, and 4-bit indices
+
+    constexpr int bc7_weights[16] = {0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64};
+
+    struct bc7_endpoint
+    {
+        int value[4];
+        int pbit;
+
+        int decoded(int c) const
+        {
+            return (value[c] << 1) | pbit;
+        }
+    };
+
+    bc7_endpoint quantize_bc7(color<4> const & c, int pbit)
+    {
+        bc7_endpoint result{{}, pbit};
+        for (int k = 0; k < 4; ++k)
+            result.value[k] = std::clamp<int>(std::lround((c[k] - pbit) / 2.f), 0, 127);
+        return result;
+    }
+
+    float quantization_error(color<4> const & c, bc7_endpoint const & e)
+    {
+        float result = 0.f;
+        for (int k = 0; k < 4; ++k)
+            result += (c[k] - e.decoded(k)) * (c[k] - e.decoded(k));
+        return result;
+    }
+
+    struct bc7_encoding
+    {
+        bc7_endpoint e0, e1;
+        std::uint8_t indices[16];
+        float error;
+    };
+
+    bc7_encoding encode_bc7_endpoints(color<4> const * colors, bc7_endpoint const & e0, bc7_endpoint const & e1)
+    {
+        color<4> palette[16];
+        for (int j = 0; j < 16; ++j)
+            for (int k = 0; k < 4; ++k)
+                palette[j][k] = float(((64 - bc7_weights[j]) * e0.decoded(k) + bc7_weights[j] * e1.decoded(k) + 32) >> 6);
+
+        bc7_encoding result{e0, e1, {}, 0.f};
+        for (int i = 0; i < 16; ++i)
+        {
+            int best = 0;
+            float best_error = distance2<4>(colors[i], palette[0]);
+            for (int j = 1; j < 16; ++j)
+                if (float const error = distance2<4>(colors[i], palette[j]); error < best_error)
+                {
+                    best = j;
+                    best_error = error;
+                }
+            result.indices[i] = best;
+            result.error += best_error;
+        }
+        return result;
+    }
+
+    bc7_encoding encode_bc7_line(color<4> const * colors, color<4> const & e0, color<4> const & e1, compression_quality quality)
+    {
+        // Each endpoint takes the p-bit that quantizes it best, or, at high quality, the
+        // combination that encodes the block best
+        if (quality != compression_quality::high)
+        {
+            auto best_quantization = [](color<4> const & c)
+            {
+                auto const q0 = quantize_bc7(c, 0), q1 = quantize_bc7(c, 1);
+                return (quantization_error(c, q1) < quantization_error(c, q0)) ? q1 : q0;
+            };
+            return encode_bc7_endpoints(colors, best_quantization(e0), best_quantization(e1));
+        }
+
+        bc7_encoding best = encode_bc7_endpoints(colors, quantize_bc7(e0, 0), quantize_bc7(e1, 0));
+        for (int pbits = 1; pbits < 4; ++pbits)
+            if (auto const candidate = encode_bc7_endpoints(colors, quantize_bc7(e0, pbits & 1), quantize_bc7(e1, pbits >> 1)); candidate.error < best.error)
+                best = candidate;
+        return best;
+    }
+
+    void encode_bc7(block const & b, compression_quality quality, std::uint8_t * out)
+    {
+        color<4> colors[16];
+        block_colors<4>(b, 0, colors);
+
+        auto const [e0, e1] = fit_line<4>(colors, quality);
+        auto best = encode_bc7_line(colors, e0, e1, quality);
+
+        if (quality == compression_quality::high)
+            for (int iteration = 0; iteration < 2; ++iteration)
+            {
+                float weights[16];
+                for (int i = 0; i < 16; ++i)
+                    weights[i] = bc7_weights[best.indices[i]] / 64.f;
+
+                color<4> r0, r1;
+                for (int k = 0; k < 4; ++k)
+                {
+                    r0[k] = float(best.e0.decoded(k));
+                    r1[k] = float(best.e1.decoded(k));
+                }
+                refine_endpoints<4>(colors, weights, r0, r1);
+
+                auto const candidate = encode_bc7_line(colors, r0, r1, quality);
+                if (candidate.error >= best.error)
+                    break;
+                best = candidate;
+            }
+
+        // The first index is stored without its top bit, which therefore has to be zero
+        if (best.indices[0] >= 8)
+        {
+            std::swap(best.e0, best.e1);
+            for (auto & index : best.indices)
+                index = 15 - index;
+        }
+
+        bit_writer writer{out};
+        writer.write(1 << 6, 7);
+        for (int k = 0; k < 4; ++k)
+        {
+            writer.write(best.e0.value[k], 7);
+            writer.write(best.e1.value[k], 7);
+        }
+        writer.write(best.e0.pbit, 1);
+        writer.write(best.e1.pbit, 1);
+        writer.write(best.indices[0], 3);
+        for (int i = 1; i < 16; ++i)
+            writer.write(best.indices[i], 4);
+    }
+
+}
+
+std::size_t block_bytes(block_format format)
+{
+    switch (format)
+    {
+    case block_format::bc1:
+    case block_format::bc4:
+        return 8;
+    case block_format::bc3:
+    case block_format::bc5:
+    case block_format::bc7:
+        return 16;
+    }
+    throw std::runtime_error("Unknown block format " + std::to_string(static_cast<int>(format)));
+}
+
+std::size_t compressed_size(block_format format, std::uint32_t width, std::uint32_t height)
+{
+    return std::size_t((width + 3) / 4) * ((height + 3) / 4) * block_bytes(format);
+}
+
+std::vector<std::uint8_t> compress_blocks(std::uint8_t const * pixels, std::uint32_t width, std::uint32_t height,
+    block_format format, compression_quality quality, std::size_t thread_count)
+{
+    if (thread_count == 0)
+        thread_count = std::max(1u, std::thread::hardware_concurrency());
+
+    std::uint32_t const blocks_x = (width + 3) / 4;
+    std::uint32_t const blocks_y = (height + 3) / 4;
+    std::size_t const size = block_bytes(format);
+
+    std::vector<std::uint8_t> result(compressed_size(format, width, height), 0);
+
+    std::size_t const range_count = std::max<std::size_t>(1, std::min<std::size_t>(thread_count, std::size_t(blocks_x) * blocks_y / min_blocks_per_thread));
+
+    parallel_for(range_count, [&](std::size_t i)
+    {
+        for (std::uint32_t by = blocks_y * i / range_count; by < blocks_y * (i + 1) / range_count; ++by)
+            for (std::uint32_t bx = 0; bx < blocks_x; ++bx)
+            {
+                auto const b = load_block(pixels, width, height, bx, by);
+                auto out = result.data() + (std::size_t(by) * blocks_x + bx) * size;
+
+                switch (format)
+                {
+                case block_format::bc1:
+                    encode_bc1(b, quality, out);
+                    break;
+                case block_format::bc3:
+                    encode_bc4(b, 3, quality, out);
+                    encode_bc1(b, quality, out + 8);
+                    break;
+                case block_format::bc4:
+                    encode_bc4(b, 0, quality, out);
+                    break;
+                case block_format::bc5:
+                    encode_bc4(b, 0, quality, out);
+                    encode_bc4(b, 1, quality, out + 8);
+                    break;
+                case block_format::bc7:
+                    encode_bc7(b, quality, out);
+                    break;
+                }
+            }
+    });
+
+    return result;
+}
@@ -26,7 +26,7 @@
 #include <glm/gtx/string_cast.hpp>
 
 #include "msdf_loader.hpp"
-#include "stb_image.h"
+#include "texture_cache_gl.hpp"
 
 std::string to_string(std::string_view str)
 {
@@ -154,18 +154,18 @@ int main() try
     GLuint texture;
     int texture_width, texture_height;
     {
-        int channels;
-        auto data = stbi_load(font.texture_path.c_str(), &texture_width, &texture_height, &channels, 4);
-        assert(data);
+        // Distances are linear data, and the Kaiser filter's ringing would move glyph edges.
+        // Kept uncompressed: block compression fits one line through the colors of a block,
+        // which couples the three distance channels and moves the edges they define
+        auto const atlas = load_texture_cached(font.texture_path, {mip_filter::box, false});
+        texture_width = atlas.levels[0].width;
+        texture_height = atlas.levels[0].height;
 
         glGenTextures(1, &texture);
         glBindTexture(GL_TEXTURE_2D, texture);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, texture_width, texture_height, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
-
-        stbi_image_free(data);
+        upload_texture(atlas);
     }
 
     auto last_frame_start = std::chrono::high_resolution_clock::now();
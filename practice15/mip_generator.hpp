@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+enum class mip_filter
+{
+    // Averages the source pixels each output pixel covers, like most glGenerateMipmap implementations
+    box,
+    // Kaiser-windowed sinc; keeps distant levels sharper at the cost of slight ringing
+    kaiser,
+};
+
+struct mip_options
+{
+    mip_filter filter = mip_filter::kaiser;
+    // Whether the color channels are sRGB-encoded, so they are filtered in linear space;
+    // false for data such as normal maps or distance fields. Alpha is always linear
+    bool srgb = true;
+    // Zero means one per core; load_texture_cached compresses the levels with as many.
+    // Not part of the result, so it doesn't affect caching
+    std::size_t thread_count = 0;
+};
+
+// Builds mip levels 1 and up of an RGBA8 image, down to 1x1; level i is max(1, size >> i) in
+// each direction, like glGenerateMipmap. Each level is filtered from the previous one, kept
+// at float precision, and rows are processed in parallel (with SSE2 where available).
+std::vector<std::vector<std::uint8_t>> generate_mips(std::uint8_t const * pixels, std::uint32_t width, std::uint32_t height, mip_options const & options = {});
@@ -1,22 +1,31 @@
 #include "msdf_loader.hpp"
+#include "mapped_file.hpp"
 
 #include <rapidjson/document.h>
-#include <rapidjson/istreamwrapper.h>
 
-#include <fstream>
+#include <vector>
+#include <cstring>
+#include <algorithm>
 #include <stdexcept>
 #include <filesystem>
 
 msdf_font load_msdf_font(std::string const & path)
 {
-    rapidjson::Document document;
-
+    // Read in one go and parsed in situ: strings point into the text instead of being
+    // allocated, and the DOM comes from a pool sized after the text
+    std::vector<char> text;
     {
-        std::ifstream input(path, std::ios::binary);
-        rapidjson::IStreamWrapper stream(input);
-        document.ParseStream(stream);
+        mapped_file file(path);
+        text.resize(file.size() + 1, '\0');
+        std::memcpy(text.data(), file.data(), file.size());
     }
 
+    rapidjson::MemoryPoolAllocator<> allocator(std::max<std::size_t>(text.size(), 64 * 1024));
+    rapidjson::Document document(&allocator);
+    document.ParseInsitu(text.data());
+    if (document.HasParseError())
+        throw std::runtime_error("Failed to parse " + path);
+
     msdf_font result;
 
     {
@@ -31,6 +40,7 @@ msdf_font load_msdf_font(std::string const & path)
     }
 
     auto chars = document["chars"].GetArray();
+    result.glyphs.reserve(chars.Size());
 
     for (auto const & charInfo : chars)
     {
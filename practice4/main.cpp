@@ -173,7 +173,7 @@ int main() try {
 	GLuint projULocation = glGetUniformLocation(program, "proj");
 
 	std::string project_root = PROJECT_ROOT;
-	obj_data bunny = parse_obj(project_root + "/bunny.obj");
+	obj_data bunny = parse_obj_mapped(project_root + "/bunny.obj");
 
 	auto lastFrameStart = std::chrono::high_resolution_clock::now();
 
@@ -0,0 +1,129 @@
+#include "mapped_file.hpp"
+
+#include <stdexcept>
+#include <utility>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+mapped_file::mapped_file(std::filesystem::path const & path)
+{
+#ifdef _WIN32
+    HANDLE file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        throw std::runtime_error("Failed to open " + path.string());
+    file_ = file;
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size))
+    {
+        reset();
+        throw std::runtime_error("Failed to get size of " + path.string());
+    }
+
+    size_ = size.QuadPart;
+    if (size_ == 0)
+        return;
+
+    mapping_ = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!mapping_)
+    {
+        reset();
+        throw std::runtime_error("Failed to map " + path.string());
+    }
+
+    data_ = static_cast<char const *>(MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0));
+    if (!data_)
+    {
+        reset();
+        throw std::runtime_error("Failed to map " + path.string());
+    }
+#else
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        throw std::runtime_error("Failed to open " + path.string());
+
+    struct stat st;
+    if (::fstat(fd, &st) != 0)
+    {
+        ::close(fd);
+        throw std::runtime_error("Failed to get size of " + path.string());
+    }
+
+    size_ = st.st_size;
+    if (size_ == 0)
+    {
+        ::close(fd);
+        return;
+    }
+
+    void * data = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+
+    if (data == MAP_FAILED)
+    {
+        size_ = 0;
+        throw std::runtime_error("Failed to map " + path.string());
+    }
+
+    ::madvise(data, size_, MADV_SEQUENTIAL);
+
+    data_ = static_cast<char const *>(data);
+#endif
+}
+
+mapped_file::~mapped_file()
+{
+    reset();
+}
+
+mapped_file::mapped_file(mapped_file && other) noexcept
+    : data_(std::exchange(other.data_, nullptr))
+    , size_(std::exchange(other.size_, 0))
+#ifdef _WIN32
+    , file_(std::exchange(other.file_, nullptr))
+    , mapping_(std::exchange(other.mapping_, nullptr))
+#endif
+{}
+
+mapped_file & mapped_file::operator = (mapped_file && other) noexcept
+{
+    if (this != &other)
+    {
+        reset();
+        data_ = std::exchange(other.data_, nullptr);
+        size_ = std::exchange(other.size_, 0);
+#ifdef _WIN32
+        file_ = std::exchange(other.file_, nullptr);
+        mapping_ = std::exchange(other.mapping_, nullptr);
+#endif
+    }
+    return *this;
+}
+
+void mapped_file::reset()
+{
+#ifdef _WIN32
+    if (data_)
+        UnmapViewOfFile(data_);
+    if (mapping_)
+        CloseHandle(mapping_);
+    if (file_)
+        CloseHandle(file_);
+    file_ = nullptr;
+    mapping_ = nullptr;
+#else
+    if (data_)
+        ::munmap(const_cast<char *>(data_), size_);
+#endif
+    data_ = nullptr;
+    size_ = 0;
+}
@@ -18,3 +18,7 @@ struct obj_data
 };
 
 obj_data parse_obj(std::filesystem::path const & path);
+
+// Same result as parse_obj, but memory-maps the file and tokenizes it in place
+// without per-line strings, streams or locale lookups
+obj_data parse_obj_mapped(std::filesystem::path const & path);
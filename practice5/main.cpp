@@ -154,7 +154,7 @@ int main() try
 
     std::string project_root = PROJECT_ROOT;
     std::string cow_texture_path = project_root + "/cow.png";
-    obj_data cow = parse_obj(project_root + "/cow.obj");
+    obj_data cow = parse_obj_mapped(project_root + "/cow.obj");
 
     auto last_frame_start = std::chrono::high_resolution_clock::now();
 
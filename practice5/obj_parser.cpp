@@ -1,9 +1,13 @@
 #include "obj_parser.hpp"
+#include "mapped_file.hpp"
 
 #include <string>
+#include <string_view>
 #include <sstream>
 #include <fstream>
 #include <stdexcept>
+#include <charconv>
+#include <cstring>
 #include <map>
 
 namespace
@@ -17,30 +21,160 @@ namespace
         return os.str();
     }
 
+
+    // Shared by both parse modes: resolves face indices, deduplicates vertices
+    // and triangulates polygons
+    struct obj_builder
+    {
+        std::vector<std::array<float, 3>> positions;
+        std::vector<std::array<float, 3>> normals;
+        std::vector<std::array<float, 2>> texcoords;
+
+        std::map<std::array<std::uint32_t, 3>, std::uint32_t> index_map;
+
+        obj_data result;
+
+        std::size_t line_count = 0;
+
+        std::vector<std::uint32_t> face;
+
+        template <typename ... Args>
+        [[noreturn]] void fail(Args const & ... args) const
+        {
+            throw std::runtime_error(to_string("Error parsing OBJ data, line ", line_count, ": ", args...));
+        }
+
+        void add_face_vertex(std::array<std::uint32_t, 3> index)
+        {
+            --index[0];
+            --index[1];
+            --index[2];
+
+            if (index[0] >= positions.size())
+                fail("bad position index (", index[0], ")");
+
+            if (index[1] != -1 && index[1] >= texcoords.size())
+                fail("bad texcoord index (", index[1], ")");
+
+            if (index[2] != -1 && index[2] >= normals.size())
+                fail("bad normal index (", index[2], ")");
+
+            auto it = index_map.find(index);
+            if (it == index_map.end())
+            {
+                it = index_map.insert({index, result.vertices.size()}).first;
+
+                auto & v = result.vertices.emplace_back();
+
+                v.position = positions[index[0]];
+
+                if (index[1] != -1)
+                    v.texcoord = texcoords[index[1]];
+                else
+                    v.texcoord = {0.f, 0.f};
+
+                if (index[2] != -1)
+                    v.normal = normals[index[2]];
+                else
+                    v.normal = {0.f, 0.f, 0.f};
+            }
+
+            face.push_back(it->second);
+        }
+
+        void end_face()
+        {
+            for (std::size_t i = 1; i + 1 < face.size(); ++i)
+            {
+                result.indices.push_back(face[0]);
+                result.indices.push_back(face[i]);
+                result.indices.push_back(face[i + 1]);
+            }
+
+            face.clear();
+        }
+    };
+
+    // Whitespace as understood by std::isspace in the "C" locale, minus the line break
+    bool is_blank(char c)
+    {
+        return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+    }
+
+    bool is_space(char c)
+    {
+        return c == '\n' || is_blank(c);
+    }
+
+    // Pointer-based tokenizer over a single line of a memory-mapped file
+    struct line_tokenizer
+    {
+        char const * p;
+        char const * end;
+
+        bool at_end() const
+        {
+            return p == end;
+        }
+
+        void skip_blank()
+        {
+            while (p != end && is_blank(*p))
+                ++p;
+        }
+
+        std::string_view token()
+        {
+            skip_blank();
+            char const * begin = p;
+            while (p != end && !is_blank(*p))
+                ++p;
+            return {begin, static_cast<std::size_t>(p - begin)};
+        }
+
+        // Mirrors `stream >> value`: skips leading whitespace and accepts an explicit '+'.
+        // Indices are unsigned, so unlike streams a leading '-' is rejected here instead
+        // of wrapping around to a huge index that fails the range check later.
+        template <typename T>
+        bool number(T & value)
+        {
+            skip_blank();
+            if (p != end && *p == '+' && p + 1 != end && *(p + 1) != '-')
+                ++p;
+            auto [ptr, ec] = std::from_chars(p, end, value);
+            if (ec != std::errc{})
+                return false;
+            p = ptr;
+            return true;
+        }
+
+        template <std::size_t N>
+        void numbers(std::array<float, N> & values)
+        {
+            for (auto & value : values)
+                if (!number(value))
+                    return;
+        }
+
+        bool next_is_separator() const
+        {
+            return p == end || is_blank(*p);
+        }
+    };
+
 }
 
 obj_data parse_obj(std::filesystem::path const & path)
 {
     std::ifstream is(path);
 
-    std::vector<std::array<float, 3>> positions;
-    std::vector<std::array<float, 3>> normals;
-    std::vector<std::array<float, 2>> texcoords;
-
-    std::map<std::array<std::uint32_t, 3>, std::uint32_t> index_map;
-
-    obj_data result;
+    obj_builder builder;
 
     std::string line;
-    std::size_t line_count = 0;
-
-    auto fail = [&](auto const & ... args){
-        throw std::runtime_error(to_string("Error parsing OBJ data, line ", line_count, ": ", args...));
-    };
 
     while (std::getline(is >> std::ws, line))
     {
-        ++line_count;
+        ++builder.line_count;
 
         if (line.empty()) continue;
 
@@ -53,51 +187,50 @@ obj_data parse_obj(std::filesystem::path const & path)
 
         if (tag == "v")
         {
-            auto & p = positions.emplace_back();
+            auto & p = builder.positions.emplace_back();
             ls >> p[0] >> p[1] >> p[2];
         }
         else if (tag == "vn")
         {
-            auto & n = normals.emplace_back();
+            auto & n = builder.normals.emplace_back();
             ls >> n[0] >> n[1] >> n[2];
         }
         else if (tag == "vt")
         {
-            auto & t = texcoords.emplace_back();
+            auto & t = builder.texcoords.emplace_back();
             ls >> t[0] >> t[1];
         }
         else if (tag == "f")
         {
-            std::vector<std::uint32_t> vertices;
-
             while (ls)
             {
                 std::array<std::uint32_t, 3> index{0, 0, 0};
 
+                if ((ls >> std::ws).eof()) break;
+
                 ls >> index[0];
-                if (ls.eof()) break;
                 if (!ls)
-                    fail("expected position index");
+                    builder.fail("expected position index");
 
                 if (!std::isspace(ls.peek()) && !ls.eof())
                 {
                     if (ls.get() != '/')
-                        fail("expected '/'");
+                        builder.fail("expected '/'");
 
                     if (ls.peek() != '/')
                     {
                         ls >> index[1];
                         if (!ls)
-                            fail("expected texcoord index");
+                            builder.fail("expected texcoord index");
 
                         if (!std::isspace(ls.peek()) && !ls.eof())
                         {
                             if (ls.get() != '/')
-                                fail("expected '/'");
+                                builder.fail("expected '/'");
 
                             ls >> index[2];
                             if (!ls)
-                                fail("expected normal index");
+                                builder.fail("expected normal index");
                         }
                     }
                     else
@@ -106,54 +239,101 @@ obj_data parse_obj(std::filesystem::path const & path)
 
                         ls >> index[2];
                         if (!ls)
-                            fail("expected normal index");
+                            builder.fail("expected normal index");
                     }
                 }
 
-                --index[0];
-                --index[1];
-                --index[2];
+                builder.add_face_vertex(index);
+            }
+
+            builder.end_face();
+        }
+    }
+
+    return std::move(builder.result);
+}
+
+obj_data parse_obj_mapped(std::filesystem::path const & path)
+{
+    mapped_file file(path);
+
+    obj_builder builder;
 
-                if (index[0] >= positions.size())
-                    fail("bad position index (", index[0], ")");
+    char const * p = file.begin();
+    char const * const end = file.end();
 
-                if (index[1] != -1 && index[1] >= texcoords.size())
-                    fail("bad texcoord index (", index[1], ")");
+    while (true)
+    {
+        while (p != end && is_space(*p))
+            ++p;
 
-                if (index[2] != -1 && index[2] >= normals.size())
-                    fail("bad normal index (", index[2], ")");
+        if (p == end) break;
 
-                auto it = index_map.find(index);
-                if (it == index_map.end())
+        ++builder.line_count;
+
+        char const * line_end = static_cast<char const *>(std::memchr(p, '\n', end - p));
+        if (!line_end)
+            line_end = end;
+
+        line_tokenizer ls{p, line_end};
+        p = line_end;
+
+        if (*ls.p == '#') continue;
+
+        auto tag = ls.token();
+
+        if (tag == "v")
+            ls.numbers(builder.positions.emplace_back());
+        else if (tag == "vn")
+            ls.numbers(builder.normals.emplace_back());
+        else if (tag == "vt")
+            ls.numbers(builder.texcoords.emplace_back());
+        else if (tag == "f")
+        {
+            while (true)
+            {
+                std::array<std::uint32_t, 3> index{0, 0, 0};
+
+                ls.skip_blank();
+                if (ls.at_end()) break;
+
+                if (!ls.number(index[0]))
+                    builder.fail("expected position index");
+
+                if (!ls.next_is_separator())
                 {
-                    it = index_map.insert({index, result.vertices.size()}).first;
+                    if (*ls.p++ != '/')
+                        builder.fail("expected '/'");
 
-                    auto & v = result.vertices.emplace_back();
+                    if (ls.at_end() || *ls.p != '/')
+                    {
+                        if (!ls.number(index[1]))
+                            builder.fail("expected texcoord index");
 
-                    v.position = positions[index[0]];
+                        if (!ls.next_is_separator())
+                        {
+                            if (*ls.p++ != '/')
+                                builder.fail("expected '/'");
 
-                    if (index[1] != -1)
-                        v.texcoord = texcoords[index[1]];
+                            if (!ls.number(index[2]))
+                                builder.fail("expected normal index");
+                        }
+                    }
                     else
-                        v.texcoord = {0.f, 0.f};
+                    {
+                        ++ls.p;
 
-                    if (index[2] != -1)
-                        v.normal = normals[index[2]];
-                    else
-                        v.normal = {0.f, 0.f, 0.f};
+                        if (!ls.number(index[2]))
+                            builder.fail("expected normal index");
+                    }
                 }
 
-                vertices.push_back(it->second);
+                builder.add_face_vertex(index);
             }
 
-            for (std::size_t i = 1; i + 1 < vertices.size(); ++i)
-            {
-                result.indices.push_back(vertices[0]);
-                result.indices.push_back(vertices[i]);
-                result.indices.push_back(vertices[i + 1]);
-            }
+            builder.end_face();
         }
     }
 
-    return result;
+    return std::move(builder.result);
 }
@@ -26,7 +26,7 @@
 #include <glm/ext/scalar_constants.hpp>
 #include <glm/gtx/string_cast.hpp>
 
-#include "obj_parser.hpp"
+#include "obj_cache.hpp"
 
 std::string to_string(std::string_view str)
 {
@@ -218,7 +218,7 @@ int main() try
 
     std::string project_root = PROJECT_ROOT;
     std::string dragon_model_path = project_root + "/dragon.obj";
-    obj_data dragon = parse_obj(dragon_model_path);
+    auto dragon = load_obj_cached(dragon_model_path);
 
     GLuint dragon_vao, dragon_vbo, dragon_ebo;
     glGenVertexArrays(1, &dragon_vao);
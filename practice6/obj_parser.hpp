@@ -1,7 +1,47 @@
 #pragma once
 
+#include <array>
+#include <string>
 #include <vector>
+#include <limits>
 #include <filesystem>
+#include <functional>
+#include <span>
+
+// A newmtl entry of an .mtl file; properties the file doesn't define keep these defaults
+struct obj_material
+{
+    std::string name;
+
+    std::array<float, 3> ambient{0.f, 0.f, 0.f};
+    std::array<float, 3> diffuse{1.f, 1.f, 1.f};
+    std::array<float, 3> specular{0.f, 0.f, 0.f};
+    float shininess = 0.f;
+    float opacity = 1.f;
+
+    // map_Kd and map_Bump / bump / norm, as written: relative to the .mtl file
+    std::string diffuse_texture;
+    std::string normal_texture;
+};
+
+// Material id of faces that come before any usemtl
+constexpr std::uint32_t obj_no_material = std::numeric_limits<std::uint32_t>::max();
+
+// Consecutive triangles with the same object (o), group (g) and material (usemtl)
+struct obj_submesh
+{
+    std::string object;
+    std::string group;
+    // Index into the materials or obj_no_material
+    std::uint32_t material;
+
+    std::uint32_t first_index;
+    std::uint32_t index_count;
+
+    // Bounds of the positions the triangles use
+    std::array<float, 3> min;
+    std::array<float, 3> max;
+};
 
 struct obj_data
 {
@@ -14,6 +54,59 @@ struct obj_data
 
     std::vector<vertex> vertices;
     std::vector<std::uint32_t> indices;
+
+    // Optional per-vertex tangents (xyz, w = bitangent sign); the parsers leave them empty
+    std::vector<std::array<float, 4>> tangents;
+
+    // Materials in order of first usemtl, with the properties found in the mtllib files
+    std::vector<obj_material> materials;
+
+    // Sorted by material, faces without one last; the indices are ordered the same way,
+    // so each material's triangles form one contiguous range
+    std::vector<obj_submesh> submeshes;
 };
 
 obj_data parse_obj(std::filesystem::path const & path);
+
+// Same result as parse_obj, but memory-maps the file and tokenizes it in place
+// without per-line strings, streams or locale lookups
+obj_data parse_obj_mapped(std::filesystem::path const & path);
+
+// Same result as parse_obj, but splits the file into line-aligned chunks that are
+// parsed on separate threads; thread_count = 0 uses all available cores
+obj_data parse_obj_parallel(std::filesystem::path const & path, std::size_t thread_count = 0);
+
+// A piece of the parsed mesh: vertices created since the previous batch (their ids
+// start at first_vertex) and the triangles completed since then. Indices refer to
+// global vertex ids, so they may point into earlier batches.
+struct obj_batch
+{
+    std::uint32_t first_vertex;
+    std::span<obj_data::vertex const> vertices;
+    std::span<std::uint32_t const> indices;
+    // Either empty or one per vertex of the batch
+    std::span<std::array<float, 4> const> tangents = {};
+    // All triangles of a batch belong to one submesh, and so to one material
+    std::uint32_t material = obj_no_material;
+};
+
+using obj_batch_consumer = std::function<void(obj_batch const &)>;
+
+struct obj_stream_stats
+{
+    std::size_t vertex_count = 0;
+    std::size_t index_count = 0;
+
+    std::vector<obj_material> materials;
+    // In file order, with first_index counting the indices of all batches before
+    std::vector<obj_submesh> submeshes;
+};
+
+// Parses the file like parse_obj_mapped, but never holds more than about batch_size
+// vertices and batch_size triangles of output: they are passed to the consumer and
+// dropped. Batches come in file order; concatenating the vertices of all batches, and
+// the indices of all batches stably sorted by material, gives the same data as parse_obj.
+// Only the output is bounded: the v/vn/vt values and the index triple -> vertex id map
+// are kept for the whole file, since a later face may reuse any earlier vertex, so they
+// grow with the number of attribute lines and unique vertices.
+obj_stream_stats parse_obj_streaming(std::filesystem::path const & path, std::size_t batch_size, obj_batch_consumer const & consumer);
@@ -29,7 +29,7 @@
 #include <glm/ext/scalar_constants.hpp>
 #include <glm/gtx/string_cast.hpp>
 
-#include "obj_parser.hpp"
+#include "obj_layout_gl.hpp"
 
 std::string to_string(std::string_view str) {
     return std::string(str.begin(), str.end());
@@ -171,7 +171,12 @@ int main() try {
 
     std::string project_root = PROJECT_ROOT;
     std::string suzanne_model_path = project_root + "/suzanne.obj";
-    obj_data suzanne = parse_obj(suzanne_model_path);
+    // The shaders only read positions and normals, so texcoords are never parsed or uploaded
+    using suzanne_layout = obj_layout<
+        obj_element<obj_attribute::position>,
+        obj_element<obj_attribute::normal, obj_encoding::snorm16>
+    >;
+    auto suzanne = parse_obj<suzanne_layout>(suzanne_model_path);
 
     GLuint suzanne_vao, suzanne_vbo, suzanne_ebo;
     glGenVertexArrays(1, &suzanne_vao);
@@ -187,10 +192,7 @@ int main() try {
     glBufferData(GL_ELEMENT_ARRAY_BUFFER, suzanne.indices.size() * sizeof(suzanne.indices[0]), suzanne.indices.data(),
                  GL_STATIC_DRAW);
 
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(obj_data::vertex), (void *) (0));
-    glEnableVertexAttribArray(1);
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(obj_data::vertex), (void *) (12));
+    setup_vertex_attributes<suzanne_layout>();
 
     auto last_frame_start = std::chrono::high_resolution_clock::now();
 
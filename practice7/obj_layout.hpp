@@ -0,0 +1,199 @@
+#pragma once
+
+#include "obj_parser.hpp"
+#include "obj_builder.hpp"
+#include "mapped_file.hpp"
+
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+
+enum class obj_attribute
+{
+    position,
+    normal,
+    texcoord,
+};
+
+enum class obj_encoding
+{
+    // GL_FLOAT
+    float32,
+    // GL_SHORT / GL_BYTE, normalized to [-1, 1]; for normals
+    snorm16,
+    snorm8,
+    // GL_UNSIGNED_SHORT, normalized to [0, 1]; for texcoords that don't wrap, others are clamped
+    unorm16,
+};
+
+// One attribute of a vertex layout and how it is stored
+template <obj_attribute Attribute, obj_encoding Encoding = obj_encoding::float32>
+struct obj_element
+{
+    // Normalized encodings would clamp positions to [-1, 1]
+    static_assert(Attribute != obj_attribute::position || Encoding == obj_encoding::float32,
+        "positions must be stored as float32");
+
+    static constexpr obj_attribute attribute = Attribute;
+    static constexpr obj_encoding encoding = Encoding;
+
+    static constexpr std::size_t components = (Attribute == obj_attribute::texcoord) ? 2 : 3;
+    static constexpr std::size_t component_size =
+        (Encoding == obj_encoding::float32) ? 4 :
+        (Encoding == obj_encoding::snorm8) ? 1 : 2;
+
+    // Padded so that every attribute starts at a multiple of 4 bytes
+    static constexpr std::size_t size = (components * component_size + 3) / 4 * 4;
+
+    static constexpr std::uint32_t gl_type =
+        (Encoding == obj_encoding::float32) ? 0x1406 :  // GL_FLOAT
+        (Encoding == obj_encoding::snorm16) ? 0x1402 :  // GL_SHORT
+        (Encoding == obj_encoding::snorm8) ? 0x1400 :   // GL_BYTE
+        0x1403;                                         // GL_UNSIGNED_SHORT
+    static constexpr bool normalized = (Encoding != obj_encoding::float32);
+
+    template <std::size_t N>
+    static void write(std::byte * out, std::array<float, N> const & values)
+    {
+        for (std::size_t k = 0; k < N; ++k)
+        {
+            if constexpr (Encoding == obj_encoding::float32)
+                std::memcpy(out + 4 * k, &values[k], 4);
+            else if constexpr (Encoding == obj_encoding::snorm16)
+            {
+                std::int16_t const v = static_cast<std::int16_t>(std::lround(std::clamp(values[k], -1.f, 1.f) * 32767.f));
+                std::memcpy(out + 2 * k, &v, 2);
+            }
+            else if constexpr (Encoding == obj_encoding::snorm8)
+            {
+                std::int8_t const v = static_cast<std::int8_t>(std::lround(std::clamp(values[k], -1.f, 1.f) * 127.f));
+                std::memcpy(out + k, &v, 1);
+            }
+            else
+            {
+                std::uint16_t const v = static_cast<std::uint16_t>(std::lround(std::clamp(values[k], 0.f, 1.f) * 65535.f));
+                std::memcpy(out + 2 * k, &v, 2);
+            }
+        }
+    }
+};
+
+// Everything glVertexAttribPointer needs for one attribute
+struct obj_layout_attribute
+{
+    std::uint32_t location;
+    std::int32_t size;
+    std::uint32_t type;
+    bool normalized;
+    std::size_t offset;
+};
+
+template <typename Layout>
+struct obj_mesh;
+
+// An interleaved vertex made of the given elements, in order; element i is bound to
+// attribute location i. Attributes that aren't listed are never parsed or stored.
+template <typename ... Elements>
+struct obj_layout
+{
+    static constexpr std::size_t element_count = sizeof...(Elements);
+
+    template <obj_attribute Attribute>
+    static constexpr std::size_t count = ((Elements::attribute == Attribute ? 1 : 0) + ...);
+
+    static_assert(count<obj_attribute::position> == 1, "a layout needs exactly one position");
+    static_assert(count<obj_attribute::normal> <= 1 && count<obj_attribute::texcoord> <= 1, "attributes may appear only once");
+
+    static constexpr std::size_t stride = (Elements::size + ...);
+
+    static constexpr std::array<std::size_t, element_count> offsets = []
+    {
+        std::array<std::size_t, element_count> offsets{};
+        std::size_t i = 0;
+        std::size_t offset = 0;
+        ((offsets[i++] = offset, offset += Elements::size), ...);
+        return offsets;
+    }();
+
+    static constexpr std::array<obj_layout_attribute, element_count> attributes = []
+    {
+        std::array<obj_layout_attribute, element_count> attributes{};
+        std::uint32_t i = 0;
+        ((attributes[i] = {i, static_cast<std::int32_t>(Elements::components), Elements::gl_type, Elements::normalized, offsets[i]}, ++i), ...);
+        return attributes;
+    }();
+
+    struct vertex
+    {
+        alignas(4) std::byte bytes[stride];
+    };
+
+    static_assert(sizeof(vertex) == stride);
+
+    // The interface obj_detail::basic_obj_builder expects
+    using mesh_type = obj_mesh<obj_layout>;
+    using vertex_type = vertex;
+
+    static constexpr bool has_normals = count<obj_attribute::normal> > 0;
+    static constexpr bool has_texcoords = count<obj_attribute::texcoord> > 0;
+
+    static void write(vertex & v, std::array<float, 3> const & position, std::array<float, 3> const * normal,
+        std::array<float, 2> const * texcoord)
+    {
+        std::size_t i = 0;
+        (write_element<Elements>(v.bytes + offsets[i++], position, normal, texcoord), ...);
+    }
+
+private:
+    template <typename Element>
+    static void write_element(std::byte * out, std::array<float, 3> const & position, std::array<float, 3> const * normal,
+        std::array<float, 2> const * texcoord)
+    {
+        if constexpr (Element::attribute == obj_attribute::position)
+            Element::write(out, position);
+        else if constexpr (Element::attribute == obj_attribute::normal)
+            Element::write(out, normal ? *normal : std::array<float, 3>{0.f, 0.f, 0.f});
+        else
+            Element::write(out, texcoord ? *texcoord : std::array<float, 2>{0.f, 0.f});
+    }
+};
+
+// Same as obj_data, with vertices in the given layout
+template <typename Layout>
+struct obj_mesh
+{
+    std::vector<typename Layout::vertex> vertices;
+    std::vector<std::uint32_t> indices;
+
+    std::vector<obj_material> materials;
+    std::vector<obj_submesh> submeshes;
+};
+
+// Parses the file like parse_obj_mapped, but builds the layout's vertices in place.
+// Attributes the layout doesn't use are skipped, and vertices that only differ in them
+// are merged, so e.g. a position-only layout gets one vertex per position.
+template <typename Layout>
+obj_mesh<Layout> parse_obj(std::filesystem::path const & path)
+{
+    mapped_file file(path);
+
+    obj_detail::basic_obj_builder<Layout> builder;
+    obj_detail::scan_obj(file.begin(), file.end(), builder);
+
+    return builder.finish(path);
+}
+
+// Common layouts
+using obj_position_layout = obj_layout<obj_element<obj_attribute::position>>;
+using obj_position_normal_layout = obj_layout<
+    obj_element<obj_attribute::position>,
+    obj_element<obj_attribute::normal>
+>;
+using obj_full_layout = obj_layout<
+    obj_element<obj_attribute::position>,
+    obj_element<obj_attribute::normal>,
+    obj_element<obj_attribute::texcoord>
+>;
@@ -0,0 +1,18 @@
+#pragma once
+
+#include "obj_layout.hpp"
+
+#include <GL/glew.h>
+
+// Enables and points the bound vertex array's attributes at Layout vertices in the
+// bound GL_ARRAY_BUFFER, one per element, at locations 0, 1, ...
+template <typename Layout>
+void setup_vertex_attributes()
+{
+    for (auto const & attribute : Layout::attributes)
+    {
+        glEnableVertexAttribArray(attribute.location);
+        glVertexAttribPointer(attribute.location, attribute.size, attribute.type, attribute.normalized ? GL_TRUE : GL_FALSE,
+            Layout::stride, reinterpret_cast<void *>(attribute.offset));
+    }
+}
@@ -0,0 +1,239 @@
+#pragma once
+
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <limits>
+#include <type_traits>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define FAST_NUMBER_SSE2
+#include <emmintrin.h>
+#endif
+
+// Locale-independent number parsing for OBJ attributes and face indices.
+// Results are the same as `stream >> value` in the "C" locale: the common
+// short forms are handled by a fast path, everything else falls back to
+// std::from_chars, adjusted where streams differ from it. Like a stream, a
+// failed parse stores 0, or the largest value of the sign on overflow.
+namespace fast_number
+{
+
+    namespace detail
+    {
+
+        inline bool is_digit(char c)
+        {
+            return static_cast<unsigned char>(c - '0') < 10;
+        }
+
+        // Number of consecutive decimal digits starting at p
+        inline std::size_t count_digits(char const * p, char const * end)
+        {
+            std::size_t count = 0;
+
+#ifdef FAST_NUMBER_SSE2
+            while (end - p >= 16)
+            {
+                __m128i bytes = _mm_loadu_si128(reinterpret_cast<__m128i const *>(p));
+                // Shift '0'..'9' to the bottom of the signed range, so that one signed compare finds them
+                __m128i shifted = _mm_sub_epi8(bytes, _mm_set1_epi8(static_cast<char>('0' + 128)));
+                __m128i digits = _mm_cmplt_epi8(shifted, _mm_set1_epi8(static_cast<char>(-128 + 10)));
+                unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(digits));
+
+                if (mask != 0xFFFFu)
+                {
+                    unsigned first_non_digit = ~mask;
+#if defined(_MSC_VER) && !defined(__clang__)
+                    unsigned long index;
+                    _BitScanForward(&index, first_non_digit);
+                    return count + index;
+#else
+                    return count + static_cast<std::size_t>(__builtin_ctz(first_non_digit));
+#endif
+                }
+
+                p += 16;
+                count += 16;
+            }
+#endif
+
+            while (p != end && is_digit(*p))
+            {
+                ++p;
+                ++count;
+            }
+
+            return count;
+        }
+
+        // Value of exactly 8 ASCII digits, converted with SWAR arithmetic
+        inline std::uint64_t eight_digits(char const * p)
+        {
+            std::uint64_t v;
+            std::memcpy(&v, p, 8);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+            v = __builtin_bswap64(v);
+#endif
+            v -= 0x3030303030303030ull;
+            v = (v * 10) + (v >> 8);
+            v = (((v & 0x000000FF000000FFull) * (100 + (1000000ull << 32)))
+                + (((v >> 16) & 0x000000FF000000FFull) * (1 + (10000ull << 32)))) >> 32;
+            return v;
+        }
+
+        // Value of count (<= 19) ASCII digits
+        inline std::uint64_t digits_value(char const * p, std::size_t count)
+        {
+            std::uint64_t value = 0;
+            while (count >= 8)
+            {
+                value = value * 100000000ull + eight_digits(p);
+                p += 8;
+                count -= 8;
+            }
+            while (count-- > 0)
+                value = value * 10 + static_cast<std::uint64_t>(*p++ - '0');
+            return value;
+        }
+
+        // Every power of ten up to 1e10 is exactly representable as a float
+        inline constexpr float pow10[] = {
+            1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f, 1e10f,
+        };
+
+        // std::from_chars for values the fast paths don't handle, with stream results
+        template <typename T>
+        bool parse_slow(char const *& p, char const * end, T & value)
+        {
+            bool const negative = (p != end && *p == '-');
+
+            auto [ptr, ec] = std::from_chars(p, end, value);
+            if (ec == std::errc::result_out_of_range)
+            {
+                if constexpr (std::is_floating_point_v<T>)
+                {
+                    // Streams keep underflowing values, rounded to a denormal or zero. Values
+                    // out of double range too are told apart by the sign of their exponent
+                    bool underflow = false;
+                    double wide;
+                    if (std::from_chars(p, end, wide).ec == std::errc{})
+                    {
+                        underflow = std::fabs(wide) < 1.0;
+                        value = static_cast<T>(wide);
+                    }
+                    else
+                    {
+                        for (char const * q = p; q != ptr; ++q)
+                            if (*q == 'e' || *q == 'E')
+                                underflow = (q + 1 != ptr && q[1] == '-');
+                        value = negative ? T(-0.0) : T(0);
+                    }
+
+                    if (underflow)
+                    {
+                        p = ptr;
+                        return true;
+                    }
+                }
+
+                value = negative ? std::numeric_limits<T>::lowest() : std::numeric_limits<T>::max();
+                return false;
+            }
+
+            if (ec != std::errc{})
+            {
+                value = T(0);
+                return false;
+            }
+
+            if constexpr (std::is_floating_point_v<T>)
+            {
+                // Streams reject "nan", "inf" and an exponent without digits, which
+                // std::from_chars accepts or parses up to the 'e'
+                if (!std::isfinite(value) || (ptr != end && (*ptr == 'e' || *ptr == 'E')))
+                {
+                    value = T(0);
+                    return false;
+                }
+            }
+
+            p = ptr;
+            return true;
+        }
+
+    }
+
+    // Parses an optionally signed decimal integer at p, advancing p past it
+    inline bool parse(char const *& p, char const * end, std::int32_t & value)
+    {
+        char const * q = p;
+        bool negative = false;
+        if (q != end && *q == '-')
+        {
+            negative = true;
+            ++q;
+        }
+
+        std::size_t const count = detail::count_digits(q, end);
+
+        // Up to 9 digits can't overflow
+        if (count == 0 || count > 9)
+            return detail::parse_slow(p, end, value);
+
+        auto magnitude = static_cast<std::int32_t>(detail::digits_value(q, count));
+        value = negative ? -magnitude : magnitude;
+        p = q + count;
+        return true;
+    }
+
+    // Parses a decimal floating-point number at p, advancing p past it.
+    // Numbers without an exponent whose digits fit into the float mantissa
+    // and that have at most 10 fractional digits are computed as a single
+    // correctly rounded division of two exactly representable floats.
+    inline bool parse(char const *& p, char const * end, float & value)
+    {
+        char const * q = p;
+        bool negative = false;
+        if (q != end && *q == '-')
+        {
+            negative = true;
+            ++q;
+        }
+
+        std::size_t const integer_count = detail::count_digits(q, end);
+        char const * integer = q;
+        q += integer_count;
+
+        char const * fraction = q;
+        std::size_t fraction_count = 0;
+        if (q != end && *q == '.')
+        {
+            fraction = ++q;
+            fraction_count = detail::count_digits(q, end);
+            q += fraction_count;
+        }
+
+        bool const has_exponent = (q != end) && (*q == 'e' || *q == 'E');
+
+        if (integer_count + fraction_count > 0 && integer_count + fraction_count <= 19
+            && fraction_count <= 10 && !has_exponent)
+        {
+            std::uint64_t mantissa = detail::digits_value(integer, integer_count);
+            for (std::size_t i = 0; i < fraction_count; ++i)
+                mantissa = mantissa * 10 + static_cast<std::uint64_t>(fraction[i] - '0');
+
+            if (mantissa <= (std::uint64_t(1) << 24))
+            {
+                float result = static_cast<float>(mantissa) / detail::pow10[fraction_count];
+                value = negative ? -result : result;
+                p = q;
+                return true;
+            }
+        }
+
+        return detail::parse_slow(p, end, value);
+    }
+
+}
@@ -0,0 +1,123 @@
+// Compares std::map against index_hash_map for OBJ vertex deduplication.
+// The face corner stream of a real mesh (buddha.obj by default, or the OBJ
+// given on the command line) is read with the parser's tokenizer, and the
+// resolved (position, texcoord, normal) index triples are replayed as keys.
+
+#include "obj_builder.hpp"
+#include "index_hash_map.hpp"
+#include "mapped_file.hpp"
+
+#include <iostream>
+#include <chrono>
+#include <map>
+#include <string>
+#include <stdexcept>
+
+namespace
+{
+
+    using clock_type = std::chrono::high_resolution_clock;
+
+    template <typename F>
+    double measure(int repeats, F && f)
+    {
+        double best = 1e30;
+        for (int i = 0; i < repeats; ++i)
+        {
+            auto start = clock_type::now();
+            f();
+            best = std::min(best, std::chrono::duration<double>(clock_type::now() - start).count());
+        }
+        return best;
+    }
+
+    // Vertices as parse_obj returns them; the recorder never writes any
+    struct obj_data_vertices
+    {
+        using mesh_type = obj_data;
+        using vertex_type = obj_data::vertex;
+
+        static constexpr bool has_normals = true;
+        static constexpr bool has_texcoords = true;
+
+        static void write(vertex_type &, std::array<float, 3> const &, std::array<float, 3> const *,
+            std::array<float, 2> const *)
+        {}
+    };
+
+    // Records the resolved index triple of every face corner instead of deduplicating it
+    struct corner_recorder
+        : obj_detail::basic_obj_builder<obj_data_vertices>
+    {
+        std::vector<index_hash_map::key_type> keys;
+
+        void add_face_vertex(std::array<std::int32_t, 3> index, bool has_texcoord, bool has_normal)
+        {
+            std::array<std::size_t, 3> const sizes{positions.size(), texcoords.size(), normals.size()};
+            keys.push_back(obj_detail::resolve_index(index, has_texcoord, has_normal, sizes,
+                [this](auto const & ... args){ fail(args...); }));
+        }
+
+        void end_face()
+        {}
+    };
+
+}
+
+int main(int argc, char ** argv)
+try
+{
+    std::string const path = (argc > 1) ? argv[1] : std::string(PROJECT_ROOT) + "/buddha.obj";
+    int const repeats = 5;
+
+    std::vector<index_hash_map::key_type> keys;
+    {
+        mapped_file file(path);
+
+        corner_recorder recorder;
+        obj_detail::scan_obj(file.begin(), file.end(), recorder);
+        keys = std::move(recorder.keys);
+    }
+
+    std::vector<std::uint32_t> map_ids(keys.size());
+    std::vector<std::uint32_t> hash_ids(keys.size());
+
+    double map_time = measure(repeats, [&]{
+        std::map<index_hash_map::key_type, std::uint32_t> map;
+        for (std::size_t i = 0; i < keys.size(); ++i)
+            map_ids[i] = map.insert({keys[i], map.size()}).first->second;
+    });
+
+    double hash_time = measure(repeats, [&]{
+        index_hash_map map(keys.size());
+        for (std::size_t i = 0; i < keys.size(); ++i)
+            hash_ids[i] = map.insert(keys[i], map.size()).first;
+    });
+
+    index_hash_map reused(keys.size());
+    double reused_time = measure(repeats, [&]{
+        reused.clear();
+        for (std::size_t i = 0; i < keys.size(); ++i)
+            hash_ids[i] = reused.insert(keys[i], reused.size()).first;
+    });
+
+    if (map_ids != hash_ids)
+        throw std::runtime_error("std::map and index_hash_map assigned different vertex ids");
+
+    auto report = [&](char const * name, double time)
+    {
+        std::cout << name << ": " << time * 1000.0 << " ms, "
+            << time * 1e9 / keys.size() << " ns per corner, "
+            << map_time / time << "x" << std::endl;
+    };
+
+    std::cout << path << ": " << keys.size() << " face corners, " << reused.size() << " unique vertices" << std::endl;
+    report("std::map", map_time);
+    report("index_hash_map", hash_time);
+    report("index_hash_map (reused)", reused_time);
+}
+catch (std::exception const & e)
+{
+    std::cerr << e.what() << std::endl;
+    return EXIT_FAILURE;
+}
@@ -16,6 +16,7 @@
 #include <vector>
 #include <map>
 #include <cmath>
+#include <algorithm>
 #include <fstream>
 #include <sstream>
 
@@ -29,7 +30,11 @@
 #include <glm/ext/scalar_constants.hpp>
 #include <glm/gtx/string_cast.hpp>
 
-#include "obj_parser.hpp"
+#include "obj_cache.hpp"
+#include "mesh_optimizer.hpp"
+#include "mesh_quantization.hpp"
+#include "mesh_simplifier.hpp"
+#include "mesh_welder.hpp"
 
 std::string to_string(std::string_view str)
 {
@@ -53,17 +58,28 @@ uniform mat4 model;
 uniform mat4 view;
 uniform mat4 projection;
 
+uniform vec3 position_offset;
+uniform vec3 position_scale;
+
 layout (location = 0) in vec3 in_position;
-layout (location = 1) in vec3 in_normal;
+layout (location = 1) in vec2 in_normal;
 
 out vec3 position;
 out vec3 normal;
 
+vec3 decode_octahedral(vec2 e)
+{
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    if (n.z < 0.0)
+        n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+    return normalize(n);
+}
+
 void main()
 {
-    position = (model * vec4(in_position, 1.0)).xyz;
+    position = (model * vec4(position_offset + position_scale * in_position, 1.0)).xyz;
     gl_Position = projection * view * vec4(position, 1.0);
-    normal = normalize(mat3(model) * in_normal);
+    normal = normalize(mat3(model) * decode_octahedral(in_normal));
 }
 )";
 
@@ -144,6 +160,51 @@ GLuint create_program(GLuint vertex_shader, GLuint fragment_shader)
     return result;
 }
 
+// LOD chain of the scene in one quantized vertex and index buffer: LOD i is the
+// lod_index_count[i] indices starting at lod_first_index[i]
+struct scene_lods
+{
+    quantized_mesh mesh;
+    std::vector<std::uint64_t> lod_first_index;
+    std::vector<std::uint64_t> lod_index_count;
+    std::vector<float> lod_error;
+};
+
+// Visits every field for cache_writer and cache_reader alike
+template <typename Stream, typename Lods>
+void visit_scene_lods(Stream & stream, Lods & lods)
+{
+    stream.value(lods.mesh.position_offset);
+    stream.value(lods.mesh.position_scale);
+    stream.array(lods.mesh.vertices);
+    stream.array(lods.mesh.index_data);
+    stream.value(lods.mesh.index_count);
+    stream.value(lods.mesh.index_type);
+    stream.array(lods.lod_first_index);
+    stream.array(lods.lod_index_count);
+    stream.array(lods.lod_error);
+}
+
+scene_lods build_scene_lods(obj_data const & mesh)
+{
+    float const lod_ratios[] = {0.5f, 0.25f, 0.1f, 0.03f};
+    auto lods = build_lod_chain(mesh.vertices, mesh.indices, lod_ratios);
+
+    // All LODs share the vertex buffer and live one after another in the index buffer
+    scene_lods result;
+    std::vector<std::uint32_t> lod_indices;
+    for (auto const & lod : lods)
+    {
+        result.lod_first_index.push_back(lod_indices.size());
+        result.lod_index_count.push_back(lod.indices.size());
+        result.lod_error.push_back(lod.error);
+        lod_indices.insert(lod_indices.end(), lod.indices.begin(), lod.indices.end());
+    }
+
+    result.mesh = quantize_mesh(mesh.vertices, lod_indices);
+    return result;
+}
+
 int main()
 try
 {
@@ -190,6 +251,8 @@ try
     GLuint model_location = glGetUniformLocation(program, "model");
     GLuint view_location = glGetUniformLocation(program, "view");
     GLuint projection_location = glGetUniformLocation(program, "projection");
+    GLuint position_offset_location = glGetUniformLocation(program, "position_offset");
+    GLuint position_scale_location = glGetUniformLocation(program, "position_scale");
     GLuint camera_position_location = glGetUniformLocation(program, "camera_position");
     GLuint albedo_location = glGetUniformLocation(program, "albedo");
     GLuint sun_direction_location = glGetUniformLocation(program, "sun_direction");
@@ -197,7 +260,41 @@ try
 
     std::string project_root = PROJECT_ROOT;
     std::string scene_path = project_root + "/buddha.obj";
-    obj_data scene = parse_obj(scene_path);
+
+    // The processed mesh is cached with its LODs and quantized buffers, so welding,
+    // optimization, simplification and quantization only run when the cache is rebuilt
+    obj_cache_processing mesh_processing{"weld_vcache_lod", [](obj_data & mesh)
+    {
+        auto weld = weld_vertices(mesh);
+        std::cout << "Welding: " << weld.vertices_before << " -> " << weld.vertices_after << " vertices, "
+            << weld.triangles_removed << " degenerate triangles removed, " << weld.bytes_saved << " bytes saved" << std::endl;
+
+        auto stats = optimize_mesh(mesh);
+        std::cout << "Vertex cache optimization: ACMR " << stats.acmr_before << " -> " << stats.acmr_after << std::endl;
+    }, [](obj_data const & mesh, cache_writer & writer)
+    {
+        auto lods = build_scene_lods(mesh);
+        visit_scene_lods(writer, lods);
+    }};
+
+    auto scene = load_obj_cached(scene_path, mesh_processing);
+    std::cout << "Scene ACMR: " << compute_acmr(scene.indices, scene.vertices.size()) << std::endl;
+
+    scene_lods lods;
+    {
+        cache_reader reader{scene.derived.data(), scene.derived.data() + scene.derived.size()};
+        visit_scene_lods(reader, lods);
+        if (!reader.ok || lods.lod_first_index.empty() || lods.lod_index_count.size() != lods.lod_first_index.size()
+            || lods.lod_error.size() != lods.lod_first_index.size())
+            throw std::runtime_error("Malformed LOD data in the mesh cache");
+    }
+
+    for (std::size_t i = 0; i < lods.lod_first_index.size(); ++i)
+        std::cout << "LOD " << i << ": " << lods.lod_index_count[i] / 3 << " triangles, error " << lods.lod_error[i] << std::endl;
+
+    auto const & packed_scene = lods.mesh;
+    std::size_t const index_size = packed_scene.index_data.size() / std::max<std::size_t>(packed_scene.index_count, 1);
+    std::cout << "Scene size: " << scene.vertices.size_bytes() + scene.indices.size_bytes() << " bytes, quantized: " << packed_scene.size_bytes() << " bytes" << std::endl;
 
     GLuint scene_vao, scene_vbo, scene_ebo;
     glGenVertexArrays(1, &scene_vao);
@@ -205,16 +302,18 @@ try
 
     glGenBuffers(1, &scene_vbo);
     glBindBuffer(GL_ARRAY_BUFFER, scene_vbo);
-    glBufferData(GL_ARRAY_BUFFER, scene.vertices.size() * sizeof(scene.vertices[0]), scene.vertices.data(), GL_STATIC_DRAW);
+    glBufferData(GL_ARRAY_BUFFER, packed_scene.vertices.size() * sizeof(packed_scene.vertices[0]), packed_scene.vertices.data(), GL_STATIC_DRAW);
 
     glGenBuffers(1, &scene_ebo);
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, scene_ebo);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, scene.indices.size() * sizeof(scene.indices[0]), scene.indices.data(), GL_STATIC_DRAW);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, packed_scene.index_data.size(), packed_scene.index_data.data(), GL_STATIC_DRAW);
 
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(obj_data::vertex), (void *)(0));
-    glEnableVertexAttribArray(1);
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(obj_data::vertex), (void *)(12));
+    for (auto const & attribute : quantized_mesh::attributes)
+    {
+        glEnableVertexAttribArray(attribute.location);
+        glVertexAttribPointer(attribute.location, attribute.size, attribute.type, attribute.normalized ? GL_TRUE : GL_FALSE,
+            sizeof(quantized_mesh::vertex), reinterpret_cast<void *>(attribute.offset));
+    }
 
     auto last_frame_start = std::chrono::high_resolution_clock::now();
 
@@ -292,6 +391,12 @@ try
 
         glm::vec3 camera_position = (glm::inverse(view) * glm::vec4(0.f, 0.f, 0.f, 1.f)).xyz();
 
+        // The coarsest LOD whose error projects to less than a pixel
+        float const pixels_per_unit = height / (2.f * std::tan(glm::pi<float>() / 6.f) * std::max(camera_distance, near));
+        std::size_t lod = 0;
+        while (lod + 1 < lods.lod_error.size() && lods.lod_error[lod + 1] * pixels_per_unit < 1.f)
+            ++lod;
+
         glm::vec3 sun_direction = glm::normalize(glm::vec3(std::sin(time * 0.5f), 2.f, std::cos(time * 0.5f)));
 
         glUseProgram(program);
@@ -300,12 +405,15 @@ try
         glUniformMatrix4fv(view_location, 1, GL_FALSE, reinterpret_cast<float *>(&view));
         glUniformMatrix4fv(projection_location, 1, GL_FALSE, reinterpret_cast<float *>(&projection));
         glUniform3fv(camera_position_location, 1, (float *)(&camera_position));
+        glUniform3fv(position_offset_location, 1, packed_scene.position_offset.data());
+        glUniform3fv(position_scale_location, 1, packed_scene.position_scale.data());
         glUniform3f(albedo_location, .8f, .7f, .6f);
         glUniform3f(sun_color_location, 1.f, 1.f, 1.f);
         glUniform3fv(sun_direction_location, 1, reinterpret_cast<float *>(&sun_direction));
 
         glBindVertexArray(scene_vao);
-        glDrawElements(GL_TRIANGLES, scene.indices.size(), GL_UNSIGNED_INT, nullptr);
+        glDrawElements(GL_TRIANGLES, lods.lod_index_count[lod], packed_scene.index_type,
+            reinterpret_cast<void *>(lods.lod_first_index[lod] * index_size));
 
         SDL_GL_SwapWindow(window);
     }
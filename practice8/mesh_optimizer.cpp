@@ -0,0 +1,239 @@
+#include "mesh_optimizer.hpp"
+
+#include <vector>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+
+namespace
+{
+
+    // Tuning constants from the original article
+    constexpr std::size_t max_cache_size = 32;
+    constexpr float cache_decay_power = 1.5f;
+    constexpr float last_triangle_score = 0.75f;
+    constexpr float valence_boost_scale = 2.f;
+    constexpr float valence_boost_power = 0.5f;
+
+    float vertex_score(int cache_position, std::uint32_t remaining_triangles)
+    {
+        // Vertices with nothing left to draw don't attract anything
+        if (remaining_triangles == 0)
+            return -1.f;
+
+        float score = 0.f;
+
+        if (cache_position >= 0)
+        {
+            // The three vertices of the last triangle get a fixed score, so that
+            // the next triangle doesn't prefer the one just drawn
+            if (cache_position < 3)
+                score = last_triangle_score;
+            else
+            {
+                float const scaler = 1.f / (max_cache_size - 3);
+                score = std::pow(1.f - (cache_position - 3) * scaler, cache_decay_power);
+            }
+        }
+
+        // Prefer vertices with few triangles left, to get rid of lone triangles early
+        score += valence_boost_scale * std::pow(static_cast<float>(remaining_triangles), -valence_boost_power);
+
+        return score;
+    }
+
+}
+
+float compute_acmr(std::span<std::uint32_t const> indices, std::size_t vertex_count, std::size_t cache_size)
+{
+    if (indices.size() < 3)
+        return 0.f;
+
+    // Time at which each vertex entered the cache; it is still there if fewer than
+    // cache_size misses happened since then
+    std::vector<std::size_t> entered(vertex_count, 0);
+    std::size_t misses = 0;
+
+    for (auto i : indices)
+    {
+        if (entered[i] == 0 || misses - entered[i] >= cache_size)
+        {
+            ++misses;
+            entered[i] = misses;
+        }
+    }
+
+    return static_cast<float>(misses) / (indices.size() / 3);
+}
+
+void optimize_vertex_cache(std::span<std::uint32_t> indices, std::size_t vertex_count)
+{
+    std::size_t const triangle_count = indices.size() / 3;
+    if (triangle_count == 0)
+        return;
+
+    // Triangles adjacent to each vertex, as offsets into one flat array
+    std::vector<std::uint32_t> adjacency_offset(vertex_count + 1, 0);
+    for (auto i : indices)
+        ++adjacency_offset[i + 1];
+    for (std::size_t v = 0; v < vertex_count; ++v)
+        adjacency_offset[v + 1] += adjacency_offset[v];
+
+    std::vector<std::uint32_t> adjacency(indices.size());
+    {
+        std::vector<std::uint32_t> fill(adjacency_offset.begin(), adjacency_offset.end() - 1);
+        for (std::size_t t = 0; t < triangle_count; ++t)
+            for (std::size_t k = 0; k < 3; ++k)
+                adjacency[fill[indices[3 * t + k]]++] = t;
+    }
+
+    // Not yet drawn triangles come first in each vertex's adjacency range
+    std::vector<std::uint32_t> remaining(vertex_count);
+    for (std::size_t v = 0; v < vertex_count; ++v)
+        remaining[v] = adjacency_offset[v + 1] - adjacency_offset[v];
+
+    std::vector<int> cache_position(vertex_count, -1);
+    std::vector<float> score(vertex_count);
+    for (std::size_t v = 0; v < vertex_count; ++v)
+        score[v] = vertex_score(-1, remaining[v]);
+
+    std::vector<float> triangle_score(triangle_count);
+    for (std::size_t t = 0; t < triangle_count; ++t)
+        triangle_score[t] = score[indices[3 * t]] + score[indices[3 * t + 1]] + score[indices[3 * t + 2]];
+
+    std::vector<bool> drawn(triangle_count, false);
+    std::vector<std::uint32_t> result;
+    result.reserve(indices.size());
+
+    std::vector<std::uint32_t> cache;
+    std::vector<std::uint32_t> new_cache;
+    cache.reserve(max_cache_size + 3);
+    new_cache.reserve(max_cache_size + 3);
+
+    std::size_t scan_position = 0;
+    std::size_t best_triangle = 0;
+    {
+        float best = -std::numeric_limits<float>::infinity();
+        for (std::size_t t = 0; t < triangle_count; ++t)
+            if (triangle_score[t] > best)
+            {
+                best = triangle_score[t];
+                best_triangle = t;
+            }
+    }
+
+    for (std::size_t drawn_count = 0; drawn_count < triangle_count; ++drawn_count)
+    {
+        if (best_triangle == std::numeric_limits<std::size_t>::max())
+        {
+            // Nothing in the cache touches an undrawn triangle: take the next one in input order
+            while (drawn[scan_position])
+                ++scan_position;
+            best_triangle = scan_position;
+        }
+
+        std::size_t const t = best_triangle;
+        drawn[t] = true;
+
+        std::uint32_t const * triangle = &indices[3 * t];
+        for (std::size_t k = 0; k < 3; ++k)
+        {
+            std::uint32_t const v = triangle[k];
+            result.push_back(v);
+
+            // Move the triangle out of the undrawn part of the adjacency range
+            auto begin = adjacency.begin() + adjacency_offset[v];
+            auto end = begin + remaining[v];
+            std::iter_swap(std::find(begin, end, t), end - 1);
+            --remaining[v];
+        }
+
+        // The triangle's vertices go to the front of the LRU cache
+        new_cache.clear();
+        for (std::size_t k = 0; k < 3; ++k)
+            if (std::find(new_cache.begin(), new_cache.end(), triangle[k]) == new_cache.end())
+                new_cache.push_back(triangle[k]);
+        for (auto v : cache)
+            if (v != triangle[0] && v != triangle[1] && v != triangle[2])
+                new_cache.push_back(v);
+
+        // Evicted vertices lose their cache bonus, or triangles around them would keep it
+        for (std::size_t i = max_cache_size; i < new_cache.size(); ++i)
+        {
+            cache_position[new_cache[i]] = -1;
+            score[new_cache[i]] = vertex_score(-1, remaining[new_cache[i]]);
+        }
+        if (new_cache.size() > max_cache_size)
+            new_cache.resize(max_cache_size);
+
+        for (std::size_t i = 0; i < new_cache.size(); ++i)
+            cache_position[new_cache[i]] = i;
+
+        std::swap(cache, new_cache);
+
+        // Rescore the cached vertices and their undrawn triangles, and pick the best one
+        for (auto v : cache)
+            score[v] = vertex_score(cache_position[v], remaining[v]);
+
+        best_triangle = std::numeric_limits<std::size_t>::max();
+        float best = -std::numeric_limits<float>::infinity();
+
+        for (auto v : cache)
+        {
+            auto begin = adjacency.begin() + adjacency_offset[v];
+            for (auto it = begin; it != begin + remaining[v]; ++it)
+            {
+                std::uint32_t const u = *it;
+                float const s = score[indices[3 * u]] + score[indices[3 * u + 1]] + score[indices[3 * u + 2]];
+                if (s > best)
+                {
+                    best = s;
+                    best_triangle = u;
+                }
+            }
+        }
+    }
+
+    std::copy(result.begin(), result.end(), indices.begin());
+}
+
+void optimize_vertex_fetch(obj_data & mesh)
+{
+    constexpr std::uint32_t unused = std::numeric_limits<std::uint32_t>::max();
+
+    std::vector<std::uint32_t> remap(mesh.vertices.size(), unused);
+    std::vector<obj_data::vertex> vertices;
+    vertices.reserve(mesh.vertices.size());
+    std::vector<std::array<float, 4>> tangents;
+    tangents.reserve(mesh.tangents.size());
+
+    for (auto & i : mesh.indices)
+    {
+        if (remap[i] == unused)
+        {
+            remap[i] = vertices.size();
+            vertices.push_back(mesh.vertices[i]);
+            if (!mesh.tangents.empty())
+                tangents.push_back(mesh.tangents[i]);
+        }
+        i = remap[i];
+    }
+
+    // Vertices not referenced by any triangle are dropped
+    mesh.vertices = std::move(vertices);
+    mesh.tangents = std::move(tangents);
+}
+
+mesh_optimization_stats optimize_mesh(obj_data & mesh)
+{
+    mesh_optimization_stats stats;
+    stats.acmr_before = compute_acmr(mesh.indices, mesh.vertices.size());
+
+    // Triangles stay within their submesh, so the per-material draw ranges remain valid
+    for (auto const & submesh : mesh.submeshes)
+        optimize_vertex_cache(std::span(mesh.indices).subspan(submesh.first_index, submesh.index_count), mesh.vertices.size());
+    optimize_vertex_fetch(mesh);
+
+    stats.acmr_after = compute_acmr(mesh.indices, mesh.vertices.size());
+    return stats;
+}
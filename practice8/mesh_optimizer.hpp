@@ -0,0 +1,27 @@
+#pragma once
+
+#include "obj_parser.hpp"
+
+#include <span>
+
+// Average cache miss ratio: vertex shader invocations per triangle, simulated with
+// a FIFO post-transform cache of the given size. 0.5 is the ideal for large
+// regular meshes, 3 means no reuse at all.
+float compute_acmr(std::span<std::uint32_t const> indices, std::size_t vertex_count, std::size_t cache_size = 32);
+
+// Reorders triangles for post-transform vertex cache locality, using
+// Tom Forsyth's "Linear-Speed Vertex Cache Optimisation"
+void optimize_vertex_cache(std::span<std::uint32_t> indices, std::size_t vertex_count);
+
+// Renumbers vertices in order of first use by the index buffer, so that
+// vertex fetches walk the vertex buffer mostly sequentially
+void optimize_vertex_fetch(obj_data & mesh);
+
+struct mesh_optimization_stats
+{
+    float acmr_before;
+    float acmr_after;
+};
+
+// Triangle reordering within each submesh followed by vertex reordering
+mesh_optimization_stats optimize_mesh(obj_data & mesh);
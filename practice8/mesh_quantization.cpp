@@ -0,0 +1,173 @@
+#include "mesh_quantization.hpp"
+
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <algorithm>
+
+namespace
+{
+
+    std::int16_t to_snorm16(float value)
+    {
+        return static_cast<std::int16_t>(std::lround(std::clamp(value, -1.f, 1.f) * 32767.f));
+    }
+
+    float sign_not_zero(float value)
+    {
+        return value < 0.f ? -1.f : 1.f;
+    }
+
+}
+
+std::uint16_t float_to_half(float value)
+{
+    std::uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+
+    std::uint32_t const sign = (bits >> 16) & 0x8000u;
+    std::uint32_t const magnitude = bits & 0x7FFFFFFFu;
+
+    // Infinity and NaN
+    if (magnitude >= 0x7F800000u)
+        return sign | 0x7C00u | (magnitude > 0x7F800000u ? 0x0200u : 0u);
+
+    // Rounds to 65536 or more
+    if (magnitude >= 0x477FF000u)
+        return sign | 0x7C00u;
+
+    // Below the smallest normal half: the mantissa is value * 2^24, rounded to nearest even
+    if (magnitude < 0x38800000u)
+    {
+        float abs_value;
+        std::memcpy(&abs_value, &magnitude, sizeof(abs_value));
+        return sign | static_cast<std::uint32_t>(std::nearbyint(abs_value * 16777216.f));
+    }
+
+    // Rebias the exponent from 127 to 15 and round the mantissa to nearest even;
+    // a carry out of the mantissa correctly bumps the exponent
+    std::uint32_t half = (magnitude - 0x38000000u) >> 13;
+    std::uint32_t const rest = magnitude & 0x1FFFu;
+    if (rest > 0x1000u || (rest == 0x1000u && (half & 1u)))
+        ++half;
+
+    return sign | half;
+}
+
+float half_to_float(std::uint16_t value)
+{
+    std::uint32_t const sign = static_cast<std::uint32_t>(value & 0x8000u) << 16;
+    std::uint32_t const exponent = (value >> 10) & 0x1Fu;
+    std::uint32_t const mantissa = value & 0x3FFu;
+
+    float result;
+    if (exponent == 0)
+        result = std::ldexp(static_cast<float>(mantissa), -24);
+    else if (exponent == 31)
+        result = mantissa == 0 ? std::numeric_limits<float>::infinity() : std::numeric_limits<float>::quiet_NaN();
+    else
+    {
+        std::uint32_t const bits = ((exponent + 112) << 23) | (mantissa << 13);
+        std::memcpy(&result, &bits, sizeof(result));
+    }
+
+    return sign ? -result : result;
+}
+
+std::array<std::int16_t, 2> encode_octahedral(std::array<float, 3> const & normal)
+{
+    float const l1 = std::abs(normal[0]) + std::abs(normal[1]) + std::abs(normal[2]);
+
+    // Missing normals (all zeros) decode to +Z
+    if (!(l1 > 0.f))
+        return {0, 0};
+
+    // Project onto the octahedron, then fold the lower hemisphere over the upper one
+    float x = normal[0] / l1;
+    float y = normal[1] / l1;
+    if (normal[2] < 0.f)
+    {
+        float const folded_x = (1.f - std::abs(y)) * sign_not_zero(x);
+        float const folded_y = (1.f - std::abs(x)) * sign_not_zero(y);
+        x = folded_x;
+        y = folded_y;
+    }
+
+    return {to_snorm16(x), to_snorm16(y)};
+}
+
+std::array<float, 3> decode_octahedral(std::array<std::int16_t, 2> const & encoded)
+{
+    float x = std::max(encoded[0] / 32767.f, -1.f);
+    float y = std::max(encoded[1] / 32767.f, -1.f);
+    float const z = 1.f - std::abs(x) - std::abs(y);
+    if (z < 0.f)
+    {
+        float const unfolded_x = (1.f - std::abs(y)) * sign_not_zero(x);
+        float const unfolded_y = (1.f - std::abs(x)) * sign_not_zero(y);
+        x = unfolded_x;
+        y = unfolded_y;
+    }
+
+    float const length = std::sqrt(x * x + y * y + z * z);
+    return {x / length, y / length, z / length};
+}
+
+quantized_mesh quantize_mesh(std::span<obj_data::vertex const> vertices, std::span<std::uint32_t const> indices)
+{
+    quantized_mesh result;
+
+    std::array<float, 3> min, max;
+    min.fill(std::numeric_limits<float>::infinity());
+    max.fill(-std::numeric_limits<float>::infinity());
+    for (auto const & v : vertices)
+        for (std::size_t k = 0; k < 3; ++k)
+        {
+            min[k] = std::min(min[k], v.position[k]);
+            max[k] = std::max(max[k], v.position[k]);
+        }
+
+    for (std::size_t k = 0; k < 3; ++k)
+    {
+        result.position_offset[k] = vertices.empty() ? 0.f : min[k];
+        result.position_scale[k] = vertices.empty() ? 0.f : max[k] - min[k];
+    }
+
+    result.vertices.resize(vertices.size());
+    for (std::size_t i = 0; i < vertices.size(); ++i)
+    {
+        auto const & in = vertices[i];
+        auto & out = result.vertices[i];
+
+        for (std::size_t k = 0; k < 3; ++k)
+        {
+            // Flat axes (zero extent) all map to 0
+            float const t = result.position_scale[k] > 0.f ? (in.position[k] - result.position_offset[k]) / result.position_scale[k] : 0.f;
+            out.position[k] = static_cast<std::uint16_t>(std::lround(std::clamp(t, 0.f, 1.f) * 65535.f));
+        }
+        out.padding = 0;
+
+        out.normal = encode_octahedral(in.normal);
+
+        out.texcoord[0] = float_to_half(in.texcoord[0]);
+        out.texcoord[1] = float_to_half(in.texcoord[1]);
+    }
+
+    result.index_count = indices.size();
+    if (vertices.size() <= std::size_t(std::numeric_limits<std::uint16_t>::max()) + 1)
+    {
+        result.index_type = quantized_mesh::gl_unsigned_short;
+        result.index_data.resize(indices.size() * sizeof(std::uint16_t));
+        auto * out = reinterpret_cast<std::uint16_t *>(result.index_data.data());
+        for (std::size_t i = 0; i < indices.size(); ++i)
+            out[i] = static_cast<std::uint16_t>(indices[i]);
+    }
+    else
+    {
+        result.index_type = quantized_mesh::gl_unsigned_int;
+        result.index_data.resize(indices.size_bytes());
+        std::memcpy(result.index_data.data(), indices.data(), indices.size_bytes());
+    }
+
+    return result;
+}
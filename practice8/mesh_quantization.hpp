@@ -0,0 +1,74 @@
+#pragma once
+
+#include "obj_parser.hpp"
+
+#include <array>
+#include <vector>
+#include <span>
+#include <cstddef>
+#include <cstdint>
+
+// One vertex attribute of a packed layout, in glVertexAttribPointer terms.
+// type holds the GL component type value (GL_UNSIGNED_SHORT etc.), like gltf accessors do.
+struct vertex_attribute
+{
+    unsigned int location;
+    int size;
+    unsigned int type;
+    bool normalized;
+    std::size_t offset;
+};
+
+// Packed version of obj_data, 16 bytes per vertex instead of 32
+struct quantized_mesh
+{
+    struct vertex
+    {
+        // Unsigned normalized, position = position_offset + position_scale * (p / 65535)
+        std::array<std::uint16_t, 3> position;
+        std::uint16_t padding;
+        // Signed normalized octahedral encoding of the unit normal
+        std::array<std::int16_t, 2> normal;
+        // Half floats
+        std::array<std::uint16_t, 2> texcoord;
+    };
+
+    static constexpr unsigned int gl_short = 0x1402;
+    static constexpr unsigned int gl_unsigned_short = 0x1403;
+    static constexpr unsigned int gl_unsigned_int = 0x1405;
+    static constexpr unsigned int gl_half_float = 0x140B;
+
+    // Same locations as the float layout: 0 = position, 1 = normal, 2 = texcoord
+    static constexpr std::array<vertex_attribute, 3> attributes = {{
+        {0, 3, gl_unsigned_short, true, offsetof(vertex, position)},
+        {1, 2, gl_short, true, offsetof(vertex, normal)},
+        {2, 2, gl_half_float, false, offsetof(vertex, texcoord)},
+    }};
+
+    std::array<float, 3> position_offset;
+    std::array<float, 3> position_scale;
+
+    std::vector<vertex> vertices;
+
+    // 16-bit indices if every vertex id fits, 32-bit otherwise; index_type tells which
+    std::vector<std::byte> index_data;
+    std::size_t index_count;
+    unsigned int index_type;
+
+    std::size_t size_bytes() const
+    {
+        return vertices.size() * sizeof(vertex) + index_data.size();
+    }
+};
+
+static_assert(sizeof(quantized_mesh::vertex) == 16);
+
+// Quantizes positions against the mesh bounds, octahedral-encodes normals and
+// converts texcoords to half floats
+quantized_mesh quantize_mesh(std::span<obj_data::vertex const> vertices, std::span<std::uint32_t const> indices);
+
+std::uint16_t float_to_half(float value);
+float half_to_float(std::uint16_t value);
+
+std::array<std::int16_t, 2> encode_octahedral(std::array<float, 3> const & normal);
+std::array<float, 3> decode_octahedral(std::array<std::int16_t, 2> const & encoded);
@@ -0,0 +1,556 @@
+#include "mesh_simplifier.hpp"
+#include "mesh_optimizer.hpp"
+#include "index_hash_map.hpp"
+
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <algorithm>
+
+namespace
+{
+
+    using vec3 = std::array<float, 3>;
+
+    vec3 operator - (vec3 const & a, vec3 const & b)
+    {
+        return {a[0] - b[0], a[1] - b[1], a[2] - b[2]};
+    }
+
+    float dot(vec3 const & a, vec3 const & b)
+    {
+        return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+    }
+
+    vec3 cross(vec3 const & a, vec3 const & b)
+    {
+        return {a[1] * b[2] - a[2] * b[1], a[2] * b[0] - a[0] * b[2], a[0] * b[1] - a[1] * b[0]};
+    }
+
+    float length(vec3 const & a)
+    {
+        return std::sqrt(dot(a, a));
+    }
+
+    constexpr std::uint32_t invalid = std::numeric_limits<std::uint32_t>::max();
+
+    // Open border and seam edges get an extra quadric with this weight, so that
+    // collapsing along them is cheap and collapsing across them is not
+    constexpr float boundary_weight = 10.f;
+
+    // Sum of squared distances to a set of planes, weighted by triangle area:
+    // x^T A x + 2 b^T x + c, with A symmetric
+    struct quadric
+    {
+        double a00 = 0, a11 = 0, a22 = 0;
+        double a01 = 0, a12 = 0, a02 = 0;
+        double b0 = 0, b1 = 0, b2 = 0;
+        double c = 0;
+        double weight = 0;
+
+        // Adds the plane n.x + d = 0 (n is unit length)
+        void add_plane(vec3 const & n, double d, double w)
+        {
+            a00 += w * n[0] * n[0];
+            a11 += w * n[1] * n[1];
+            a22 += w * n[2] * n[2];
+            a01 += w * n[0] * n[1];
+            a12 += w * n[1] * n[2];
+            a02 += w * n[0] * n[2];
+            b0 += w * n[0] * d;
+            b1 += w * n[1] * d;
+            b2 += w * n[2] * d;
+            c += w * d * d;
+            weight += w;
+        }
+
+        quadric & operator += (quadric const & q)
+        {
+            a00 += q.a00; a11 += q.a11; a22 += q.a22;
+            a01 += q.a01; a12 += q.a12; a02 += q.a02;
+            b0 += q.b0; b1 += q.b1; b2 += q.b2;
+            c += q.c;
+            weight += q.weight;
+            return *this;
+        }
+
+        // Mean squared distance to the planes
+        float error(vec3 const & p) const
+        {
+            double const x = p[0], y = p[1], z = p[2];
+            double r = a00 * x * x + a11 * y * y + a22 * z * z
+                + 2 * (a01 * x * y + a12 * y * z + a02 * x * z)
+                + 2 * (b0 * x + b1 * y + b2 * z)
+                + c;
+            return weight > 0 ? static_cast<float>(std::abs(r) / weight) : 0.f;
+        }
+    };
+
+    enum class vertex_kind
+    {
+        // Interior vertex with a single normal/texcoord
+        manifold,
+        // On a single open boundary loop
+        border,
+        // Exactly two attribute variants, split along a single seam line
+        seam,
+        // Anything else: corners, non-manifold or multi-seam vertices
+        locked,
+    };
+
+    // Collapse source kind -> allowed target kinds
+    bool can_collapse(vertex_kind from, vertex_kind to)
+    {
+        switch (from)
+        {
+        case vertex_kind::manifold:
+            return true;
+        case vertex_kind::border:
+            return to == vertex_kind::border;
+        case vertex_kind::seam:
+            return to == vertex_kind::seam;
+        default:
+            return false;
+        }
+    }
+
+    // Half-edges leaving each vertex: for every triangle corner, the next and previous corner
+    struct edge_adjacency
+    {
+        struct edge
+        {
+            std::uint32_t next;
+            std::uint32_t prev;
+        };
+
+        std::vector<std::uint32_t> offsets;
+        std::vector<edge> edges;
+
+        void build(std::span<std::uint32_t const> indices, std::size_t vertex_count)
+        {
+            offsets.assign(vertex_count + 1, 0);
+            for (auto i : indices)
+                ++offsets[i + 1];
+            for (std::size_t v = 0; v < vertex_count; ++v)
+                offsets[v + 1] += offsets[v];
+
+            edges.resize(indices.size());
+            std::vector<std::uint32_t> fill(offsets.begin(), offsets.end() - 1);
+            for (std::size_t t = 0; t + 2 < indices.size(); t += 3)
+                for (std::size_t k = 0; k < 3; ++k)
+                {
+                    std::uint32_t const a = indices[t + k];
+                    std::uint32_t const b = indices[t + (k + 1) % 3];
+                    std::uint32_t const c = indices[t + (k + 2) % 3];
+                    edges[fill[a]++] = {b, c};
+                }
+        }
+
+        std::span<edge const> operator[](std::uint32_t v) const
+        {
+            return {edges.data() + offsets[v], edges.data() + offsets[v + 1]};
+        }
+
+        bool has_edge(std::uint32_t a, std::uint32_t b) const
+        {
+            for (auto const & e : (*this)[a])
+                if (e.next == b)
+                    return true;
+            return false;
+        }
+    };
+
+    struct collapse
+    {
+        std::uint32_t from;
+        std::uint32_t to;
+        float error;
+    };
+
+    struct simplifier
+    {
+        std::span<obj_data::vertex const> vertices;
+        std::size_t vertex_count;
+
+        // First vertex with the same position, and a ring through all vertices sharing it
+        std::vector<std::uint32_t> remap;
+        std::vector<std::uint32_t> wedge;
+
+        std::vector<vertex_kind> kind;
+
+        // The vertex at the other end of the single open outgoing / incoming half-edge,
+        // invalid if there is none, the vertex itself if there are several
+        std::vector<std::uint32_t> loop;
+        std::vector<std::uint32_t> loopback;
+
+        // Indexed by remap
+        std::vector<quadric> quadrics;
+
+        edge_adjacency adjacency;
+
+        vec3 const & position(std::uint32_t v) const
+        {
+            return vertices[v].position;
+        }
+
+        void build_position_remap()
+        {
+            remap.resize(vertex_count);
+            wedge.resize(vertex_count);
+
+            index_hash_map positions(vertex_count);
+            for (std::uint32_t v = 0; v < vertex_count; ++v)
+            {
+                index_hash_map::key_type key;
+                for (std::size_t k = 0; k < 3; ++k)
+                {
+                    // Adding zero turns -0 into +0, so both hash the same
+                    float const coordinate = vertices[v].position[k] + 0.f;
+                    std::memcpy(&key[k], &coordinate, sizeof(float));
+                }
+                remap[v] = positions.insert(key, v).first;
+            }
+
+            for (std::uint32_t v = 0; v < vertex_count; ++v)
+                wedge[v] = v;
+            for (std::uint32_t v = 0; v < vertex_count; ++v)
+                if (remap[v] != v)
+                {
+                    std::uint32_t const r = remap[v];
+                    wedge[v] = wedge[r];
+                    wedge[r] = v;
+                }
+        }
+
+        void classify_vertices()
+        {
+            loop.assign(vertex_count, invalid);
+            loopback.assign(vertex_count, invalid);
+
+            for (std::uint32_t v = 0; v < vertex_count; ++v)
+                for (auto const & e : adjacency[v])
+                {
+                    std::uint32_t const target = e.next;
+                    if (target == v)
+                        loop[v] = loopback[v] = v;
+                    else if (!adjacency.has_edge(target, v))
+                    {
+                        loop[v] = loop[v] == invalid ? target : v;
+                        loopback[target] = loopback[target] == invalid ? v : target;
+                    }
+                }
+
+            auto single_open = [&](std::uint32_t v)
+            {
+                return loop[v] != invalid && loop[v] != v && loopback[v] != invalid && loopback[v] != v;
+            };
+
+            kind.assign(vertex_count, vertex_kind::locked);
+            for (std::uint32_t v = 0; v < vertex_count; ++v)
+            {
+                if (remap[v] != v)
+                    continue;
+
+                if (wedge[v] == v)
+                {
+                    // Note that an edge shared by 4 triangles counts as closed, which is harmless here
+                    if (loop[v] == invalid && loopback[v] == invalid)
+                        kind[v] = vertex_kind::manifold;
+                    else if (single_open(v))
+                        kind[v] = vertex_kind::border;
+                }
+                else if (wedge[wedge[v]] == v)
+                {
+                    // Both variants have one open edge in and out, and they run along the same positions
+                    std::uint32_t const w = wedge[v];
+                    if (single_open(v) && single_open(w)
+                        && remap[loop[v]] == remap[loopback[w]] && remap[loopback[v]] == remap[loop[w]]
+                        && remap[loop[v]] != remap[loopback[v]])
+                        kind[v] = vertex_kind::seam;
+                }
+            }
+
+            for (std::uint32_t v = 0; v < vertex_count; ++v)
+                kind[v] = kind[remap[v]];
+        }
+
+        void build_quadrics(std::span<std::uint32_t const> indices)
+        {
+            quadrics.assign(vertex_count, quadric{});
+
+            for (std::size_t t = 0; t + 2 < indices.size(); t += 3)
+            {
+                std::uint32_t const i0 = indices[t], i1 = indices[t + 1], i2 = indices[t + 2];
+                vec3 const & p0 = position(i0);
+                vec3 const & p1 = position(i1);
+                vec3 const & p2 = position(i2);
+
+                vec3 n = cross(p1 - p0, p2 - p0);
+                float const area = length(n);
+                if (area == 0.f)
+                    continue;
+                for (auto & x : n)
+                    x /= area;
+
+                quadric q;
+                q.add_plane(n, -dot(n, p0), area);
+                quadrics[remap[i0]] += q;
+                quadrics[remap[i1]] += q;
+                quadrics[remap[i2]] += q;
+
+                // Open edges (borders and seams) get a plane through the edge, perpendicular to the triangle
+                std::uint32_t const corners[3] = {i0, i1, i2};
+                for (std::size_t k = 0; k < 3; ++k)
+                {
+                    std::uint32_t const a = corners[k];
+                    std::uint32_t const b = corners[(k + 1) % 3];
+                    if (loop[a] != b)
+                        continue;
+                    if (kind[a] != vertex_kind::border && kind[a] != vertex_kind::seam)
+                        continue;
+
+                    vec3 const edge = position(b) - position(a);
+                    float const edge_length = length(edge);
+                    vec3 m = cross(edge, n);
+                    float const m_length = length(m);
+                    if (m_length == 0.f)
+                        continue;
+                    for (auto & x : m)
+                        x /= m_length;
+
+                    quadric e;
+                    e.add_plane(m, -dot(m, position(a)), edge_length * edge_length * boundary_weight);
+                    quadrics[remap[a]] += e;
+                    quadrics[remap[b]] += e;
+                }
+            }
+        }
+
+        // Whether moving vertex from onto to would turn any remaining triangle around from over;
+        // collapse_remap accounts for the collapses already done in this pass
+        bool flips_triangles(std::uint32_t from, std::uint32_t to, std::vector<std::uint32_t> const & collapse_remap) const
+        {
+            vec3 const & p0 = position(from);
+            vec3 const & p1 = position(to);
+
+            std::uint32_t v = from;
+            do
+            {
+                for (auto const & e : adjacency[v])
+                {
+                    std::uint32_t const next = collapse_remap[e.next];
+                    std::uint32_t const prev = collapse_remap[e.prev];
+                    if (remap[next] == remap[to] || remap[prev] == remap[to] || remap[next] == remap[prev])
+                        continue;
+
+                    vec3 const & a = position(next);
+                    vec3 const & b = position(prev);
+                    if (dot(cross(a - p0, b - p0), cross(a - p1, b - p1)) <= 0.f)
+                        return true;
+                }
+                v = wedge[v];
+            }
+            while (v != from);
+
+            return false;
+        }
+
+        void pick_collapses(std::span<std::uint32_t const> indices, std::vector<collapse> & result) const
+        {
+            result.clear();
+
+            for (std::size_t t = 0; t + 2 < indices.size(); t += 3)
+                for (std::size_t k = 0; k < 3; ++k)
+                {
+                    std::uint32_t const i0 = indices[t + k];
+                    std::uint32_t const i1 = indices[t + (k + 1) % 3];
+
+                    vertex_kind const k0 = kind[i0];
+                    vertex_kind const k1 = kind[i1];
+
+                    bool const forward = can_collapse(k0, k1);
+                    bool const backward = can_collapse(k1, k0);
+                    if (!forward && !backward)
+                        continue;
+
+                    // Two border or seam vertices joined by an edge that isn't the boundary itself
+                    // belong to different loops (or cut across the mesh) and must stay apart
+                    if (k0 == k1 && (k0 == vertex_kind::border || k0 == vertex_kind::seam) && loop[i0] != i1)
+                        continue;
+
+                    // Closed edges show up once from each side, keep one of them
+                    if (forward && backward && k0 == vertex_kind::manifold && k1 == vertex_kind::manifold && remap[i0] > remap[i1])
+                        continue;
+
+                    collapse c{invalid, invalid, std::numeric_limits<float>::infinity()};
+                    if (forward)
+                        c = {i0, i1, quadrics[remap[i0]].error(position(i1))};
+                    if (backward)
+                    {
+                        float const error = quadrics[remap[i1]].error(position(i0));
+                        if (error < c.error)
+                            c = {i1, i0, error};
+                    }
+
+                    result.push_back(c);
+                }
+
+            std::sort(result.begin(), result.end(), [](collapse const & a, collapse const & b){ return a.error < b.error; });
+        }
+
+        // Performs the cheapest independent collapses of the sorted list, stopping once
+        // enough triangles are gone. Returns the number of collapses done.
+        std::size_t perform_collapses(std::vector<collapse> const & collapses, std::vector<std::uint32_t> & collapse_remap,
+            std::size_t triangle_goal, float & max_error)
+        {
+            std::vector<bool> collapse_locked(vertex_count, false);
+
+            // Collapses are picked from the cheaper part of the list only; the rest wait
+            // for the next pass, when their neighbourhood may have become cheaper
+            std::size_t const edge_goal = std::max<std::size_t>(triangle_goal / 2, 1);
+            float const error_limit = collapses[std::min(collapses.size() - 1, edge_goal)].error;
+
+            std::size_t triangles_removed = 0;
+            std::size_t count = 0;
+
+            for (auto const & c : collapses)
+            {
+                if (triangles_removed >= triangle_goal || c.error > error_limit)
+                    break;
+
+                std::uint32_t const r0 = remap[c.from];
+                std::uint32_t const r1 = remap[c.to];
+                if (collapse_locked[r0] || collapse_locked[r1])
+                    continue;
+
+                if (flips_triangles(c.from, c.to, collapse_remap))
+                    continue;
+
+                if (kind[c.from] == vertex_kind::seam)
+                {
+                    // Both sides of the seam move together
+                    collapse_remap[c.from] = c.to;
+                    collapse_remap[wedge[c.from]] = wedge[c.to];
+                }
+                else
+                {
+                    std::uint32_t v = c.from;
+                    do
+                    {
+                        collapse_remap[v] = c.to;
+                        v = wedge[v];
+                    }
+                    while (v != c.from);
+                }
+
+                quadrics[r1] += quadrics[r0];
+
+                collapse_locked[r0] = true;
+                collapse_locked[r1] = true;
+
+                triangles_removed += kind[c.from] == vertex_kind::border ? 1 : 2;
+                max_error = std::max(max_error, c.error);
+                ++count;
+            }
+
+            return count;
+        }
+
+        void remap_loops(std::vector<std::uint32_t> & l, std::vector<std::uint32_t> const & collapse_remap)
+        {
+            for (std::uint32_t v = 0; v < vertex_count; ++v)
+                if (l[v] != invalid)
+                {
+                    std::uint32_t const target = l[v];
+                    std::uint32_t const r = collapse_remap[target];
+                    // A seam collapsed against the loop direction points back at the vertex itself
+                    l[v] = r == v ? l[target] : r;
+                }
+        }
+    };
+
+}
+
+std::vector<std::uint32_t> simplify_mesh(std::span<obj_data::vertex const> vertices, std::span<std::uint32_t const> indices,
+    std::size_t target_index_count, float * error)
+{
+    std::vector<std::uint32_t> result(indices.begin(), indices.end());
+    float max_error = 0.f;
+
+    simplifier s;
+    s.vertices = vertices;
+    s.vertex_count = vertices.size();
+    s.build_position_remap();
+    s.adjacency.build(result, s.vertex_count);
+    s.classify_vertices();
+    s.build_quadrics(result);
+
+    std::vector<collapse> collapses;
+    std::vector<std::uint32_t> collapse_remap(s.vertex_count);
+
+    while (result.size() > target_index_count)
+    {
+        s.adjacency.build(result, s.vertex_count);
+        s.pick_collapses(result, collapses);
+        if (collapses.empty())
+            break;
+
+        for (std::uint32_t v = 0; v < s.vertex_count; ++v)
+            collapse_remap[v] = v;
+
+        std::size_t const triangle_goal = (result.size() - target_index_count + 2) / 3;
+        if (s.perform_collapses(collapses, collapse_remap, triangle_goal, max_error) == 0)
+            break;
+
+        // Apply the collapses and drop the triangles that became degenerate
+        std::size_t write = 0;
+        for (std::size_t t = 0; t + 2 < result.size(); t += 3)
+        {
+            std::uint32_t const a = collapse_remap[result[t]];
+            std::uint32_t const b = collapse_remap[result[t + 1]];
+            std::uint32_t const c = collapse_remap[result[t + 2]];
+            if (s.remap[a] == s.remap[b] || s.remap[b] == s.remap[c] || s.remap[c] == s.remap[a])
+                continue;
+
+            result[write++] = a;
+            result[write++] = b;
+            result[write++] = c;
+        }
+        result.resize(write);
+
+        s.remap_loops(s.loop, collapse_remap);
+        s.remap_loops(s.loopback, collapse_remap);
+    }
+
+    if (error)
+        *error = std::sqrt(max_error);
+
+    return result;
+}
+
+std::vector<mesh_lod> build_lod_chain(std::span<obj_data::vertex const> vertices, std::span<std::uint32_t const> indices,
+    std::span<float const> ratios)
+{
+    std::vector<mesh_lod> lods;
+    lods.push_back({std::vector<std::uint32_t>(indices.begin(), indices.end()), 0.f});
+
+    for (float ratio : ratios)
+    {
+        auto const & previous = lods.back();
+
+        std::size_t const target = static_cast<std::size_t>(indices.size() / 3 * ratio) * 3;
+
+        float error = 0.f;
+        mesh_lod lod;
+        lod.indices = simplify_mesh(vertices, previous.indices, target, &error);
+        lod.error = previous.error + error;
+
+        // Simplification scatters the triangle order, restore cache locality
+        optimize_vertex_cache(lod.indices, vertices.size());
+
+        lods.push_back(std::move(lod));
+    }
+
+    return lods;
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include "obj_parser.hpp"
+
+#include <span>
+#include <vector>
+
+// Reduces the triangle list to about target_index_count indices with quadric error
+// edge collapses (Garland & Heckbert). Collapses only move a vertex onto one of its
+// neighbours, so the result indexes the same vertex buffer. Open borders and attribute
+// seams (vertices sharing a position but not normal/texcoord) only collapse along
+// themselves, and vertices where they can't are kept in place.
+// If error is given, it receives the largest collapse error: an estimate of the
+// distance between the simplified and the original surface, in model units.
+std::vector<std::uint32_t> simplify_mesh(std::span<obj_data::vertex const> vertices, std::span<std::uint32_t const> indices,
+    std::size_t target_index_count, float * error = nullptr);
+
+struct mesh_lod
+{
+    std::vector<std::uint32_t> indices;
+    // Distance estimate to the full resolution surface, 0 for the first LOD
+    float error;
+};
+
+// LOD 0 is the original index buffer, LOD i + 1 keeps about ratios[i] of the original
+// triangles. Each LOD is simplified from the previous one, so errors add up along the chain.
+std::vector<mesh_lod> build_lod_chain(std::span<obj_data::vertex const> vertices, std::span<std::uint32_t const> indices,
+    std::span<float const> ratios);
@@ -0,0 +1,197 @@
+#include "mesh_welder.hpp"
+#include "index_hash_map.hpp"
+
+#include <cmath>
+#include <limits>
+#include <vector>
+#include <algorithm>
+
+namespace
+{
+
+    constexpr std::uint32_t invalid = std::numeric_limits<std::uint32_t>::max();
+    constexpr float infinity = std::numeric_limits<float>::infinity();
+
+    template <std::size_t N>
+    float distance_squared(std::array<float, N> const & a, std::array<float, N> const & b)
+    {
+        float sum = 0.f;
+        for (std::size_t k = 0; k < N; ++k)
+            sum += (a[k] - b[k]) * (a[k] - b[k]);
+        return sum;
+    }
+
+    // Cells are at least as large as the position tolerance, so every match of a vertex
+    // lies in one of the 27 cells around it
+    struct position_grid
+    {
+        std::array<float, 3> origin;
+        float cell_size;
+
+        index_hash_map::key_type cell(std::array<float, 3> const & p) const
+        {
+            index_hash_map::key_type key;
+            for (std::size_t k = 0; k < 3; ++k)
+                key[k] = static_cast<std::int32_t>(std::floor((p[k] - origin[k]) / cell_size));
+            return key;
+        }
+    };
+
+    position_grid make_grid(std::span<obj_data::vertex const> vertices, float tolerance)
+    {
+        std::array<float, 3> min{infinity, infinity, infinity};
+        std::array<float, 3> max{-infinity, -infinity, -infinity};
+        for (auto const & v : vertices)
+            for (std::size_t k = 0; k < 3; ++k)
+            {
+                min[k] = std::min(min[k], v.position[k]);
+                max[k] = std::max(max[k], v.position[k]);
+            }
+
+        float extent = 0.f;
+        for (std::size_t k = 0; k < 3; ++k)
+            extent = std::max(extent, max[k] - min[k]);
+
+        // Counting cells from the minimum corner keeps the coordinates non-negative, so they never
+        // look like index_hash_map's empty key; large meshes get larger cells to stay within int32
+        float cell_size = std::max(tolerance, extent / (1 << 30));
+        if (!(cell_size > 0.f))
+            cell_size = 1.f;
+
+        return {min, cell_size};
+    }
+
+}
+
+weld_stats weld_vertices(obj_data & mesh, weld_tolerance const & tolerance)
+{
+    std::size_t const vertex_count = mesh.vertices.size();
+
+    weld_stats stats{};
+    stats.vertices_before = vertex_count;
+
+    auto const grid = make_grid(mesh.vertices, tolerance.position);
+
+    float const position_limit = tolerance.position * tolerance.position;
+    float const normal_limit = tolerance.normal * tolerance.normal;
+    float const texcoord_limit = tolerance.texcoord * tolerance.texcoord;
+
+    auto within_tolerance = [&](obj_data::vertex const & a, obj_data::vertex const & b)
+    {
+        return distance_squared(a.position, b.position) <= position_limit
+            && distance_squared(a.normal, b.normal) <= normal_limit
+            && distance_squared(a.texcoord, b.texcoord) <= texcoord_limit;
+    };
+
+    // Kept vertices are linked into lists per grid cell: cell_head holds the latest vertex of
+    // each cell and cell_next the one kept before it in the same cell
+    index_hash_map cells(vertex_count);
+    std::vector<std::uint32_t> cell_head;
+    std::vector<std::uint32_t> cell_next(vertex_count, invalid);
+
+    std::vector<std::uint32_t> remap(vertex_count);
+    std::uint32_t kept_count = 0;
+
+    for (std::uint32_t v = 0; v < vertex_count; ++v)
+    {
+        auto const & vertex = mesh.vertices[v];
+        auto const center = grid.cell(vertex.position);
+
+        std::uint32_t match = invalid;
+        for (std::int32_t dz = -1; dz <= 1 && match == invalid; ++dz)
+            for (std::int32_t dy = -1; dy <= 1 && match == invalid; ++dy)
+                for (std::int32_t dx = -1; dx <= 1 && match == invalid; ++dx)
+                {
+                    auto const cell = cells.find({center[0] + dx, center[1] + dy, center[2] + dz});
+                    if (!cell) continue;
+
+                    for (std::uint32_t k = cell_head[*cell]; k != invalid; k = cell_next[k])
+                        if (within_tolerance(mesh.vertices[k], vertex))
+                        {
+                            match = k;
+                            break;
+                        }
+                }
+
+        if (match != invalid)
+        {
+            remap[v] = remap[match];
+            continue;
+        }
+
+        auto [cell, inserted] = cells.insert(center, cell_head.size());
+        if (inserted)
+            cell_head.push_back(invalid);
+        cell_next[v] = cell_head[cell];
+        cell_head[cell] = v;
+
+        remap[v] = kept_count++;
+    }
+
+    // Kept vertices are numbered in order, so they can be moved down in place: a vertex is
+    // kept exactly if its new id is the number of vertices kept before it
+    bool const has_tangents = mesh.tangents.size() == vertex_count;
+    for (std::uint32_t v = 0, write = 0; v < vertex_count; ++v)
+    {
+        if (remap[v] != write) continue;
+
+        mesh.vertices[write] = mesh.vertices[v];
+        if (has_tangents)
+            mesh.tangents[write] = mesh.tangents[v];
+        ++write;
+    }
+    mesh.vertices.resize(kept_count);
+    if (has_tangents)
+        mesh.tangents.resize(kept_count);
+
+    std::size_t index_write = 0;
+    auto weld_triangles = [&](std::size_t begin, std::size_t end)
+    {
+        for (std::size_t i = begin; i + 2 < end; i += 3)
+        {
+            std::uint32_t const a = remap[mesh.indices[i]];
+            std::uint32_t const b = remap[mesh.indices[i + 1]];
+            std::uint32_t const c = remap[mesh.indices[i + 2]];
+
+            if (a == b || b == c || c == a)
+                continue;
+
+            mesh.indices[index_write++] = a;
+            mesh.indices[index_write++] = b;
+            mesh.indices[index_write++] = c;
+        }
+    };
+
+    // Submeshes cover the indices in order, so compacting them one after another keeps them contiguous
+    if (mesh.submeshes.empty())
+        weld_triangles(0, mesh.indices.size());
+
+    for (auto & submesh : mesh.submeshes)
+    {
+        std::size_t const first_index = index_write;
+        weld_triangles(submesh.first_index, submesh.first_index + submesh.index_count);
+        submesh.first_index = first_index;
+        submesh.index_count = index_write - first_index;
+
+        // Welded positions may have moved by up to the tolerance
+        submesh.min = {infinity, infinity, infinity};
+        submesh.max = {-infinity, -infinity, -infinity};
+        for (std::size_t i = submesh.first_index; i < index_write; ++i)
+            for (std::size_t k = 0; k < 3; ++k)
+            {
+                submesh.min[k] = std::min(submesh.min[k], mesh.vertices[mesh.indices[i]].position[k]);
+                submesh.max[k] = std::max(submesh.max[k], mesh.vertices[mesh.indices[i]].position[k]);
+            }
+    }
+
+    std::erase_if(mesh.submeshes, [](obj_submesh const & submesh){ return submesh.index_count == 0; });
+
+    stats.triangles_removed = (mesh.indices.size() - index_write) / 3;
+    mesh.indices.resize(index_write);
+
+    stats.vertices_after = kept_count;
+    stats.bytes_saved = (stats.vertices_before - stats.vertices_after) * (sizeof(obj_data::vertex) + (has_tangents ? sizeof(mesh.tangents[0]) : 0))
+        + stats.triangles_removed * 3 * sizeof(std::uint32_t);
+
+    return stats;
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include "obj_parser.hpp"
+
+// Largest distances between attributes of vertices that are still merged
+struct weld_tolerance
+{
+    float position = 1e-5f;
+    float normal = 1e-3f;
+    float texcoord = 1e-5f;
+};
+
+struct weld_stats
+{
+    std::size_t vertices_before;
+    std::size_t vertices_after;
+    std::size_t triangles_removed;
+    // Vertex, tangent and index data no longer needed
+    std::size_t bytes_saved;
+};
+
+// Merges vertices whose positions, normals and texcoords are all within the tolerance,
+// which the parsers' exact index deduplication misses when a file repeats attributes
+// under different indices. Vertices are visited in order and snap to an earlier kept
+// vertex within tolerance, found through a hash grid over the positions; triangles that
+// collapse to a line or point are dropped. Submesh ranges and bounds are updated.
+weld_stats weld_vertices(obj_data & mesh, weld_tolerance const & tolerance = {});
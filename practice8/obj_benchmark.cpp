@@ -0,0 +1,160 @@
+// Measures OBJ parser throughput and memory use for every parse mode.
+// Arguments are OBJ files or triangle counts; for a count, a synthetic mesh of
+// about that size (see obj_generator.hpp) is written to the temporary directory
+// and removed afterwards. Without arguments, 10k and 1M triangle meshes are used.
+
+#include "obj_parser.hpp"
+#include "obj_generator.hpp"
+
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <charconv>
+#include <functional>
+#include <stdexcept>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+namespace
+{
+
+    using clock_type = std::chrono::high_resolution_clock;
+
+    // Where the OS allows it (Linux), resets the peak resident set size, so that each
+    // parser's peak is measured on its own; elsewhere the peak covers the whole process
+    void reset_peak_rss()
+    {
+#ifdef __linux__
+        std::ofstream("/proc/self/clear_refs") << "5";
+#endif
+    }
+
+    // In bytes
+    std::uint64_t peak_rss()
+    {
+#ifdef _WIN32
+        PROCESS_MEMORY_COUNTERS counters{};
+        GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters));
+        return counters.PeakWorkingSetSize;
+#else
+#ifdef __linux__
+        std::ifstream status("/proc/self/status");
+        for (std::string line; std::getline(status, line);)
+            if (line.rfind("VmHWM:", 0) == 0)
+                return std::stoull(line.substr(6)) * 1024;
+#endif
+        rusage usage{};
+        getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+        return usage.ru_maxrss;
+#else
+        return static_cast<std::uint64_t>(usage.ru_maxrss) * 1024;
+#endif
+#endif
+    }
+
+    struct parser
+    {
+        char const * name;
+        // Returns the number of indices, so the result can be checked and the work isn't optimized away
+        std::function<std::size_t(std::filesystem::path const &)> parse;
+    };
+
+    std::vector<parser> const parsers{
+        {"parse_obj", [](auto const & path){ return parse_obj(path).indices.size(); }},
+        {"parse_obj_mapped", [](auto const & path){ return parse_obj_mapped(path).indices.size(); }},
+        {"parse_obj_parallel", [](auto const & path){ return parse_obj_parallel(path).indices.size(); }},
+        {"parse_obj_streaming", [](auto const & path){
+            return parse_obj_streaming(path, 1 << 16, [](obj_batch const &){}).index_count;
+        }},
+    };
+
+    void benchmark(std::filesystem::path const & path, int repeats)
+    {
+        double const megabytes = std::filesystem::file_size(path) / (1024.0 * 1024.0);
+
+        std::size_t const index_count = parsers.front().parse(path);
+        double const triangles = index_count / 3.0;
+
+        std::cout << path.string() << ": " << std::fixed << std::setprecision(1) << megabytes << " MB, "
+            << static_cast<std::size_t>(triangles) << " triangles" << std::endl;
+
+        for (auto const & parser : parsers)
+        {
+            reset_peak_rss();
+
+            double best = 1e30;
+            for (int i = 0; i < repeats; ++i)
+            {
+                auto start = clock_type::now();
+                std::size_t const count = parser.parse(path);
+                best = std::min(best, std::chrono::duration<double>(clock_type::now() - start).count());
+
+                if (count != index_count)
+                    throw std::runtime_error(std::string(parser.name) + " returned a different number of indices");
+            }
+
+            std::cout << "  " << std::left << std::setw(20) << parser.name << std::right
+                << std::setw(10) << std::setprecision(1) << best * 1000.0 << " ms"
+                << std::setw(10) << megabytes / best << " MB/s"
+                << std::setw(10) << std::setprecision(2) << triangles / best * 1e-6 << " M triangles/s"
+                << std::setw(10) << std::setprecision(1) << peak_rss() / (1024.0 * 1024.0) << " MB peak RSS"
+                << std::endl;
+        }
+    }
+
+}
+
+int main(int argc, char ** argv)
+try
+{
+    std::vector<std::string> arguments(argv + 1, argv + argc);
+    if (arguments.empty())
+        arguments = {"10000", "1000000"};
+
+    int const repeats = 3;
+
+    for (auto const & argument : arguments)
+    {
+        std::size_t triangle_count = 0;
+        auto [end, error] = std::from_chars(argument.data(), argument.data() + argument.size(), triangle_count);
+        if (error != std::errc{} || end != argument.data() + argument.size())
+        {
+            benchmark(argument, repeats);
+            continue;
+        }
+
+        auto const path = std::filesystem::temp_directory_path() / ("synthetic_" + argument + ".obj");
+
+        auto start = clock_type::now();
+        auto stats = generate_obj(path, triangle_count);
+        std::cout << "Generated " << stats.triangle_count << " triangles (" << stats.face_count << " faces, "
+            << stats.vertex_count << " vertices) in " << std::chrono::duration<double>(clock_type::now() - start).count() << " s" << std::endl;
+
+        try
+        {
+            benchmark(path, repeats);
+        }
+        catch (...)
+        {
+            std::filesystem::remove(path);
+            throw;
+        }
+        std::filesystem::remove(path);
+    }
+}
+catch (std::exception const & e)
+{
+    std::cerr << e.what() << std::endl;
+    return EXIT_FAILURE;
+}
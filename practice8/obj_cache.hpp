@@ -0,0 +1,129 @@
+#pragma once
+
+#include "obj_parser.hpp"
+#include "mapped_file.hpp"
+
+#include <span>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <functional>
+#include <type_traits>
+
+// Final vertex and index arrays of an OBJ file. Usually they point straight into
+// a memory-mapped binary cache, so they can be handed to glBufferData as is.
+struct cached_obj
+{
+    std::span<obj_data::vertex const> vertices;
+    std::span<std::uint32_t const> indices;
+    // Empty unless the processing step produced tangents
+    std::span<std::array<float, 4> const> tangents;
+
+    // Index ranges and their materials, sorted by material like obj_data::submeshes
+    std::vector<obj_material> materials;
+    std::vector<obj_submesh> submeshes;
+
+    // Whatever obj_cache_processing::derive wrote, empty without it
+    std::span<char const> derived;
+
+    // Backing storage: the mapped cache, or the parsed data if the cache could not be written
+    mapped_file file;
+    obj_data data;
+    std::string derived_data;
+};
+
+// Appends trivially copyable values, strings and vectors of such values to a byte string
+struct cache_writer
+{
+    std::string bytes;
+
+    template <typename T>
+    void value(T const & v)
+    {
+        static_assert(std::is_trivially_copyable_v<T>);
+        bytes.append(reinterpret_cast<char const *>(&v), sizeof(v));
+    }
+
+    void string(std::string const & s)
+    {
+        value<std::uint64_t>(s.size());
+        bytes.append(s);
+    }
+
+    template <typename T>
+    void array(std::vector<T> const & values)
+    {
+        static_assert(std::is_trivially_copyable_v<T>);
+        value<std::uint64_t>(values.size());
+        bytes.append(reinterpret_cast<char const *>(values.data()), values.size() * sizeof(T));
+    }
+};
+
+// Bounds-checked counterpart of cache_writer; ok turns false on truncated data
+struct cache_reader
+{
+    char const * p;
+    char const * end;
+    bool ok = true;
+
+    template <typename T>
+    void value(T & v)
+    {
+        static_assert(std::is_trivially_copyable_v<T>);
+        if (static_cast<std::size_t>(end - p) < sizeof(v))
+        {
+            ok = false;
+            return;
+        }
+        std::memcpy(&v, p, sizeof(v));
+        p += sizeof(v);
+    }
+
+    void string(std::string & s)
+    {
+        std::uint64_t size = 0;
+        value(size);
+        if (!ok || static_cast<std::uint64_t>(end - p) < size)
+        {
+            ok = false;
+            return;
+        }
+        s.assign(p, size);
+        p += size;
+    }
+
+    template <typename T>
+    void array(std::vector<T> & values)
+    {
+        static_assert(std::is_trivially_copyable_v<T>);
+        std::uint64_t size = 0;
+        value(size);
+        if (!ok || static_cast<std::uint64_t>(end - p) / sizeof(T) < size)
+        {
+            ok = false;
+            return;
+        }
+        values.resize(size);
+        std::memcpy(values.data(), p, size * sizeof(T));
+        p += size * sizeof(T);
+    }
+};
+
+// Optional post-processing (e.g. mesh optimization) applied to freshly parsed data
+// before it is cached. The name becomes part of the cache key and file name, so
+// caches built with different processing don't replace each other.
+struct obj_cache_processing
+{
+    std::string name;
+    std::function<void(obj_data &)> process;
+    // Optional data computed once from the processed mesh (e.g. LODs or a packed vertex
+    // format) and stored in the cache with it; read it back from cached_obj::derived
+    std::function<void(obj_data const &, cache_writer &)> derive = {};
+};
+
+// Loads the OBJ file through a binary cache stored next to it (<path>[.<name>].meshcache).
+// The cache is keyed by the source path, size, modification time and content hash,
+// and is rebuilt whenever any of them changes. Rebuilding streams the mesh into the cache
+// in batches (parse_obj_streaming), so the full mesh is never held in memory unless
+// processing is requested.
+cached_obj load_obj_cached(std::filesystem::path const & path, obj_cache_processing const & processing = {});
@@ -0,0 +1,236 @@
+#include "obj_generator.hpp"
+
+#include <cmath>
+#include <string>
+#include <string_view>
+#include <fstream>
+#include <charconv>
+#include <stdexcept>
+#include <algorithm>
+#include <initializer_list>
+
+namespace
+{
+
+    // Buffers the output and writes it in large blocks
+    struct obj_writer
+    {
+        std::ofstream out;
+        std::string buffer;
+        std::uint64_t size = 0;
+
+        explicit obj_writer(std::filesystem::path const & path)
+            : out(path, std::ios::binary | std::ios::trunc)
+        {
+            if (!out)
+                throw std::runtime_error("Failed to create " + path.string());
+            buffer.reserve(block_size + 256);
+        }
+
+        static constexpr std::size_t block_size = 1 << 20;
+
+        void text(std::string_view s)
+        {
+            buffer.append(s);
+        }
+
+        // Six decimals, the way most exporters write attributes
+        void number(float value)
+        {
+            char chars[32];
+            auto result = std::to_chars(chars, chars + sizeof(chars), value, std::chars_format::fixed, 6);
+            buffer.append(chars, result.ptr);
+        }
+
+        void number(std::int64_t value)
+        {
+            char chars[24];
+            auto result = std::to_chars(chars, chars + sizeof(chars), value);
+            buffer.append(chars, result.ptr);
+        }
+
+        void end_line()
+        {
+            buffer.push_back('\n');
+            if (buffer.size() >= block_size)
+                flush();
+        }
+
+        void flush()
+        {
+            out.write(buffer.data(), buffer.size());
+            size += buffer.size();
+            buffer.clear();
+        }
+    };
+
+    enum face_format
+    {
+        position_only,
+        position_texcoord,
+        position_normal,
+        position_texcoord_normal,
+    };
+
+    enum face_shape
+    {
+        triangles,
+        quad,
+        // Covers two cells; the vertex between their bottom corners is skipped
+        pentagon,
+    };
+
+}
+
+obj_generator_stats generate_obj(std::filesystem::path const & path, std::size_t triangle_count)
+{
+    // Triangles, quads and pentagons give 2, 2 and 1.5 triangles per cell
+    double const cell_count = triangle_count / (5.5 / 3.0);
+    std::size_t const columns = std::max<std::size_t>(2, static_cast<std::size_t>(std::sqrt(cell_count)) / 2 * 2);
+    std::size_t const rows = std::max<std::size_t>(1, static_cast<std::size_t>(std::ceil(cell_count / columns)));
+
+    std::size_t const row_vertices = columns + 1;
+    std::size_t const vertex_count = row_vertices * (rows + 1);
+
+    obj_writer writer(path);
+    obj_generator_stats stats{vertex_count, 0, 0, 0};
+
+    writer.text("# synthetic OBJ, ");
+    writer.number(static_cast<std::int64_t>(columns));
+    writer.text(" x ");
+    writer.number(static_cast<std::int64_t>(rows));
+    writer.text(" cells");
+    writer.end_line();
+
+    auto height = [](float x, float y)
+    {
+        return 0.05f * std::sin(x * 20.f) * std::cos(y * 20.f);
+    };
+
+    std::size_t emitted_vertices = 0;
+
+    auto vertex_row = [&](std::size_t y)
+    {
+        for (std::size_t x = 0; x < row_vertices; ++x)
+        {
+            float const u = static_cast<float>(x) / columns;
+            float const v = static_cast<float>(y) / rows;
+
+            writer.text("v ");
+            writer.number(u);
+            writer.text(" ");
+            writer.number(v);
+            writer.text(" ");
+            writer.number(height(u, v));
+            writer.end_line();
+
+            writer.text("vt ");
+            writer.number(u);
+            writer.text(" ");
+            writer.number(v);
+            writer.end_line();
+
+            float const dx = std::cos(u * 20.f) * std::cos(v * 20.f);
+            float const dy = -std::sin(u * 20.f) * std::sin(v * 20.f);
+            float const length = std::sqrt(dx * dx + dy * dy + 1.f);
+            writer.text("vn ");
+            writer.number(-dx / length);
+            writer.text(" ");
+            writer.number(-dy / length);
+            writer.text(" ");
+            writer.number(1.f / length);
+            writer.end_line();
+        }
+
+        emitted_vertices += row_vertices;
+    };
+
+    // Attribute i is the i-th of its kind, so all three indices of a corner are equal.
+    // Relative indices count back from the last attribute written so far.
+    auto corner = [&](std::size_t vertex, face_format format, bool relative)
+    {
+        std::int64_t const index = relative ? static_cast<std::int64_t>(vertex) - static_cast<std::int64_t>(emitted_vertices)
+            : static_cast<std::int64_t>(vertex) + 1;
+
+        writer.text(" ");
+        writer.number(index);
+        if (format == position_texcoord || format == position_texcoord_normal)
+        {
+            writer.text("/");
+            writer.number(index);
+        }
+        if (format == position_normal)
+            writer.text("/");
+        if (format == position_normal || format == position_texcoord_normal)
+        {
+            writer.text("/");
+            writer.number(index);
+        }
+    };
+
+    auto face = [&](std::initializer_list<std::size_t> vertices, face_format format, bool relative)
+    {
+        writer.text("f");
+        for (auto v : vertices)
+            corner(v, format, relative);
+        writer.end_line();
+
+        ++stats.face_count;
+        stats.triangle_count += vertices.size() - 2;
+    };
+
+    auto name_line = [&](std::string_view tag, std::string_view name, std::size_t number)
+    {
+        writer.text(tag);
+        writer.text(" ");
+        writer.text(name);
+        writer.number(static_cast<std::int64_t>(number));
+        writer.end_line();
+    };
+
+    vertex_row(0);
+
+    for (std::size_t y = 0; y < rows; ++y)
+    {
+        // Each face row follows the vertex row it closes, so attributes and faces interleave
+        vertex_row(y + 1);
+
+        // Two objects, a group every 5 rows and a material every 7, so that group and
+        // material changes fall on different rows and every material is used by several groups
+        if (y == 0 || y == rows / 2)
+            name_line("o", "grid", (y == 0) ? 0 : 1);
+        if (y % 5 == 0)
+            name_line("g", "band", y / 5);
+        if (y % 7 == 0)
+            name_line("usemtl", "material", (y / 7) % 3);
+
+        auto const format = static_cast<face_format>(y % 4);
+        auto const shape = static_cast<face_shape>(y % 3);
+        bool const relative = (y / 12) % 2 == 1;
+
+        for (std::size_t x = 0; x < columns; x += (shape == pentagon) ? 2 : 1)
+        {
+            std::size_t const v00 = y * row_vertices + x;
+            std::size_t const v10 = v00 + 1;
+            std::size_t const v01 = v00 + row_vertices;
+            std::size_t const v11 = v01 + 1;
+
+            if (shape == triangles)
+            {
+                face({v00, v10, v11}, format, relative);
+                face({v00, v11, v01}, format, relative);
+            }
+            else if (shape == quad)
+                face({v00, v10, v11, v01}, format, relative);
+            else
+                face({v00, v10 + 1, v11 + 1, v11, v01}, format, relative);
+        }
+    }
+
+    writer.flush();
+    if (!writer.out)
+        throw std::runtime_error("Failed to write " + path.string());
+
+    stats.file_size = writer.size;
+    return stats;
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <filesystem>
+#include <cstdint>
+
+struct obj_generator_stats
+{
+    std::size_t vertex_count;
+    std::size_t face_count;
+    // After triangulation
+    std::size_t triangle_count;
+    std::uint64_t file_size;
+};
+
+// Writes a synthetic OBJ file with about triangle_count triangles: a wavy height field
+// grid with a position, texcoord and normal per grid point. Each row of faces follows the
+// row of attributes it completes. Face rows cycle through the v, v/t, v//n and v/t/n formats
+// and through triangles, quads and pentagons spanning two cells; every other block of 12 rows
+// uses negative indices, relative to the attributes written so far. The rows are split into
+// two objects, groups and three materials (usemtl without an mtllib, so they keep the
+// defaults), so all combinations appear in any file of more than a few thousand triangles.
+obj_generator_stats generate_obj(std::filesystem::path const & path, std::size_t triangle_count);
@@ -0,0 +1,192 @@
+// Checks that fast_number parses every number of the OBJ files in the repository
+// (or the OBJ files given on the command line) exactly like the "C" locale stream
+// extraction the original parser used: same success, same value bits (also the value
+// stored on failure) and same number of characters consumed. Exits with a non-zero
+// status on any mismatch.
+
+#include "fast_number.hpp"
+#include "mapped_file.hpp"
+
+#include <iostream>
+#include <sstream>
+#include <locale>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstring>
+#include <algorithm>
+#include <filesystem>
+#include <stdexcept>
+
+namespace
+{
+
+    struct conformance
+    {
+        std::size_t checked = 0;
+        std::size_t mismatches = 0;
+
+        // Only the first few mismatches are printed
+        static constexpr std::size_t max_reports = 20;
+
+        template <typename T>
+        void check(std::string_view token, std::filesystem::path const & path, std::size_t line)
+        {
+            ++checked;
+
+            char const * end = token.data() + token.size();
+
+            T fast{};
+            char const * fast_end = token.data();
+            bool const fast_ok = fast_number::parse(fast_end, end, fast);
+
+            std::istringstream stream{std::string(token)};
+            stream.imbue(std::locale::classic());
+            T streamed{};
+            bool const stream_ok = static_cast<bool>(stream >> streamed);
+            // tellg fails once the stream hit the end of the token
+            std::streamoff const stream_length = stream_ok && stream.tellg() >= 0 ? static_cast<std::streamoff>(stream.tellg())
+                : static_cast<std::streamoff>(token.size());
+
+            bool match = (fast_ok == stream_ok) && std::memcmp(&fast, &streamed, sizeof(T)) == 0;
+            if (match && fast_ok)
+                match = (fast_end - token.data()) == stream_length;
+
+            if (match)
+                return;
+
+            if (mismatches++ < max_reports)
+            {
+                std::cerr.precision(9);
+                std::cerr << path.string() << ":" << line << ": \"" << token << "\": fast_number "
+                    << (fast_ok ? "" : "failed, ") << fast << " (" << (fast_end - token.data()) << " chars), stream "
+                    << (stream_ok ? "" : "failed, ") << streamed << " (" << stream_length << " chars)" << std::endl;
+            }
+        }
+
+        // Attribute values of v/vn/vt lines and the indices of f lines; other lines are skipped
+        void check_file(std::filesystem::path const & path)
+        {
+            mapped_file file(path);
+            std::string_view const text(file.data(), file.size());
+
+            std::size_t line_number = 0;
+            std::size_t position = 0;
+            while (position < text.size())
+            {
+                std::size_t line_end = text.find('\n', position);
+                if (line_end == std::string_view::npos)
+                    line_end = text.size();
+
+                auto line = text.substr(position, line_end - position);
+                position = line_end + 1;
+                ++line_number;
+
+                std::vector<std::string_view> tokens;
+                std::size_t i = 0;
+                while (true)
+                {
+                    i = line.find_first_not_of(" \t\r", i);
+                    if (i == std::string_view::npos)
+                        break;
+                    std::size_t j = std::min(line.find_first_of(" \t\r", i), line.size());
+                    tokens.push_back(line.substr(i, j - i));
+                    i = j;
+                }
+
+                if (tokens.empty())
+                    continue;
+
+                if (tokens[0] == "v" || tokens[0] == "vn" || tokens[0] == "vt")
+                {
+                    for (std::size_t t = 1; t < tokens.size(); ++t)
+                        check<float>(tokens[t], path, line_number);
+                }
+                else if (tokens[0] == "f")
+                {
+                    for (std::size_t t = 1; t < tokens.size(); ++t)
+                    {
+                        auto corner = tokens[t];
+                        while (!corner.empty())
+                        {
+                            std::size_t slash = std::min(corner.find('/'), corner.size());
+                            if (slash > 0)
+                                check<std::int32_t>(corner.substr(0, slash), path, line_number);
+                            corner.remove_prefix(std::min(slash + 1, corner.size()));
+                        }
+                    }
+                }
+            }
+        }
+    };
+
+    // Forms the fast paths treat specially, and forms where std::from_chars differs from
+    // streams, which the repository meshes may not contain. A leading '+' is left out: the
+    // OBJ tokenizer skips it before calling fast_number, as streams do.
+    std::vector<std::string> const edge_cases{
+        "0", "-0", "0.0", "-0.0", ".5", "-.5", "5.", "1e3", "1E-3", "-2.5e+2",
+        "16777216", "16777217", "0.16777217", "123456789.0", "1234567890123456789",
+        "0.0000000001", "0.00000000001", "3.4028235e38", "1e-45", "0.1", "0.3", "0.7",
+        "2147483647", "-2147483648", "2147483648", "-2147483649", "99999999999999999999",
+        "999999999", "1000000000", "-", "abc",
+        "nan", "-nan", "inf", "-inf", "infinity", "1e", "1e+", "1E-", "1.5e", "2e3x", "1ex",
+        "0x10", "1e400", "-1e400", "1e-50", "-1e-50", "8e-46", "1e-400", "-1e-400",
+    };
+
+    void collect_obj_files(std::filesystem::path const & root, std::vector<std::filesystem::path> & paths)
+    {
+        std::filesystem::recursive_directory_iterator it(root), end;
+        for (; it != end; ++it)
+        {
+            auto const & path = it->path();
+            auto const name = path.filename().string();
+            // Build directories may contain generated meshes; skip them and hidden directories
+            if (it->is_directory() && (name.starts_with("_") || name.starts_with(".")))
+                it.disable_recursion_pending();
+            else if (it->is_regular_file() && path.extension() == ".obj")
+                paths.push_back(path);
+        }
+        std::sort(paths.begin(), paths.end());
+    }
+
+}
+
+int main(int argc, char ** argv)
+try
+{
+    std::vector<std::filesystem::path> paths;
+    for (int i = 1; i < argc; ++i)
+        paths.push_back(argv[i]);
+
+    // Every practice keeps its meshes next to its sources
+    if (paths.empty())
+        collect_obj_files(std::filesystem::path(PROJECT_ROOT).parent_path(), paths);
+
+    if (paths.empty())
+        throw std::runtime_error("no OBJ files found");
+
+    conformance result;
+
+    for (auto const & token : edge_cases)
+    {
+        result.check<float>(token, "<edge cases>", 0);
+        result.check<std::int32_t>(token, "<edge cases>", 0);
+    }
+
+    for (auto const & path : paths)
+    {
+        std::size_t const checked = result.checked;
+        std::size_t const mismatches = result.mismatches;
+        result.check_file(path);
+        std::cout << path.string() << ": " << (result.checked - checked) << " numbers, "
+            << (result.mismatches - mismatches) << " mismatches" << std::endl;
+    }
+
+    std::cout << result.checked << " numbers checked, " << result.mismatches << " mismatches" << std::endl;
+    return (result.mismatches == 0) ? 0 : 1;
+}
+catch (std::exception const & e)
+{
+    std::cerr << e.what() << std::endl;
+    return 1;
+}
@@ -26,7 +26,7 @@
 #include <glm/ext/scalar_constants.hpp>
 #include <glm/gtx/string_cast.hpp>
 
-#include "obj_parser.hpp"
+#include "obj_cache.hpp"
 
 std::string to_string(std::string_view str)
 {
@@ -68,6 +68,7 @@ const char fragment_shader_source[] =
 R"(#version 330 core
 
 uniform vec3 ambient;
+uniform vec3 albedo;
 
 uniform vec3 light_direction;
 uniform vec3 light_color;
@@ -92,8 +93,6 @@ void main()
     if (in_shadow_texture)
         shadow_factor = (texture(shadow_map, shadow_pos.xy).r < shadow_pos.z) ? 0.0 : 1.0;
 
-    vec3 albedo = vec3(1.0, 1.0, 1.0);
-
     vec3 light = ambient;
     light += light_color * max(0.0, dot(normal, light_direction)) * shadow_factor;
     vec3 color = albedo * light;
@@ -245,6 +244,7 @@ int main() try
     GLuint transform_location = glGetUniformLocation(program, "transform");
 
     GLuint ambient_location = glGetUniformLocation(program, "ambient");
+    GLuint albedo_location = glGetUniformLocation(program, "albedo");
     GLuint light_direction_location = glGetUniformLocation(program, "light_direction");
     GLuint light_color_location = glGetUniformLocation(program, "light_color");
 
@@ -271,7 +271,32 @@ int main() try
 
     std::string project_root = PROJECT_ROOT;
     std::string scene_path = project_root + "/bunny.obj";
-    obj_data scene = parse_obj(scene_path);
+    auto scene = load_obj_cached(scene_path);
+
+    // The indices are sorted by material, so all submeshes of a material are drawn at once
+    struct draw_range
+    {
+        std::uint32_t material;
+        std::uint32_t first_index;
+        std::uint32_t index_count;
+    };
+
+    std::vector<draw_range> draws;
+    for (auto const & submesh : scene.submeshes)
+    {
+        if (!draws.empty() && draws.back().material == submesh.material)
+            draws.back().index_count += submesh.index_count;
+        else
+            draws.push_back({submesh.material, submesh.first_index, submesh.index_count});
+    }
+
+    auto albedo = [&](std::uint32_t material)
+    {
+        if (material == obj_no_material)
+            return glm::vec3(1.f);
+        auto const & diffuse = scene.materials[material].diffuse;
+        return glm::vec3(diffuse[0], diffuse[1], diffuse[2]);
+    };
 
     GLuint vao, vbo, ebo;
     glGenVertexArrays(1, &vao);
@@ -443,7 +468,12 @@ int main() try
         glUniform3f(light_color_location, 0.8f, 0.8f, 0.8f);
 
         glBindVertexArray(vao);
-        glDrawElements(GL_TRIANGLES, scene.indices.size(), GL_UNSIGNED_INT, nullptr);
+        for (auto const & draw : draws)
+        {
+            glm::vec3 color = albedo(draw.material);
+            glUniform3fv(albedo_location, 1, reinterpret_cast<float *>(&color));
+            glDrawElements(GL_TRIANGLES, draw.index_count, GL_UNSIGNED_INT, reinterpret_cast<void *>(draw.first_index * sizeof(std::uint32_t)));
+        }
 
         glUseProgram(debug_program);
         glBindTexture(GL_TEXTURE_2D, shadow_map);
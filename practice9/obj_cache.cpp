@@ -0,0 +1,443 @@
+#include "obj_cache.hpp"
+
+#include <fstream>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+namespace
+{
+
+    constexpr char cache_magic[8] = {'O', 'B', 'J', 'C', 'A', 'C', 'H', 'E'};
+    constexpr std::uint32_t cache_version = 4;
+
+    // Vertex, index, tangent, table and derived sections start at multiples of this
+    constexpr std::uint64_t cache_alignment = 64;
+
+    struct cache_header
+    {
+        char magic[8];
+        std::uint32_t version;
+        std::uint32_t vertex_size;
+
+        std::uint64_t source_size;
+        std::int64_t source_mtime;
+        std::uint64_t source_hash;
+
+        std::uint64_t path_length;
+
+        std::uint64_t vertex_count;
+        std::uint64_t vertex_offset;
+        std::uint64_t index_count;
+        std::uint64_t index_offset;
+        std::uint64_t tangent_count;
+        std::uint64_t tangent_offset;
+        // Materials and submeshes, see write_table
+        std::uint64_t table_size;
+        std::uint64_t table_offset;
+        // Output of obj_cache_processing::derive
+        std::uint64_t derived_size;
+        std::uint64_t derived_offset;
+    };
+
+    using tangent = std::array<float, 4>;
+
+    std::uint64_t align(std::uint64_t offset)
+    {
+        return (offset + cache_alignment - 1) / cache_alignment * cache_alignment;
+    }
+
+    // 64-bit multiplicative hash processing 8 bytes at a time; only used to detect changes
+    std::uint64_t hash_bytes(char const * data, std::size_t size)
+    {
+        constexpr std::uint64_t multiplier = 0x9E3779B97F4A7C15ull;
+
+        std::uint64_t h = size * multiplier;
+
+        std::size_t i = 0;
+        for (; i + 8 <= size; i += 8)
+        {
+            std::uint64_t word;
+            std::memcpy(&word, data + i, 8);
+            h = (h ^ word) * multiplier;
+            h ^= h >> 32;
+        }
+
+        std::uint64_t tail = 0;
+        if (i < size)
+            std::memcpy(&tail, data + i, size - i);
+        h = (h ^ tail) * multiplier;
+        h ^= h >> 29;
+
+        return h;
+    }
+
+    struct source_key
+    {
+        // Absolute source path, followed by the processing name if there is one
+        std::string path;
+        std::uint64_t size;
+        std::int64_t mtime;
+    };
+
+    bool header_matches(cache_header const & header, mapped_file const & cache, source_key const & key)
+    {
+        if (cache.size() < sizeof(cache_header)) return false;
+        if (std::memcmp(header.magic, cache_magic, sizeof(cache_magic)) != 0) return false;
+        if (header.version != cache_version) return false;
+        if (header.vertex_size != sizeof(obj_data::vertex)) return false;
+        if (header.source_size != key.size) return false;
+        if (header.source_mtime != key.mtime) return false;
+        if (header.path_length != key.path.size()) return false;
+        if (sizeof(cache_header) + header.path_length > cache.size()) return false;
+        if (std::memcmp(cache.data() + sizeof(cache_header), key.path.data(), key.path.size()) != 0) return false;
+        if (header.vertex_offset + header.vertex_count * sizeof(obj_data::vertex) > cache.size()) return false;
+        if (header.index_offset + header.index_count * sizeof(std::uint32_t) > cache.size()) return false;
+        if (header.tangent_count != 0 && header.tangent_count != header.vertex_count) return false;
+        if (header.tangent_offset + header.tangent_count * sizeof(tangent) > cache.size()) return false;
+        if (header.table_offset + header.table_size > cache.size()) return false;
+        if (header.derived_offset + header.derived_size > cache.size()) return false;
+        return true;
+    }
+
+    // Visits every field of the materials and submeshes, for reading and writing alike
+    template <typename Table, typename Materials, typename Submeshes>
+    void visit_table(Table & table, Materials & materials, Submeshes & submeshes)
+    {
+        for (auto & material : materials)
+        {
+            table.string(material.name);
+            table.value(material.ambient);
+            table.value(material.diffuse);
+            table.value(material.specular);
+            table.value(material.shininess);
+            table.value(material.opacity);
+            table.string(material.diffuse_texture);
+            table.string(material.normal_texture);
+        }
+
+        for (auto & submesh : submeshes)
+        {
+            table.string(submesh.object);
+            table.string(submesh.group);
+            table.value(submesh.material);
+            table.value(submesh.first_index);
+            table.value(submesh.index_count);
+            table.value(submesh.min);
+            table.value(submesh.max);
+        }
+    }
+
+    std::string write_table(std::vector<obj_material> const & materials, std::vector<obj_submesh> const & submeshes)
+    {
+        cache_writer table;
+        table.value<std::uint64_t>(materials.size());
+        table.value<std::uint64_t>(submeshes.size());
+        visit_table(table, materials, submeshes);
+        return std::move(table.bytes);
+    }
+
+    bool read_table(char const * data, std::size_t size, std::vector<obj_material> & materials, std::vector<obj_submesh> & submeshes)
+    {
+        cache_reader table{data, data + size};
+
+        std::uint64_t material_count = 0;
+        std::uint64_t submesh_count = 0;
+        table.value(material_count);
+        table.value(submesh_count);
+
+        // Every entry takes at least a few bytes, which bounds the counts before allocating
+        if (!table.ok || material_count > size || submesh_count > size)
+            return false;
+
+        materials.resize(material_count);
+        submeshes.resize(submesh_count);
+        visit_table(table, materials, submeshes);
+        return table.ok;
+    }
+
+    // Output vertices and indices handed to the writer at a time
+    constexpr std::size_t cache_batch_size = 1 << 16;
+
+    using mesh_producer = std::function<obj_stream_stats(obj_batch_consumer const &)>;
+
+    // Streams the mesh batches into the cache: vertices go straight into the cache file,
+    // indices and tangents into side files that are appended at the end, so the whole mesh
+    // needn't be held in memory. The index runs of the batches are appended grouped by
+    // material, which orders the indices like parse_obj does. Returns false if the cache
+    // could not be written.
+    bool write_cache(mesh_producer const & produce, std::string const & derived, std::filesystem::path const & cache_path,
+        source_key const & key, std::uint64_t source_hash)
+    {
+        cache_header header{};
+        std::memcpy(header.magic, cache_magic, sizeof(cache_magic));
+        header.version = cache_version;
+        header.vertex_size = sizeof(obj_data::vertex);
+        header.source_size = key.size;
+        header.source_mtime = key.mtime;
+        header.source_hash = source_hash;
+        header.path_length = key.path.size();
+        header.vertex_offset = align(sizeof(cache_header) + key.path.size());
+
+        // Write to temporary files and rename the result, so that a concurrent or
+        // interrupted run never sees a partially written cache
+        auto temp_path = cache_path;
+        temp_path += ".tmp";
+        auto index_path = cache_path;
+        index_path += ".indices.tmp";
+        auto tangent_path = cache_path;
+        tangent_path += ".tangents.tmp";
+
+        auto cleanup = [&]
+        {
+            std::error_code ec;
+            std::filesystem::remove(temp_path, ec);
+            std::filesystem::remove(index_path, ec);
+            std::filesystem::remove(tangent_path, ec);
+            return false;
+        };
+
+        // The streams are closed during unwinding, before the temporary files are removed
+        try
+        {
+            std::ofstream out(temp_path, std::ios::binary | std::ios::trunc);
+            std::ofstream index_out(index_path, std::ios::binary | std::ios::trunc);
+            std::ofstream tangent_out(tangent_path, std::ios::binary | std::ios::trunc);
+            if (!out || !index_out || !tangent_out)
+                return cleanup();
+
+            char const padding[cache_alignment] = {};
+            auto pad_to = [&](std::uint64_t offset)
+            {
+                out.write(padding, offset - static_cast<std::uint64_t>(out.tellp()));
+            };
+
+            out.write(reinterpret_cast<char const *>(&header), sizeof(header));
+            out.write(key.path.data(), key.path.size());
+            pad_to(header.vertex_offset);
+
+            std::uint64_t tangent_count = 0;
+
+            struct index_run
+            {
+                std::uint32_t material;
+                std::uint64_t offset;
+                std::uint64_t size;
+            };
+            std::vector<index_run> index_runs;
+            std::uint64_t index_bytes = 0;
+
+            auto stats = produce([&](obj_batch const & batch)
+            {
+                out.write(reinterpret_cast<char const *>(batch.vertices.data()), batch.vertices.size_bytes());
+                index_out.write(reinterpret_cast<char const *>(batch.indices.data()), batch.indices.size_bytes());
+                if (!batch.indices.empty())
+                    index_runs.push_back({batch.material, index_bytes, batch.indices.size_bytes()});
+                index_bytes += batch.indices.size_bytes();
+                tangent_out.write(reinterpret_cast<char const *>(batch.tangents.data()), batch.tangents.size_bytes());
+                tangent_count += batch.tangents.size();
+            });
+
+            if (!index_out || !tangent_out)
+                return cleanup();
+            index_out.close();
+            tangent_out.close();
+
+            std::vector<char> block(1 << 20);
+            auto append = [&](std::ifstream & in, std::uint64_t size)
+            {
+                while (size > 0 && in.read(block.data(), std::min<std::uint64_t>(size, block.size())))
+                {
+                    out.write(block.data(), in.gcount());
+                    size -= in.gcount();
+                }
+            };
+
+            header.vertex_count = stats.vertex_count;
+            header.index_count = stats.index_count;
+            header.index_offset = align(header.vertex_offset + stats.vertex_count * sizeof(obj_data::vertex));
+            pad_to(header.index_offset);
+            {
+                std::stable_sort(index_runs.begin(), index_runs.end(), [](index_run const & a, index_run const & b){
+                    return a.material < b.material;
+                });
+
+                std::ifstream in(index_path, std::ios::binary);
+                for (auto const & run : index_runs)
+                {
+                    in.seekg(run.offset);
+                    append(in, run.size);
+                }
+            }
+
+            header.tangent_count = tangent_count;
+            header.tangent_offset = align(header.index_offset + stats.index_count * sizeof(std::uint32_t));
+            pad_to(header.tangent_offset);
+            {
+                std::ifstream in(tangent_path, std::ios::binary);
+                append(in, tangent_count * sizeof(tangent));
+            }
+
+            // The runs were moved the same way, so the submeshes get the same stable order
+            std::stable_sort(stats.submeshes.begin(), stats.submeshes.end(), [](obj_submesh const & a, obj_submesh const & b){
+                return a.material < b.material;
+            });
+            std::uint32_t first_index = 0;
+            for (auto & submesh : stats.submeshes)
+            {
+                submesh.first_index = first_index;
+                first_index += submesh.index_count;
+            }
+
+            auto const table = write_table(stats.materials, stats.submeshes);
+            header.table_size = table.size();
+            header.table_offset = align(header.tangent_offset + tangent_count * sizeof(tangent));
+            pad_to(header.table_offset);
+            out.write(table.data(), table.size());
+
+            // Written after the whole mesh was produced, since producing it computes the derived data
+            header.derived_size = derived.size();
+            header.derived_offset = align(header.table_offset + header.table_size);
+            pad_to(header.derived_offset);
+            out.write(derived.data(), derived.size());
+
+            out.seekp(0);
+            out.write(reinterpret_cast<char const *>(&header), sizeof(header));
+
+            if (!out || static_cast<std::uint64_t>(out.seekp(0, std::ios::end).tellp()) != header.derived_offset + header.derived_size)
+                return cleanup();
+        }
+        catch (...)
+        {
+            cleanup();
+            throw;
+        }
+
+        std::error_code ec;
+        std::filesystem::remove(index_path, ec);
+        std::filesystem::remove(tangent_path, ec);
+        std::filesystem::rename(temp_path, cache_path, ec);
+        if (ec)
+            return cleanup();
+
+        return true;
+    }
+
+}
+
+cached_obj load_obj_cached(std::filesystem::path const & path, obj_cache_processing const & processing)
+{
+    auto cache_path = path;
+    if (!processing.name.empty())
+        cache_path += "." + processing.name;
+    cache_path += ".meshcache";
+
+    source_key key;
+    key.path = std::filesystem::absolute(path).string();
+    if (!processing.name.empty())
+        key.path += "#" + processing.name;
+    key.size = std::filesystem::file_size(path);
+    key.mtime = std::filesystem::last_write_time(path).time_since_epoch().count();
+
+    cached_obj result;
+
+    // The content hash is only computed when the cheap checks pass (or the cache is rebuilt)
+    std::uint64_t source_hash = 0;
+    bool source_hashed = false;
+
+    auto hash_source = [&]
+    {
+        if (!source_hashed)
+        {
+            mapped_file source(path);
+            source_hash = hash_bytes(source.data(), source.size());
+            source_hashed = true;
+        }
+        return source_hash;
+    };
+
+    auto try_cache = [&]
+    {
+        std::error_code ec;
+        if (!std::filesystem::exists(cache_path, ec))
+            return false;
+
+        mapped_file cache(cache_path);
+
+        cache_header header{};
+        if (cache.size() >= sizeof(header))
+            std::memcpy(&header, cache.data(), sizeof(header));
+
+        if (!header_matches(header, cache, key) || header.source_hash != hash_source())
+            return false;
+
+        if (!read_table(cache.data() + header.table_offset, header.table_size, result.materials, result.submeshes))
+            return false;
+
+        result.vertices = {reinterpret_cast<obj_data::vertex const *>(cache.data() + header.vertex_offset), header.vertex_count};
+        result.indices = {reinterpret_cast<std::uint32_t const *>(cache.data() + header.index_offset), header.index_count};
+        result.tangents = {reinterpret_cast<tangent const *>(cache.data() + header.tangent_offset), header.tangent_count};
+        result.derived = {cache.data() + header.derived_offset, header.derived_size};
+        result.file = std::move(cache);
+        return true;
+    };
+
+    if (try_cache())
+        return result;
+
+    auto derive = [&](obj_data const & data)
+    {
+        cache_writer writer;
+        if (processing.derive)
+            processing.derive(data, writer);
+        return std::move(writer.bytes);
+    };
+
+    std::string derived;
+
+    mesh_producer produce;
+    if (processing.process || processing.derive)
+    {
+        // Processing needs the whole mesh at once
+        produce = [&](obj_batch_consumer const & consumer)
+        {
+            obj_data data = parse_obj_parallel(path);
+            if (processing.process)
+                processing.process(data);
+            // Submeshes are already sorted by material, so these are the final indices
+            derived = derive(data);
+
+            // One batch per submesh, so the writer keeps the material order
+            consumer(obj_batch{0, data.vertices, {}, data.tangents});
+            for (auto const & submesh : data.submeshes)
+                consumer(obj_batch{static_cast<std::uint32_t>(data.vertices.size()), {},
+                    std::span(data.indices).subspan(submesh.first_index, submesh.index_count), {}, submesh.material});
+
+            return obj_stream_stats{data.vertices.size(), data.indices.size(), data.materials, data.submeshes};
+        };
+    }
+    else
+    {
+        produce = [&](obj_batch_consumer const & consumer)
+        {
+            return parse_obj_streaming(path, cache_batch_size, consumer);
+        };
+    }
+
+    if (write_cache(produce, derived, cache_path, key, hash_source()) && try_cache())
+        return result;
+
+    // The cache could not be written (e.g. a read-only directory), parse the file directly
+    result.data = parse_obj_parallel(path);
+    if (processing.process)
+        processing.process(result.data);
+    result.derived_data = derive(result.data);
+    result.derived = result.derived_data;
+    result.vertices = result.data.vertices;
+    result.indices = result.data.indices;
+    result.tangents = result.data.tangents;
+    result.materials = result.data.materials;
+    result.submeshes = result.data.submeshes;
+    return result;
+}